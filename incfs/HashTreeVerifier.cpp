@@ -0,0 +1,214 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "incfs-verifier"
+
+#include "HashTreeVerifier.h"
+
+#include <lz4.h>
+#include <openssl/sha.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "SignatureView.h"
+#include "hashtree.h"
+#include "parallel.h"
+
+namespace android::incfs {
+
+// Hashing a block takes a few microseconds, don't spawn threads for less than this.
+static constexpr auto kMinBlocksPerThread = 32;
+
+static void sha256(const char* data, size_t size, char digest[hashtree::kDigestSize]) {
+    ::SHA256((const uint8_t*)data, size, (uint8_t*)digest);
+}
+
+HashTreeVerifier::HashTreeVerifier(Size fileSize, std::string_view rootHash)
+      : mFileSize(fileSize), mRootHash(rootHash) {
+    const auto geometry = hashtree::geometry(fileSize);
+    mTree.resize(hashtree::size(geometry));
+    mVerified.resize(geometry.totalBlocks);
+}
+
+std::optional<HashTreeVerifier> HashTreeVerifier::fromSignature(Size fileSize,
+                                                                Span<const char> signature) {
+    const auto view = SignatureView::parse(signature);
+    if (!view) {
+        return {};
+    }
+    return HashTreeVerifier(fileSize, view->rootHash());
+}
+
+HashTreeVerifier::HashTreeVerifier(HashTreeVerifier&& other) noexcept {
+    *this = std::move(other);
+}
+
+HashTreeVerifier& HashTreeVerifier::operator=(HashTreeVerifier&& other) noexcept {
+    if (this != &other) {
+        std::scoped_lock lock(mLock, other.mLock);
+        mFileSize = other.mFileSize;
+        mRootHash = std::move(other.mRootHash);
+        mTree = std::move(other.mTree);
+        mVerified = std::move(other.mVerified);
+        mUnverified = std::move(other.mUnverified);
+    }
+    return *this;
+}
+
+// Returns the hash |hashBlock| has to match, or nullptr if its parent isn't verified yet.
+const char* HashTreeVerifier::expectedHashLocked(BlockIndex hashBlock) const {
+    const auto geometry = hashtree::geometry(mFileSize);
+    const auto level = hashtree::levelOf(geometry, hashBlock);
+    if (level == geometry.depth - 1) {
+        return mRootHash.data();
+    }
+    const auto index = hashBlock - geometry.levelOffset[level];
+    const auto parent = geometry.levelOffset[level + 1] + index / hashtree::kHashesPerBlock;
+    if (!mVerified[parent]) {
+        return nullptr;
+    }
+    return mTree.data() + Size(parent) * kBlockSize +
+            (index % hashtree::kHashesPerBlock) * hashtree::kDigestSize;
+}
+
+// Returns the hash |dataBlock| has to match, or nullptr if its hash block isn't verified yet.
+const char* HashTreeVerifier::expectedDataHashLocked(BlockIndex dataBlock) const {
+    const auto geometry = hashtree::geometry(mFileSize);
+    if (geometry.depth == 0) {
+        return mRootHash.data();
+    }
+    const auto leaf = geometry.levelOffset[0] + dataBlock / hashtree::kHashesPerBlock;
+    if (!mVerified[leaf]) {
+        return nullptr;
+    }
+    return mTree.data() + Size(leaf) * kBlockSize +
+            (dataBlock % hashtree::kHashesPerBlock) * hashtree::kDigestSize;
+}
+
+ErrorCode HashTreeVerifier::addHashBlocks(Span<const DataBlock> blocks,
+                                          std::vector<BlockIndex>* rejected) {
+    bool allGood = true;
+    const auto reject = [&](BlockIndex index) {
+        allGood = false;
+        if (rejected) {
+            rejected->push_back(index);
+        }
+    };
+
+    // Malformed blocks fail the whole batch before anything is copied, like IncFs_WriteBlocks().
+    for (auto&& block : blocks) {
+        if (!block.data || block.kind != INCFS_BLOCK_KIND_HASH || block.pageIndex < 0 ||
+            block.pageIndex >= BlockIndex(mVerified.size()) ||
+            block.compression != INCFS_COMPRESSION_KIND_NONE || block.dataSize != kBlockSize) {
+            reject(block.pageIndex);
+        }
+    }
+    if (!allGood) {
+        return -EINVAL;
+    }
+
+    std::unique_lock lock(mLock);
+    for (auto&& block : blocks) {
+        if (mVerified[block.pageIndex]) {
+            continue;
+        }
+        memcpy(mTree.data() + Size(block.pageIndex) * kBlockSize, block.data, kBlockSize);
+        mUnverified.insert(block.pageIndex);
+    }
+
+    // Parents are stored before their children, so a single pass in the index order verifies
+    // every block that has a complete path to the root.
+    for (auto it = mUnverified.begin(); it != mUnverified.end();) {
+        const auto index = *it;
+        const auto expected = expectedHashLocked(index);
+        if (!expected) {
+            ++it;
+            continue;
+        }
+        char digest[hashtree::kDigestSize];
+        sha256(mTree.data() + Size(index) * kBlockSize, kBlockSize, digest);
+        if (memcmp(digest, expected, sizeof(digest)) == 0) {
+            mVerified[index] = true;
+        } else {
+            reject(index);
+        }
+        it = mUnverified.erase(it);
+    }
+    return allGood ? 0 : -EBADMSG;
+}
+
+bool HashTreeVerifier::hasHashFor(BlockIndex dataBlock) const {
+    std::shared_lock lock(mLock);
+    return dataBlock >= 0 && dataBlock < hashtree::dataBlocks(mFileSize) &&
+            expectedDataHashLocked(dataBlock);
+}
+
+auto HashTreeVerifier::verifyLocked(const DataBlock& block) const -> Result {
+    const auto blocksCount = hashtree::dataBlocks(mFileSize);
+    if (block.kind != INCFS_BLOCK_KIND_DATA || block.pageIndex < 0 ||
+        block.pageIndex >= blocksCount || !block.data) {
+        return Result::Invalid;
+    }
+    const auto expected = expectedDataHashLocked(block.pageIndex);
+    if (!expected) {
+        return Result::MissingHash;
+    }
+
+    // The last block is hashed zero-padded to the full block size.
+    const auto size = block.pageIndex == blocksCount - 1
+            ? int(mFileSize - Size(block.pageIndex) * kBlockSize)
+            : kBlockSize;
+    char buffer[kBlockSize];
+    const char* data = block.data;
+    if (block.compression == INCFS_COMPRESSION_KIND_LZ4) {
+        if (LZ4_decompress_safe(block.data, buffer, block.dataSize, sizeof(buffer)) != size) {
+            return Result::Invalid;
+        }
+        data = buffer;
+    } else if (block.compression != INCFS_COMPRESSION_KIND_NONE || int(block.dataSize) != size) {
+        return Result::Invalid;
+    }
+    if (size < kBlockSize) {
+        if (data != buffer) {
+            memcpy(buffer, data, size);
+            data = buffer;
+        }
+        memset(buffer + size, 0, sizeof(buffer) - size);
+    }
+
+    char digest[hashtree::kDigestSize];
+    sha256(data, kBlockSize, digest);
+    return memcmp(digest, expected, sizeof(digest)) == 0 ? Result::Ok : Result::Corrupted;
+}
+
+auto HashTreeVerifier::verify(Span<const DataBlock> blocks) const -> std::vector<Result> {
+    std::vector<Result> results(blocks.size());
+    std::shared_lock lock(mLock);
+    details::parallelFor(blocks.size(), kMinBlocksPerThread,
+                         [&](size_t i) { results[i] = verifyLocked(blocks[i]); });
+    return results;
+}
+
+ErrorCode HashTreeVerifier::verifyAll(Span<const DataBlock> blocks) const {
+    const auto results = verify(blocks);
+    return std::all_of(results.begin(), results.end(),
+                       [](Result result) { return result == Result::Ok; })
+            ? 0
+            : -EBADMSG;
+}
+
+} // namespace android::incfs
@@ -259,6 +259,11 @@ void MountRegistry::reload() {
     (void)ensureUpToDate();
 }
 
+uint64_t MountRegistry::generation() {
+    auto lock = ensureUpToDate();
+    return mGeneration;
+}
+
 std::unique_lock<std::mutex> MountRegistry::ensureUpToDate() {
     pollfd pfd = {.fd = mMountInfo.get(), .events = POLLERR | POLLPRI};
     const auto res = TEMP_FAILURE_RETRY(poll(&pfd, 1, 0));
@@ -270,6 +275,7 @@ std::unique_lock<std::mutex> MountRegistry::ensureUpToDate() {
     // reload even if poll() fails: (1) it usually doesn't and (2) it's better to be safe.
     std::unique_lock lock(mDataMutex);
     mMounts.loadFrom(mMountInfo, mFilesystem);
+    ++mGeneration;
     return lock;
 }
 
@@ -0,0 +1,359 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "incfs-walker"
+
+#include "MountWalker.h"
+
+#include <android-base/logging.h>
+#include <android-base/stringprintf.h>
+#include <android-base/unique_fd.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <unordered_set>
+
+#include "path.h"
+
+using android::base::unique_fd;
+
+namespace android::incfs {
+
+namespace {
+
+// Directories are opened only when a worker takes them, so the queued ones don't hold an fd;
+// they share their parent's one instead.
+struct DirTask {
+    std::shared_ptr<const unique_fd> parent;
+    std::string name;
+    std::string path; // relative to the mount root, empty for the root itself
+};
+
+class Walker {
+public:
+    Walker(bool loadingState, int threads) : mLoadingState(loadingState) {
+        for (int i = 0; i < threads; ++i) {
+            mWorkers.push_back(std::make_unique<Worker>());
+        }
+    }
+
+    ErrorCode operator()(unique_fd root, MountInventory* inventory);
+
+private:
+    struct Worker {
+        std::mutex lock;
+        std::deque<DirTask> tasks;
+        MountInventory result;
+        // Files of the current directory that still need their loading state.
+        std::vector<std::pair<size_t, std::string>> unknownState;
+    };
+
+    void push(int self, DirTask&& task) {
+        ++mPending;
+        {
+            auto& worker = *mWorkers[self];
+            std::lock_guard lock(worker.lock);
+            worker.tasks.push_back(std::move(task));
+        }
+        {
+            std::lock_guard lock(mIdleLock);
+            ++mQueued;
+        }
+        mIdle.notify_one();
+    }
+    void wakeAll() {
+        std::lock_guard lock(mIdleLock);
+        mIdle.notify_all();
+    }
+    bool popOrSteal(int self, DirTask* task);
+    void run(int self);
+    void setError(ErrorCode err);
+    ErrorCode walkDir(int self, const DirTask& dir);
+    ErrorCode addFile(int self, int dirFd, const std::string& dirPath, std::string_view name);
+
+    const bool mLoadingState;
+    // Ids in the root's .incomplete directory, if the kernel has one: no per-file queries then.
+    std::optional<std::unordered_set<FileId>> mIncomplete;
+    std::vector<std::unique_ptr<Worker>> mWorkers;
+    // Directories queued or being walked.
+    std::atomic<int> mPending = 0;
+    // Directories queued, the workers with nothing to do sleep until there are some.
+    std::atomic<int> mQueued = 0;
+    std::mutex mIdleLock;
+    std::condition_variable mIdle;
+    std::atomic<int> mError = 0;
+};
+
+// Own tasks are taken depth-first from the back, stolen ones from the front, where the larger
+// subtrees usually are.
+bool Walker::popOrSteal(int self, DirTask* task) {
+    for (size_t i = 0; i < mWorkers.size(); ++i) {
+        auto& worker = *mWorkers[(self + i) % mWorkers.size()];
+        std::lock_guard lock(worker.lock);
+        if (worker.tasks.empty()) {
+            continue;
+        }
+        if (i == 0) {
+            *task = std::move(worker.tasks.back());
+            worker.tasks.pop_back();
+        } else {
+            *task = std::move(worker.tasks.front());
+            worker.tasks.pop_front();
+        }
+        --mQueued;
+        return true;
+    }
+    return false;
+}
+
+void Walker::setError(ErrorCode err) {
+    int expected = 0;
+    mError.compare_exchange_strong(expected, err);
+    wakeAll();
+}
+
+void Walker::run(int self) {
+    for (;;) {
+        DirTask task;
+        if (!popOrSteal(self, &task)) {
+            std::unique_lock lock(mIdleLock);
+            mIdle.wait(lock, [this] { return mPending == 0 || mError || mQueued > 0; });
+            if (mPending == 0 || mError) {
+                return;
+            }
+            continue;
+        }
+        if (const auto err = walkDir(self, task)) {
+            LOG(ERROR) << "Failed to walk '" << task.path << "': " << err;
+            setError(err);
+        }
+        if (--mPending == 0) {
+            wakeAll();
+        }
+    }
+}
+
+ErrorCode Walker::addFile(int self, int dirFd, const std::string& dirPath,
+                          std::string_view name) {
+    // There's no getxattrat(), but a path through /proc/self/fd/ only walks from the directory.
+    const auto procPath =
+            base::StringPrintf("/proc/self/fd/%d/%.*s", dirFd, int(name.size()), name.data());
+    char id[kIncFsFileIdStringLength];
+    if (::getxattr(procPath.c_str(), kIdAttrName, id, sizeof(id)) != sizeof(id)) {
+        // Not an IncFS file, e.g. one of the special files in the root.
+        return 0;
+    }
+    struct stat st;
+    if (::fstatat(dirFd, std::string(name).c_str(), &st, AT_SYMLINK_NOFOLLOW)) {
+        // Unlinked while we were looking at it: it's not a part of the mount anymore.
+        return errno == ENOENT ? 0 : -errno;
+    }
+    const auto metadataSize = ::getxattr(procPath.c_str(), kMetadataAttrName, nullptr, 0);
+
+    auto& worker = *mWorkers[self];
+    auto& result = worker.result;
+    result.pathOffsets.push_back(result.pathArena.size());
+    if (!dirPath.empty()) {
+        result.pathArena += dirPath;
+        result.pathArena += '/';
+    }
+    result.pathArena += name;
+    result.ids.push_back(toFileId({id, sizeof(id)}));
+    result.sizes.push_back(st.st_size);
+    result.metadataSizes.push_back(std::max<ssize_t>(0, metadataSize));
+    if (mLoadingState) {
+        if (mIncomplete) {
+            result.loadingStates.push_back(mIncomplete->count(result.ids.back())
+                                                   ? LoadingState::MissingBlocks
+                                                   : LoadingState::Full);
+        } else {
+            result.loadingStates.push_back(LoadingState::MissingBlocks);
+            worker.unknownState.emplace_back(result.size() - 1, name);
+        }
+    }
+    return 0;
+}
+
+// Drops the file at |index| from |result|, e.g. when it got unlinked during the walk.
+static void eraseFile(MountInventory* result, size_t index) {
+    const auto begin = result->pathOffsets[index];
+    const auto end = index + 1 < result->pathOffsets.size() ? result->pathOffsets[index + 1]
+                                                            : result->pathArena.size();
+    result->pathArena.erase(begin, end - begin);
+    result->pathOffsets.erase(result->pathOffsets.begin() + index);
+    for (auto i = index; i < result->pathOffsets.size(); ++i) {
+        result->pathOffsets[i] -= end - begin;
+    }
+    result->ids.erase(result->ids.begin() + index);
+    result->sizes.erase(result->sizes.begin() + index);
+    result->metadataSizes.erase(result->metadataSizes.begin() + index);
+    if (index < result->loadingStates.size()) {
+        result->loadingStates.erase(result->loadingStates.begin() + index);
+    }
+}
+
+ErrorCode Walker::walkDir(int self, const DirTask& dir) {
+    const auto dirFd = std::make_shared<const unique_fd>(
+            ::openat(dir.parent->get(), dir.name.c_str(),
+                     O_RDONLY | O_DIRECTORY | O_CLOEXEC | O_NOFOLLOW));
+    if (!dirFd->ok()) {
+        // Same as for the files, a directory removed during the walk is just skipped.
+        return errno == ENOENT ? 0 : -errno;
+    }
+    const auto fd = dirFd->get();
+    const auto res = path::forEachEntry(fd, [&](const char* name, unsigned char type) {
+        // The same files are reachable by their ids in the root's special directories.
+        if (dir.path.empty() &&
+            (name == std::string_view(kIndexDir) || name == std::string_view(kIncompleteDir))) {
+            return 0;
+        }
+        if (type == DT_UNKNOWN) {
+            struct stat st;
+            if (::fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW)) {
+                return errno == ENOENT ? 0 : -errno;
+            }
+            type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+        }
+        if (type == DT_DIR) {
+            push(self,
+                 {dirFd, name, dir.path.empty() ? std::string(name) : path::join(dir.path, name)});
+        } else if (type == DT_REG) {
+            return addFile(self, fd, dir.path, name);
+        }
+        return 0;
+    });
+    if (res) {
+        return res;
+    }
+
+    // Older kernels have no .incomplete directory, so each file has to be asked. Do it after
+    // the listing, while the directory's entries are cached.
+    auto& worker = *mWorkers[self];
+    ErrorCode err = 0;
+    std::vector<size_t> unlinked;
+    for (auto&& [index, name] : worker.unknownState) {
+        const unique_fd fileFd(::openat(fd, name.c_str(), O_RDONLY | O_CLOEXEC));
+        if (!fileFd.ok()) {
+            if (errno == ENOENT) {
+                unlinked.push_back(index);
+                continue;
+            }
+            err = -errno;
+            break;
+        }
+        const auto loaded = IncFs_IsFullyLoaded(fileFd.get());
+        if (loaded != 0 && loaded != -ENODATA) {
+            err = loaded;
+            break;
+        }
+        worker.result.loadingStates[index] =
+                loaded == 0 ? LoadingState::Full : LoadingState::MissingBlocks;
+    }
+    worker.unknownState.clear();
+    // Back to front, so the indices of the ones left stay valid.
+    for (auto it = unlinked.rbegin(); it != unlinked.rend(); ++it) {
+        eraseFile(&worker.result, *it);
+    }
+    return err;
+}
+
+// Every file that misses blocks has a link named by its id in .incomplete. A single listing
+// there gives all the loading states at once.
+static std::optional<std::unordered_set<FileId>> incompleteIds(int rootFd) {
+    const unique_fd fd(
+            ::openat(rootFd, kIncompleteDir, O_RDONLY | O_DIRECTORY | O_CLOEXEC | O_NOFOLLOW));
+    if (!fd.ok()) {
+        return {};
+    }
+    std::unordered_set<FileId> ids;
+    if (path::forEachEntry(fd.get(), [&](const char* name, unsigned char) {
+            ids.insert(toFileId(name));
+            return 0;
+        })) {
+        return {};
+    }
+    return ids;
+}
+
+ErrorCode Walker::operator()(unique_fd root, MountInventory* inventory) {
+    if (mLoadingState) {
+        mIncomplete = incompleteIds(root.get());
+    }
+    push(0, {std::make_shared<const unique_fd>(std::move(root)), ".", {}});
+    std::vector<std::thread> pool;
+    for (int i = 1; i < int(mWorkers.size()); ++i) {
+        pool.emplace_back([this, i] { run(i); });
+    }
+    run(0);
+    for (auto&& thread : pool) {
+        thread.join();
+    }
+    if (mError) {
+        return mError;
+    }
+
+    *inventory = {};
+    for (auto&& worker : mWorkers) {
+        auto& result = worker->result;
+        const auto base = inventory->pathArena.size();
+        inventory->pathArena += result.pathArena;
+        for (auto offset : result.pathOffsets) {
+            inventory->pathOffsets.push_back(base + offset);
+        }
+        const auto append = [](auto& to, auto& from) {
+            to.insert(to.end(), from.begin(), from.end());
+        };
+        append(inventory->ids, result.ids);
+        append(inventory->sizes, result.sizes);
+        append(inventory->metadataSizes, result.metadataSizes);
+        append(inventory->loadingStates, result.loadingStates);
+    }
+    return 0;
+}
+
+} // namespace
+
+ErrorCode walkMount(const Control& control, MountInventory* inventory, WalkOptions options) {
+    if (!inventory) {
+        return -EINVAL;
+    }
+    const auto mountRoot = root(control);
+    if (mountRoot.empty()) {
+        return -EINVAL;
+    }
+    unique_fd fd(::open(mountRoot.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+    if (!fd.ok()) {
+        return -errno;
+    }
+    const auto threads = options.threads > 0
+            ? options.threads
+            : int(std::max(1u, std::thread::hardware_concurrency()));
+    return Walker(options.loadingState, threads)(std::move(fd), inventory);
+}
+
+} // namespace android::incfs
@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#define LOG_TAG "incfs-readlog"
+
+#include "ReadLogMonitor.h"
+
+namespace android::incfs {
+
+// Serial numbers further ahead than this are taken for ones going backwards.
+static constexpr uint32_t kMaxSerialStep = 1u << 31;
+
+void ReadLogMonitor::onRecords(const IncFsReadInfo reads[], size_t count) {
+    std::lock_guard lock(mLock);
+    for (size_t i = 0; i < count; ++i) {
+        const auto& read = reads[i];
+        if (mStats.records > 0) {
+            // Unsigned, so it wraps around together with the serial numbers.
+            const uint32_t step = read.serialNo - mLastSerial;
+            if (step == 0 || step > kMaxSerialStep || read.bootClockTsUs < mLastTsUs) {
+                ++mStats.discontinuities;
+            } else if (step > 1) {
+                mStats.droppedRecords += step - 1;
+                ++mStats.gaps;
+            }
+        }
+        mLastSerial = read.serialNo;
+        mLastTsUs = read.bootClockTsUs;
+        ++mStats.records;
+    }
+}
+
+IncFsReadLogStats ReadLogMonitor::stats() const {
+    std::lock_guard lock(mLock);
+    return mStats;
+}
+
+} // namespace android::incfs
@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "incfs-signature"
+
+#include "SignatureView.h"
+
+#include <string.h>
+
+namespace android::incfs {
+
+namespace {
+
+// Reads the fields one after another, without copying anything but the integers.
+class Cursor {
+public:
+    Cursor(const char* data, size_t size) : mData(data), mSize(size) {}
+
+    template <class T>
+    std::optional<T> read() {
+        if (remaining() < sizeof(T)) {
+            return {};
+        }
+        T res;
+        memcpy(&res, mData + mPos, sizeof(res));
+        mPos += sizeof(res);
+        return res;
+    }
+    bool skip(size_t size) {
+        if (remaining() < size) {
+            return false;
+        }
+        mPos += size;
+        return true;
+    }
+    uint32_t pos() const { return mPos; }
+    size_t remaining() const { return mSize - mPos; }
+
+private:
+    const char* const mData;
+    const size_t mSize;
+    uint32_t mPos = 0;
+};
+
+} // namespace
+
+std::optional<SignatureView> SignatureView::parse(Span<const char> signature, ErrorCode* error) {
+    const auto fail = [error](ErrorCode err) {
+        if (error) {
+            *error = err;
+        }
+        return std::nullopt;
+    };
+
+    // These structs are here purely for checking the minimum size.
+    struct __attribute__((packed)) Hashing {
+        int32_t size;
+        int32_t algorithm;
+        int8_t log2_blocksize;
+        int32_t salt_size;
+        int32_t raw_root_hash_size;
+    };
+    struct __attribute__((packed)) Signing {
+        int32_t size;
+        int32_t apk_digest_size;
+        int32_t certificate_size;
+        int32_t addl_data_size;
+        int32_t public_key_size;
+        int32_t algorithm;
+        int32_t signature_size;
+    };
+    struct __attribute__((packed)) MinSignature {
+        int32_t version;
+        Hashing hashing_info;
+        Signing signing_info;
+    };
+    if (!signature.data() || signature.size() < sizeof(MinSignature) ||
+        signature.size() > INCFS_MAX_SIGNATURE_SIZE) {
+        return fail(-ERANGE);
+    }
+
+    SignatureView view(signature.data(), signature.size());
+    Cursor cursor(signature.data(), signature.size());
+    view.mVersion = cursor.read<int32_t>().value_or(-1);
+    if (view.mVersion != INCFS_SIGNATURE_VERSION) {
+        return fail(-EINVAL);
+    }
+    const auto hashingSize = cursor.read<int32_t>();
+    if (!hashingSize || *hashingSize < 0 || cursor.remaining() < size_t(*hashingSize)) {
+        return fail(-EINVAL);
+    }
+    view.mHashing = {cursor.pos(), uint32_t(*hashingSize)};
+    if (cursor.read<int32_t>().value_or(-1) != INCFS_HASH_TREE_SHA256) {
+        return fail(-EINVAL);
+    }
+    view.mHashAlgorithm = HashAlgorithm::sha256;
+    view.mLog2BlockSize = cursor.read<int8_t>().value_or(-1);
+    if (view.mLog2BlockSize != 12 /* 2^12 == 4096 */) {
+        return fail(-EINVAL);
+    }
+    const auto saltSize = cursor.read<int32_t>();
+    if (saltSize.value_or(-1) != 0) {
+        return fail(-EINVAL);
+    }
+    view.mSalt = {cursor.pos(), 0};
+    const auto rootHashSize = cursor.read<int32_t>();
+    if (rootHashSize.value_or(-1) != INCFS_MAX_HASH_SIZE) {
+        return fail(-EINVAL);
+    }
+    view.mRootHash = {cursor.pos(), uint32_t(*rootHashSize)};
+    if (!cursor.skip(*rootHashSize)) {
+        return fail(-EINVAL);
+    }
+    // everything remaining has to be in the signing info
+    const auto signingSize = cursor.read<int32_t>();
+    if (!signingSize || *signingSize < 0 || size_t(*signingSize) != cursor.remaining()) {
+        return fail(-EINVAL);
+    }
+    view.mSigning = {cursor.pos(), uint32_t(*signingSize)};
+
+    // TODO: validate the signature part too.
+    return view;
+}
+
+} // namespace android::incfs
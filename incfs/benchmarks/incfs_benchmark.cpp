@@ -0,0 +1,194 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <android-base/file.h>
+#include <android-base/stringprintf.h>
+#include <benchmark/benchmark.h>
+#include <sys/vfs.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "incfs.h"
+
+using namespace android::incfs;
+
+// Metadata of a typical installation: a path to the file in the package, longer than an id.
+static std::vector<std::string> makeManifest(int files) {
+    std::vector<std::string> metadata;
+    metadata.reserve(files);
+    for (int i = 0; i < files; ++i) {
+        metadata.push_back(android::base::StringPrintf("base.apk/assets/resources/%08d.bin", i));
+    }
+    return metadata;
+}
+
+static std::vector<IncFsSpan> spans(const std::vector<std::string>& metadata) {
+    std::vector<IncFsSpan> result;
+    result.reserve(metadata.size());
+    for (auto&& md : metadata) {
+        result.push_back({md.data(), IncFsSize(md.size())});
+    }
+    return result;
+}
+
+static void BM_FileIdFromMetadata(benchmark::State& state) {
+    const auto metadata = makeManifest(state.range(0));
+    const auto input = spans(metadata);
+    for (auto _ : state) {
+        for (auto&& md : input) {
+            benchmark::DoNotOptimize(IncFs_FileIdFromMetadata(md));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * input.size());
+}
+BENCHMARK(BM_FileIdFromMetadata)->Arg(1000)->Arg(100000);
+
+static void BM_FileIdsFromMetadata(benchmark::State& state) {
+    const auto metadata = makeManifest(state.range(0));
+    const auto input = spans(metadata);
+    std::vector<IncFsFileId> ids(input.size());
+    for (auto _ : state) {
+        IncFs_FileIdsFromMetadata(input.data(), input.size(), ids.data());
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * input.size());
+}
+BENCHMARK(BM_FileIdsFromMetadata)->Arg(1000)->Arg(100000)->UseRealTime();
+
+// Mount-to-ready time: from IncFs_Mount() until the control is usable, with each phase reported.
+// Needs root and IncFS.
+static void BM_MountToReady(benchmark::State& state) {
+    if (!enabled()) {
+        state.SkipWithError("IncFS is not enabled");
+        return;
+    }
+    const TemporaryDir backing;
+    const TemporaryDir target;
+    const auto flags = IncFsMountFlags(INCFS_MOUNT_TRUNCATE | state.range(0));
+    MountTimings total = {};
+    for (auto _ : state) {
+        MountTimings timings;
+        auto control = mount(backing.path, target.path, MountOptions{.flags = flags}, &timings);
+        state.PauseTiming();
+        if (control.cmd() < 0) {
+            state.SkipWithError("mount() failed");
+            break;
+        }
+        control = {};
+        unmount(target.path);
+        total.validateUs += timings.validateUs;
+        total.prepareBackingUs += timings.prepareBackingUs;
+        total.mountUs += timings.mountUs;
+        total.restoreconUs += timings.restoreconUs;
+        total.controlUs += timings.controlUs;
+        state.ResumeTiming();
+    }
+    const auto average = [&](int64_t us) {
+        return benchmark::Counter(us, benchmark::Counter::kAvgIterations);
+    };
+    state.counters["validate_us"] = average(total.validateUs);
+    state.counters["prepare_us"] = average(total.prepareBackingUs);
+    state.counters["mount_us"] = average(total.mountUs);
+    state.counters["restorecon_us"] = average(total.restoreconUs);
+    state.counters["control_us"] = average(total.controlUs);
+}
+BENCHMARK(BM_MountToReady)->Arg(0)->Arg(INCFS_MOUNT_FAST_SETUP)->UseRealTime();
+
+// Telling IncFS paths from the rest: a plain statfs() per path, as IncFs_IsIncFsPath() does,
+// against the device id cache IncFs_AreIncFsPaths() uses for batches. The paths are regular files
+// in a temporary directory, so this runs without IncFS; with |state.range(1)| set they're on
+// a fresh IncFS mount instead.
+class IsIncFsPathFixture {
+public:
+    explicit IsIncFsPathFixture(benchmark::State& state) {
+        const bool onIncFs = state.range(1);
+        if (onIncFs) {
+            if (!enabled()) {
+                state.SkipWithError("IncFS is not enabled");
+                return;
+            }
+            mBacking = std::make_unique<TemporaryDir>();
+            mControl = mount(mBacking->path, mDir.path, MountOptions{});
+            if (mControl.cmd() < 0) {
+                state.SkipWithError("mount() failed");
+                return;
+            }
+        }
+        for (int i = 0; i < state.range(0); ++i) {
+            auto path = android::base::StringPrintf("%s/file_%d", mDir.path, i);
+            const auto res = onIncFs
+                    ? makeFile(mControl, path, 0555, fileId(i), {})
+                    : (android::base::WriteStringToFile("", path) ? 0 : -EIO);
+            if (res) {
+                state.SkipWithError("failed to create the files");
+                return;
+            }
+            mPaths.push_back(std::move(path));
+        }
+        for (auto&& path : mPaths) {
+            mPathPtrs.push_back(path.c_str());
+        }
+    }
+    ~IsIncFsPathFixture() {
+        if (mControl.cmd() >= 0) {
+            mControl = {};
+            unmount(mDir.path);
+        }
+    }
+
+    const std::vector<const char*>& paths() const { return mPathPtrs; }
+
+private:
+    static FileId fileId(int i) {
+        FileId id = {};
+        memcpy(id.data, &i, sizeof(i));
+        return id;
+    }
+
+    const TemporaryDir mDir;
+    std::unique_ptr<TemporaryDir> mBacking;
+    UniqueControl mControl;
+    std::vector<std::string> mPaths;
+    std::vector<const char*> mPathPtrs;
+};
+
+static void BM_IsIncFsPathStatfs(benchmark::State& state) {
+    const IsIncFsPathFixture fixture(state);
+    for (auto _ : state) {
+        for (auto path : fixture.paths()) {
+            struct statfs fs = {};
+            benchmark::DoNotOptimize(::statfs(path, &fs) == 0 &&
+                                     fs.f_type == (decltype(fs.f_type))INCFS_MAGIC_NUMBER);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * fixture.paths().size());
+}
+BENCHMARK(BM_IsIncFsPathStatfs)->Args({100, 0})->Args({100, 1});
+
+static void BM_IsIncFsPathBatch(benchmark::State& state) {
+    const IsIncFsPathFixture fixture(state);
+    auto results = std::make_unique<bool[]>(fixture.paths().size());
+    for (auto _ : state) {
+        IncFs_AreIncFsPaths(fixture.paths().data(), fixture.paths().size(), results.get());
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * fixture.paths().size());
+}
+BENCHMARK(BM_IsIncFsPathBatch)->Args({100, 0})->Args({100, 1});
+
+BENCHMARK_MAIN();
@@ -23,6 +23,7 @@
 #include <android-base/logging.h>
 #include <android-base/no_destructor.h>
 #include <android-base/parsebool.h>
+#include <android-base/scopeguard.h>
 #include <android-base/stringprintf.h>
 #include <android-base/strings.h>
 #include <android-base/unique_fd.h>
@@ -30,9 +31,11 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <libgen.h>
+#include <lz4.h>
 #include <openssl/sha.h>
 #include <selinux/android.h>
 #include <selinux/selinux.h>
+#include <sys/mman.h>
 #include <sys/mount.h>
 #include <sys/poll.h>
 #include <sys/stat.h>
@@ -42,27 +45,164 @@
 #include <sys/xattr.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <chrono>
 #include <fstream>
 #include <iterator>
+#include <list>
+#include <memory>
 #include <mutex>
 #include <optional>
+#include <set>
+#include <shared_mutex>
 #include <string_view>
+#include <thread>
+#include <unordered_map>
 
 #include "MountRegistry.h"
+#include "ReadLogMonitor.h"
+#include "SignatureView.h"
+#include "hashtree.h"
+#include "parallel.h"
 #include "path.h"
+#include "rmtree.h"
 
 using namespace std::literals;
 
 using android::base::StringPrintf;
 using android::base::unique_fd;
 
+static std::string rootForCmd(int fd);
+
+// Files' metadata and signatures don't change while the file exists, so they can be cached for
+// as long as there's room. The oldest entries get evicted first. An id may get reused after the
+// file is unlinked: creating or unlinking a file through the same control updates its entry,
+// but the cache doesn't notice ids freed and recreated through another control, another
+// process, or a plain unlink() of the .index entry. Those keep returning the old values until
+// evicted, which is fine for the loaders that never reuse ids within a mount.
+class FileAttrCache final {
+public:
+    explicit FileAttrCache(size_t maxEntries) : mMaxEntries(maxEntries) {}
+
+    // Calls |func(value)| under the lock; returns false if |id| isn't cached.
+    template <class Func>
+    bool find(IncFsFileId id, Func&& func) const {
+        std::shared_lock lock(mLock);
+        const auto it = mEntries.find(id);
+        if (it == mEntries.end()) {
+            return false;
+        }
+        func(std::string_view(it->second.value));
+        return true;
+    }
+
+    void put(IncFsFileId id, std::string_view value) {
+        std::unique_lock lock(mLock);
+        const auto [it, inserted] = mEntries.try_emplace(id);
+        it->second.value = value;
+        if (!inserted) {
+            return;
+        }
+        it->second.order = mOrder.insert(mOrder.end(), id);
+        if (mOrder.size() > mMaxEntries) {
+            mEntries.erase(mOrder.front());
+            mOrder.pop_front();
+        }
+    }
+
+    void erase(IncFsFileId id) {
+        std::unique_lock lock(mLock);
+        const auto it = mEntries.find(id);
+        if (it == mEntries.end()) {
+            return;
+        }
+        mOrder.erase(it->second.order);
+        mEntries.erase(it);
+    }
+
+private:
+    struct Entry {
+        std::string value;
+        std::list<IncFsFileId>::iterator order;
+    };
+
+    const size_t mMaxEntries;
+    std::unordered_map<IncFsFileId, Entry> mEntries;
+    std::list<IncFsFileId> mOrder;
+    mutable std::shared_mutex mLock;
+};
+
+// Directories already created or found through a control, so laying out a deep tree doesn't
+// mkdir() every parent again for each file. Removals through the same control forget the
+// whole subtree; directories removed behind its back aren't noticed.
+class KnownDirs final {
+public:
+    static constexpr size_t kMaxEntries = 64 * 1024;
+
+    bool contains(std::string_view dir) const {
+        std::shared_lock lock(mLock);
+        return mDirs.find(dir) != mDirs.end();
+    }
+
+    void add(std::string_view dir) {
+        std::unique_lock lock(mLock);
+        if (mDirs.size() >= kMaxEntries) {
+            mDirs.clear();
+        }
+        mDirs.emplace(dir);
+    }
+
+    void removeTree(std::string_view dir) {
+        std::unique_lock lock(mLock);
+        if (const auto it = mDirs.find(dir); it != mDirs.end()) {
+            mDirs.erase(it);
+        }
+        // Siblings like "dir-1" sort between "dir" and "dir/", so only look past the latter.
+        const auto prefix = std::string(dir) + '/';
+        auto it = mDirs.lower_bound(prefix);
+        while (it != mDirs.end() && it->starts_with(prefix)) {
+            it = mDirs.erase(it);
+        }
+    }
+
+private:
+    std::set<std::string, std::less<>> mDirs;
+    mutable std::shared_mutex mLock;
+};
+
+// Same contract as IncFs_GetMetadataById(): a small buffer only gets the needed size back.
+static void copyMetadata(std::string_view metadata, char buffer[], size_t* bufferSize) {
+    if (metadata.size() <= *bufferSize) {
+        memcpy(buffer, metadata.data(), metadata.size());
+    }
+    *bufferSize = metadata.size();
+}
+
 struct IncFsControl final {
     IncFsFd cmd;
     IncFsFd pendingReads;
     IncFsFd logs;
-    constexpr IncFsControl(IncFsFd cmd, IncFsFd pendingReads, IncFsFd logs)
+    IncFsControl(IncFsFd cmd, IncFsFd pendingReads, IncFsFd logs)
           : cmd(cmd), pendingReads(pendingReads), logs(logs) {}
+
+    // The mount root of the |cmd| file, looked up on the first use only.
+    const std::string& root() const {
+        std::call_once(mRootOnce, [this] { mRoot = rootForCmd(cmd); });
+        return mRoot;
+    }
+
+    FileAttrCache& metadataCache() const { return mMetadataCache; }
+    FileAttrCache& signatureCache() const { return mSignatureCache; }
+    KnownDirs& knownDirs() const { return mKnownDirs; }
+    android::incfs::ReadLogMonitor& readLogMonitor() const { return mReadLogMonitor; }
+
+private:
+    mutable FileAttrCache mMetadataCache{4096};
+    mutable FileAttrCache mSignatureCache{256};
+    mutable KnownDirs mKnownDirs;
+    mutable android::incfs::ReadLogMonitor mReadLogMonitor;
+    mutable std::once_flag mRootOnce;
+    mutable std::string mRoot;
 };
 
 static android::incfs::MountRegistry& registry() {
@@ -227,6 +367,38 @@ bool IncFs_IsEnabled() {
     return init().enabled();
 }
 
+// Remembers which devices are IncFS ones. A device number can only get reused after the
+// mounts change, and that drops the whole cache.
+class IncFsDevices final {
+public:
+    std::optional<bool> find(uint64_t generation, dev_t dev) {
+        std::lock_guard lock(mLock);
+        if (generation != mGeneration) {
+            mDevices.clear();
+            mGeneration = generation;
+            return {};
+        }
+        const auto it = mDevices.find(dev);
+        return it == mDevices.end() ? std::optional<bool>() : it->second;
+    }
+    void add(uint64_t generation, dev_t dev, bool isIncFs) {
+        std::lock_guard lock(mLock);
+        if (generation == mGeneration) {
+            mDevices.emplace(dev, isIncFs);
+        }
+    }
+
+private:
+    std::unordered_map<dev_t, bool> mDevices;
+    uint64_t mGeneration = 0;
+    std::mutex mLock;
+};
+
+static IncFsDevices& incFsDevices() {
+    static android::base::NoDestructor<IncFsDevices> instance{};
+    return *instance;
+}
+
 bool isIncFsPath(const char* path) {
     struct statfs fs = {};
     if (::statfs(path, &fs) != 0) {
@@ -237,6 +409,25 @@ bool isIncFsPath(const char* path) {
     return fs.f_type == (decltype(fs.f_type))INCFS_MAGIC_NUMBER;
 }
 
+// For IncFs_AreIncFsPaths() only: |generation| is taken once for the whole batch, so a hit
+// costs a single fstatat(). Single paths stay on the plain statfs() above, which is cheaper
+// than a mountinfo poll() plus the fstatat(); see BM_IsIncFsPath* in the benchmarks.
+static bool isIncFsPathCached(const char* path, uint64_t generation) {
+    struct stat st;
+    const bool haveDevice = ::fstatat(AT_FDCWD, path, &st, AT_NO_AUTOMOUNT) == 0;
+    if (haveDevice) {
+        if (const auto isIncFs = incFsDevices().find(generation, st.st_dev)) {
+            return *isIncFs;
+        }
+    }
+
+    const auto isIncFs = isIncFsPath(path);
+    if (haveDevice) {
+        incFsDevices().add(generation, st.st_dev, isIncFs);
+    }
+    return isIncFs;
+}
+
 static int isDir(const char* path) {
     struct stat st;
     if (::stat(path, &st) != 0) {
@@ -256,6 +447,7 @@ static int isValidMountTarget(const char* path) {
     if (!isAbsolute(path)) {
         return -EINVAL;
     }
+    // A new mount target is checked once, the cache wouldn't help.
     if (isIncFsPath(path)) {
         LOG(ERROR) << "[incfs] mounting over existing incfs mount is not allowed";
         return -EINVAL;
@@ -269,42 +461,39 @@ static int isValidMountTarget(const char* path) {
     return 0;
 }
 
-static int rmDirContent(const char* path) {
-    auto dir = android::incfs::path::openDir(path);
-    if (!dir) {
+// Same checks as isValidMountTarget(), but a single open() instead of resolving |path| for
+// each of them.
+static int isValidMountTargetFast(const char* path) {
+    if (!isAbsolute(path)) {
         return -EINVAL;
     }
-    while (auto entry = ::readdir(dir.get())) {
-        if (entry->d_name == "."sv || entry->d_name == ".."sv) {
-            continue;
-        }
-        auto fullPath = StringPrintf("%s/%s", path, entry->d_name);
-        if (entry->d_type == DT_DIR) {
-            if (const auto err = rmDirContent(fullPath.c_str()); err != 0) {
-                return err;
-            }
-            if (const auto err = ::rmdir(fullPath.c_str()); err != 0) {
-                return err;
-            }
-        } else {
-            if (const auto err = ::unlink(fullPath.c_str()); err != 0) {
-                return err;
-            }
-        }
+    const unique_fd fd(::open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+    if (!fd.ok()) {
+        return -errno;
     }
-    return 0;
+    struct statfs fs = {};
+    if (::fstatfs(fd.get(), &fs) != 0) {
+        return -errno;
+    }
+    if (fs.f_type == (decltype(fs.f_type))INCFS_MAGIC_NUMBER) {
+        LOG(ERROR) << "[incfs] mounting over existing incfs mount is not allowed";
+        return -EINVAL;
+    }
+    const auto notEmpty = [](const char*, unsigned char) { return -ENOTEMPTY; };
+    return android::incfs::path::forEachEntry(fd.get(), notEmpty);
 }
 
 static std::string makeMountOptionsString(IncFsMountOptions options) {
-    return StringPrintf("read_timeout_ms=%u,readahead=0,rlog_pages=%u,rlog_wakeup_cnt=1",
+    return StringPrintf("read_timeout_ms=%u,readahead=%u,rlog_pages=%u,rlog_wakeup_cnt=%u",
                         unsigned(options.defaultReadTimeoutMs),
+                        unsigned(std::max(0, options.readAheadPages)),
                         unsigned(options.readLogBufferPages < 0
                                          ? INCFS_DEFAULT_PAGE_READ_BUFFER_PAGES
-                                         : options.readLogBufferPages));
+                                         : options.readLogBufferPages),
+                        unsigned(std::max(1, options.readLogWakeupCount)));
 }
 
-static IncFsControl* makeControl(const char* root) {
-    auto cmd = openRaw(root, INCFS_PENDING_READS_FILENAME);
+static IncFsControl* makeControl(unique_fd cmd, unique_fd logs) {
     if (!cmd.ok()) {
         return nullptr;
     }
@@ -312,7 +501,6 @@ static IncFsControl* makeControl(const char* root) {
     if (!pendingReads.ok()) {
         return nullptr;
     }
-    auto logs = openRaw(root, INCFS_LOG_FILENAME);
     // logs may be absent, that's fine
     auto control = IncFs_CreateControl(cmd.get(), pendingReads.get(), logs.get());
     if (control) {
@@ -323,6 +511,18 @@ static IncFsControl* makeControl(const char* root) {
     return control;
 }
 
+static IncFsControl* makeControl(const char* root) {
+    return makeControl(openRaw(root, INCFS_PENDING_READS_FILENAME),
+                       openRaw(root, INCFS_LOG_FILENAME));
+}
+
+// Same as makeControl(), but opens the files relative to the mount root |rootFd|.
+static IncFsControl* makeControlAt(int rootFd) {
+    return makeControl(unique_fd(::openat(rootFd, INCFS_PENDING_READS_FILENAME,
+                                          O_RDONLY | O_CLOEXEC)),
+                       unique_fd(::openat(rootFd, INCFS_LOG_FILENAME, O_RDONLY | O_CLOEXEC)));
+}
+
 static std::string makeCommandPath(std::string_view root, std::string_view item) {
     auto [itemRoot, subpath] = registry().rootAndSubpathFor(item);
     if (itemRoot != root) {
@@ -332,6 +532,18 @@ static std::string makeCommandPath(std::string_view root, std::string_view item)
     return android::incfs::path::join(itemRoot, subpath);
 }
 
+// Same as makeCommandPath(), but doesn't go to the registry for paths that are already under
+// |root| - the most common case, and the only one batches have lots of.
+static std::string makeCommandPathUnder(std::string_view root, std::string_view item) {
+    if (item.starts_with('/')) {
+        auto normalized = android::incfs::path::normalize(item);
+        if (android::incfs::path::startsWith(normalized, root)) {
+            return normalized;
+        }
+    }
+    return makeCommandPath(root, item);
+}
+
 static void toString(IncFsFileId id, char* out) {
     // Make sure this function matches the one in the kernel (e.g. same case for a-f digits).
     static constexpr char kHexChar[] = "0123456789abcdef";
@@ -405,7 +617,23 @@ IncFsFileId IncFs_FileIdFromMetadata(IncFsSpan metadata) {
     return id;
 }
 
-static bool restoreconControlFiles(std::string_view targetDir) {
+// Hashing typical metadata takes well under a microsecond, only large batches need threads.
+static constexpr auto kMinHashedIdsPerThread = 1024;
+
+IncFsErrorCode IncFs_FileIdsFromMetadata(const IncFsSpan metadata[], size_t count,
+                                         IncFsFileId ids[]) {
+    if (count && (!metadata || !ids)) {
+        return -EINVAL;
+    }
+    // BoringSSL's SHA-1 already picks the SHA-NI or ARMv8 crypto code when the CPU has it;
+    // spreading the batch over the cores is what's left to gain.
+    android::incfs::details::parallelFor(count, kMinHashedIdsPerThread, [&](size_t i) {
+        ids[i] = IncFs_FileIdFromMetadata(metadata[i]);
+    });
+    return 0;
+}
+
+static int restoreconControlFiles(std::string_view targetDir) {
     const std::string controlFilePaths[] =
             {android::incfs::path::join(targetDir, INCFS_PENDING_READS_FILENAME),
              android::incfs::path::join(targetDir, INCFS_LOG_FILENAME)};
@@ -415,22 +643,76 @@ static bool restoreconControlFiles(std::string_view targetDir) {
             err != 0) {
             PLOG(ERROR) << "[incfs] Failed to restorecon: " << controlFilePaths[i]
                         << " error code: " << err;
-            errno = -err;
-            return false;
+            return err < 0 ? err : -EPERM;
         }
     }
-    return true;
+    return 0;
 }
 
+// Records how long each phase of IncFs_Mount() took, if anyone asked for it.
+class MountTimer final {
+public:
+    using Clock = std::chrono::steady_clock;
+    using Phase = int64_t IncFsMountTimings::*;
+
+    explicit MountTimer(IncFsMountTimings* timings)
+          : mTimings(timings), mStart(Clock::now()), mLast(mStart) {
+        if (mTimings) {
+            *mTimings = {};
+        }
+    }
+    ~MountTimer() {
+        if (mTimings) {
+            mTimings->totalUs = micros(Clock::now() - mStart);
+            LOG(DEBUG) << "[incfs] mount took " << mTimings->totalUs
+                       << "us: validate=" << mTimings->validateUs
+                       << " prepare=" << mTimings->prepareBackingUs
+                       << " mount=" << mTimings->mountUs
+                       << " restorecon=" << mTimings->restoreconUs
+                       << " control=" << mTimings->controlUs;
+        }
+    }
+
+    // Ends |phase|, the next one starts now.
+    void done(Phase phase) {
+        const auto now = Clock::now();
+        set(phase, now - mLast);
+        mLast = now;
+    }
+    void set(Phase phase, Clock::duration duration) {
+        if (mTimings) {
+            mTimings->*phase = micros(duration);
+        }
+    }
+
+private:
+    static int64_t micros(Clock::duration d) {
+        return std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+    }
+
+    IncFsMountTimings* const mTimings;
+    const Clock::time_point mStart;
+    Clock::time_point mLast;
+};
+
 IncFsControl* IncFs_Mount(const char* backingPath, const char* targetDir,
                           IncFsMountOptions options) {
+    return IncFs_MountWithTimings(backingPath, targetDir, options, nullptr);
+}
+
+IncFsControl* IncFs_MountWithTimings(const char* backingPath, const char* targetDir,
+                                     IncFsMountOptions options, IncFsMountTimings* timings) {
+    // Before any early return: callers may read |timings| on failure too.
+    MountTimer timer(timings);
     if (!init().enabledAndReady()) {
         LOG(WARNING) << "[incfs] Feature is not enabled";
         errno = ENOTSUP;
         return nullptr;
     }
 
-    if (auto err = isValidMountTarget(targetDir); err != 0) {
+    const bool fast = options.flags & android::incfs::fastSetup;
+    if (auto err = fast ? isValidMountTargetFast(targetDir) : isValidMountTarget(targetDir);
+        err != 0) {
         errno = -err;
         return nullptr;
     }
@@ -438,6 +720,7 @@ IncFsControl* IncFs_Mount(const char* backingPath, const char* targetDir,
         errno = EINVAL;
         return nullptr;
     }
+    timer.done(&IncFsMountTimings::validateUs);
 
     if (options.flags & android::incfs::createOnly) {
         if (const auto err = android::incfs::path::isEmptyDir(backingPath); err != 0) {
@@ -445,11 +728,15 @@ IncFsControl* IncFs_Mount(const char* backingPath, const char* targetDir,
             return nullptr;
         }
     } else if (options.flags & android::incfs::truncate) {
-        if (const auto err = rmDirContent(backingPath); err != 0) {
+        const auto err = (options.flags & android::incfs::truncateAsync) && options.trashDir
+                ? android::incfs::rmtree::removeContentAsync(backingPath, options.trashDir)
+                : android::incfs::rmtree::removeContent(backingPath);
+        if (err != 0) {
             errno = -err;
             return nullptr;
         }
     }
+    timer.done(&IncFsMountTimings::prepareBackingUs);
 
     const auto opts = makeMountOptionsString(options);
     if (::mount(backingPath, targetDir, INCFS_NAME, MS_NOSUID | MS_NODEV | MS_NOATIME,
@@ -458,16 +745,47 @@ IncFsControl* IncFs_Mount(const char* backingPath, const char* targetDir,
                     << " errno: " << errno;
         return nullptr;
     }
+    timer.done(&IncFsMountTimings::mountUs);
 
-    if (!restoreconControlFiles(targetDir)) {
-        return nullptr;
+    if (!fast) {
+        if (const auto err = restoreconControlFiles(targetDir); err != 0) {
+            errno = -err;
+            return nullptr;
+        }
+        timer.done(&IncFsMountTimings::restoreconUs);
+        auto control = makeControl(targetDir);
+        timer.done(&IncFsMountTimings::controlUs);
+        return control;
     }
 
-    auto control = makeControl(targetDir);
-    if (control == nullptr) {
+    // Relabeling only changes the inodes, so the control files can be opened meanwhile; the
+    // control is only handed out once both are done.
+    const unique_fd root(::open(targetDir, O_PATH | O_DIRECTORY | O_CLOEXEC));
+    if (!root.ok()) {
+        PLOG(ERROR) << "[incfs] Failed to open the new mount: " << targetDir;
         return nullptr;
     }
-    return control;
+    int restoreconErr = 0;
+    std::thread restorecon([&] {
+        const auto start = MountTimer::Clock::now();
+        restoreconErr = restoreconControlFiles(targetDir);
+        timer.set(&IncFsMountTimings::restoreconUs, MountTimer::Clock::now() - start);
+    });
+    const auto controlStart = MountTimer::Clock::now();
+    std::unique_ptr<IncFsControl, decltype(&IncFs_DeleteControl)>
+            control(makeControlAt(root.get()), IncFs_DeleteControl);
+    const auto controlErr = errno;
+    timer.set(&IncFsMountTimings::controlUs, MountTimer::Clock::now() - controlStart);
+    restorecon.join();
+    if (restoreconErr != 0) {
+        errno = -restoreconErr;
+        return nullptr;
+    }
+    if (!control) {
+        errno = controlErr;
+        return nullptr;
+    }
+    return control.release();
 }
 
 IncFsControl* IncFs_Open(const char* dir) {
@@ -560,18 +878,6 @@ IncFsErrorCode IncFs_Root(const IncFsControl* control, char buffer[], size_t* bu
     return 0;
 }
 
-template <class T>
-std::optional<T> read(IncFsSpan& data) {
-    if (data.size < (int32_t)sizeof(T)) {
-        return {};
-    }
-    T res;
-    memcpy(&res, data.data, sizeof(res));
-    data.data += sizeof(res);
-    data.size -= sizeof(res);
-    return res;
-}
-
 static IncFsErrorCode validateSignatureFormat(IncFsSpan signature) {
     if (signature.data == nullptr && signature.size == 0) {
         return 0; // it's fine to have unverified files too
@@ -579,74 +885,50 @@ static IncFsErrorCode validateSignatureFormat(IncFsSpan signature) {
     if ((signature.data == nullptr) != (signature.size == 0)) {
         return -EINVAL;
     }
+    if (signature.size < 0) {
+        return -ERANGE;
+    }
+    IncFsErrorCode error = 0;
+    android::incfs::SignatureView::parse({signature.data, size_t(signature.size)}, &error);
+    return error;
+}
 
-    // These structs are here purely for checking the minimum size. Maybe will use them for
-    // parsing later.
-    struct __attribute__((packed)) Hashing {
-        int32_t size;
-        int32_t algorithm;
-        int8_t log2_blocksize;
-        int32_t salt_size;
-        int32_t raw_root_hash_size;
-    };
-    struct __attribute__((packed)) Signing {
-        int32_t size;
-        int32_t apk_digest_size;
-        int32_t certificate_size;
-        int32_t addl_data_size;
-        int32_t public_key_size;
-        int32_t algorithm;
-        int32_t signature_size;
-    };
-    struct __attribute__((packed)) MinSignature {
-        int32_t version;
-        Hashing hashing_info;
-        Signing signing_info;
+// |subpath| is relative to the mount |root|.
+static IncFsErrorCode createFile(const IncFsControl* control, std::string_view root,
+                                 std::string_view subpath, int32_t mode, IncFsFileId id,
+                                 IncFsNewFileParams params) {
+    std::string pathCopy(subpath);
+    const auto [subdir, name] = android::incfs::path::splitDirBase(pathCopy);
+    incfs_new_file_args args = {
+            .size = (uint64_t)params.size,
+            .mode = (uint16_t)mode,
+            .directory_path = (uint64_t)subdir.data(),
+            .file_name = (uint64_t)name.data(),
+            .file_attr = (uint64_t)params.metadata.data,
+            .file_attr_len = (uint32_t)params.metadata.size,
     };
+    static_assert(sizeof(args.file_id.bytes) == sizeof(id.data));
+    memcpy(args.file_id.bytes, id.data, sizeof(args.file_id.bytes));
 
-    if (signature.size < (int32_t)sizeof(MinSignature)) {
-        return -ERANGE;
-    }
-    if (signature.size > INCFS_MAX_SIGNATURE_SIZE) {
-        return -ERANGE;
+    if (auto err = validateSignatureFormat(params.signature)) {
+        return err;
     }
+    args.signature_info = (uint64_t)(uintptr_t)params.signature.data;
+    args.signature_size = (uint64_t)params.signature.size;
 
-    auto version = read<int32_t>(signature);
-    if (version.value_or(-1) != INCFS_SIGNATURE_VERSION) {
-        return -EINVAL;
-    }
-    auto hashSize = read<int32_t>(signature);
-    if (!hashSize || signature.size < *hashSize) {
-        return -EINVAL;
-    }
-    auto hashAlgo = read<int32_t>(signature);
-    if (hashAlgo.value_or(-1) != INCFS_HASH_TREE_SHA256) {
-        return -EINVAL;
-    }
-    auto logBlockSize = read<int8_t>(signature);
-    if (logBlockSize.value_or(-1) != 12 /* 2^12 == 4096 */) {
-        return -EINVAL;
-    }
-    auto saltSize = read<int32_t>(signature);
-    if (saltSize.value_or(-1) != 0) {
-        return -EINVAL;
-    }
-    auto rootHashSize = read<int32_t>(signature);
-    if (rootHashSize.value_or(-1) != INCFS_MAX_HASH_SIZE) {
-        return -EINVAL;
-    }
-    if (signature.size < *rootHashSize) {
-        return -EINVAL;
+    if (::ioctl(control->cmd, INCFS_IOC_CREATE_FILE, &args)) {
+        PLOG(WARNING) << "[incfs] makeFile failed for " << root << " / " << subdir << " / " << name
+                      << " of " << params.size << " bytes";
+        return -errno;
     }
-    signature.data += *rootHashSize;
-    signature.size -= *rootHashSize;
-    auto signingSize = read<int32_t>(signature);
-    // everything remaining has to be in the signing info
-    if (signingSize.value_or(-1) != signature.size) {
-        return -EINVAL;
+    // Loaders ask for the metadata right away, on the first pending read.
+    control->metadataCache().put(id, {params.metadata.data, size_t(params.metadata.size)});
+    if (params.signature.size > 0) {
+        control->signatureCache().put(id, {params.signature.data, size_t(params.signature.size)});
+    } else {
+        // Don't let a previous file with the same id leave its signature behind.
+        control->signatureCache().erase(id);
     }
-
-    // TODO: validate the signature part too.
     return 0;
 }
 
@@ -667,29 +949,9 @@ IncFsErrorCode IncFs_MakeFile(const IncFsControl* control, const char* path, int
         return -ERANGE;
     }
 
-    const auto [subdir, name] = android::incfs::path::splitDirBase(subpath);
-    incfs_new_file_args args = {
-            .size = (uint64_t)params.size,
-            .mode = (uint16_t)mode,
-            .directory_path = (uint64_t)subdir.data(),
-            .file_name = (uint64_t)name.data(),
-            .file_attr = (uint64_t)params.metadata.data,
-            .file_attr_len = (uint32_t)params.metadata.size,
-    };
-    static_assert(sizeof(args.file_id.bytes) == sizeof(id.data));
-    memcpy(args.file_id.bytes, id.data, sizeof(args.file_id.bytes));
-
-    if (auto err = validateSignatureFormat(params.signature)) {
+    if (auto err = createFile(control, root, subpath, mode, id, params)) {
         return err;
     }
-    args.signature_info = (uint64_t)(uintptr_t)params.signature.data;
-    args.signature_size = (uint64_t)params.signature.size;
-
-    if (::ioctl(control->cmd, INCFS_IOC_CREATE_FILE, &args)) {
-        PLOG(WARNING) << "[incfs] makeFile failed for " << root << " / " << subdir << " / " << name
-                      << " of " << params.size << " bytes";
-        return -errno;
-    }
     if (::chmod(android::incfs::path::join(root, subpath).c_str(), mode)) {
         PLOG(WARNING) << "[incfs] couldn't change file mode to 0" << std::oct << mode;
     }
@@ -708,11 +970,16 @@ static IncFsErrorCode makeDir(const char* commandPath, int32_t mode, bool allowE
     return (allowExisting && errno == EEXIST) ? 0 : -errno;
 }
 
-static IncFsErrorCode makeDirs(std::string_view commandPath, std::string_view path,
-                               std::string_view root, int32_t mode) {
+static IncFsErrorCode makeDirs(const IncFsControl* control, std::string_view commandPath,
+                               std::string_view path, std::string_view root, int32_t mode) {
+    auto& knownDirs = control->knownDirs();
+    if (knownDirs.contains(commandPath)) {
+        return 0;
+    }
     auto commandCPath = android::incfs::details::c_str(commandPath);
     const auto mkdirRes = makeDir(commandCPath, mode, true);
     if (!mkdirRes) {
+        knownDirs.add(commandPath);
         return 0;
     }
     if (mkdirRes != -ENOENT) {
@@ -726,17 +993,22 @@ static IncFsErrorCode makeDirs(std::string_view commandPath, std::string_view pa
         return -EINVAL;
     }
 
-    if (auto parentMkdirRes = makeDirs(parent, android::incfs::path::dirName(path), root, mode)) {
+    if (auto parentMkdirRes =
+                makeDirs(control, parent, android::incfs::path::dirName(path), root, mode)) {
         return parentMkdirRes;
     }
-    return makeDir(commandCPath, mode, true);
+    if (const auto res = makeDir(commandCPath, mode, true)) {
+        return res;
+    }
+    knownDirs.add(commandPath);
+    return 0;
 }
 
 IncFsErrorCode IncFs_MakeDir(const IncFsControl* control, const char* path, int32_t mode) {
     if (!control) {
         return -EINVAL;
     }
-    const auto root = rootForCmd(control->cmd);
+    const auto& root = control->root();
     if (root.empty()) {
         LOG(ERROR) << __func__ << "(): root is empty for " << path;
         return -EINVAL;
@@ -750,6 +1022,7 @@ IncFsErrorCode IncFs_MakeDir(const IncFsControl* control, const char* path, int3
         LOG(ERROR) << __func__ << "(): mkdir failed for " << commandPath << " - " << res;
         return res;
     }
+    control->knownDirs().add(commandPath);
     return 0;
 }
 
@@ -757,7 +1030,7 @@ IncFsErrorCode IncFs_MakeDirs(const IncFsControl* control, const char* path, int
     if (!control) {
         return -EINVAL;
     }
-    const auto root = rootForCmd(control->cmd);
+    const auto& root = control->root();
     if (root.empty()) {
         LOG(ERROR) << __func__ << "(): root is empty for " << path;
         return -EINVAL;
@@ -767,22 +1040,47 @@ IncFsErrorCode IncFs_MakeDirs(const IncFsControl* control, const char* path, int
         LOG(ERROR) << __func__ << "(): commandPath is empty for " << path;
         return -EINVAL;
     }
-    return makeDirs(commandPath, path, root, mode);
+    return makeDirs(control, commandPath, path, root, mode);
 }
 
-static IncFsErrorCode getMetadata(const char* path, char buffer[], size_t* bufferSize) {
-    const auto res = ::getxattr(path, android::incfs::kMetadataAttrName, buffer, *bufferSize);
+static IncFsErrorCode countFailures(const IncFsErrorCode results[], size_t count) {
+    return std::count_if(results, results + count, [](auto res) { return res != 0; });
+}
+
+IncFsErrorCode IncFs_MakeDirsAll(const IncFsControl* control, const char* const paths[],
+                                 size_t count, int32_t mode, IncFsErrorCode results[]) {
+    if (!control || (count && (!paths || !results))) {
+        return -EINVAL;
+    }
+    const auto& root = control->root();
+    if (root.empty()) {
+        return -EINVAL;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        const auto commandPath = paths[i] ? makeCommandPathUnder(root, paths[i]) : std::string();
+        results[i] = commandPath.empty() ? -EINVAL
+                                         : makeDirs(control, commandPath, paths[i], root, mode);
+    }
+    return countFailures(results, count);
+}
+
+// A single getxattr() into a buffer large enough for any metadata.
+static IncFsErrorCode readMetadata(const char* path, std::string* metadata) {
+    char buffer[INCFS_MAX_FILE_ATTR_SIZE];
+    const auto res = ::getxattr(path, android::incfs::kMetadataAttrName, buffer, sizeof(buffer));
     if (res < 0) {
-        if (errno == ERANGE) {
-            auto neededSize = ::getxattr(path, android::incfs::kMetadataAttrName, buffer, 0);
-            if (neededSize >= 0) {
-                *bufferSize = neededSize;
-                return 0;
-            }
-        }
         return -errno;
     }
-    *bufferSize = res;
+    metadata->assign(buffer, res);
+    return 0;
+}
+
+static IncFsErrorCode getMetadata(const char* path, char buffer[], size_t* bufferSize) {
+    std::string metadata;
+    if (const auto err = readMetadata(path, &metadata)) {
+        return err;
+    }
+    copyMetadata(metadata, buffer, bufferSize);
     return 0;
 }
 
@@ -791,13 +1089,24 @@ IncFsErrorCode IncFs_GetMetadataById(const IncFsControl* control, IncFsFileId fi
     if (!control) {
         return -EINVAL;
     }
+    if (control->metadataCache().find(fileId, [&](std::string_view metadata) {
+            copyMetadata(metadata, buffer, bufferSize);
+        })) {
+        return 0;
+    }
 
-    const auto root = rootForCmd(control->cmd);
+    const auto& root = control->root();
     if (root.empty()) {
         return -EINVAL;
     }
     auto name = android::incfs::path::join(root, android::incfs::kIndexDir, toStringImpl(fileId));
-    return getMetadata(android::incfs::details::c_str(name), buffer, bufferSize);
+    std::string metadata;
+    if (const auto err = readMetadata(android::incfs::details::c_str(name), &metadata)) {
+        return err;
+    }
+    control->metadataCache().put(fileId, metadata);
+    copyMetadata(metadata, buffer, bufferSize);
+    return 0;
 }
 
 IncFsErrorCode IncFs_GetMetadataByPath(const IncFsControl* control, const char* path, char buffer[],
@@ -814,6 +1123,15 @@ IncFsErrorCode IncFs_GetMetadataByPath(const IncFsControl* control, const char*
     return getMetadata(path, buffer, bufferSize);
 }
 
+static IncFsFileId idForPath(const char* path) {
+    char buffer[kIncFsFileIdStringLength];
+    const auto res = ::getxattr(path, android::incfs::kIdAttrName, buffer, sizeof(buffer));
+    if (res != sizeof(buffer)) {
+        return kIncFsInvalidFileId;
+    }
+    return toFileIdImpl({buffer, std::size(buffer)});
+}
+
 IncFsFileId IncFs_GetId(const IncFsControl* control, const char* path) {
     if (!control) {
         return kIncFsInvalidFileId;
@@ -824,12 +1142,65 @@ IncFsFileId IncFs_GetId(const IncFsControl* control, const char* path) {
         errno = EINVAL;
         return kIncFsInvalidFileId;
     }
-    char buffer[kIncFsFileIdStringLength];
-    const auto res = ::getxattr(path, android::incfs::kIdAttrName, buffer, sizeof(buffer));
-    if (res != sizeof(buffer)) {
-        return kIncFsInvalidFileId;
+    return idForPath(path);
+}
+
+// getxattr() costs a few microseconds, don't spawn threads for less than this.
+static constexpr auto kMinIdsPerThread = 64;
+
+IncFsErrorCode IncFs_GetIds(const IncFsControl* control, const char* const paths[], size_t count,
+                            IncFsFileId ids[]) {
+    if (!control || (count && (!paths || !ids))) {
+        return -EINVAL;
     }
-    return toFileIdImpl({buffer, std::size(buffer)});
+    const auto& root = control->root();
+    if (root.empty()) {
+        return -EINVAL;
+    }
+
+    // Group the files by their directory, so each one gets resolved and opened only once.
+    std::vector<std::string_view> dirs(count);
+    for (size_t i = 0; i < count; ++i) {
+        ids[i] = kIncFsInvalidFileId;
+        dirs[i] = paths[i] ? android::incfs::path::dirName(paths[i]) : std::string_view();
+    }
+    std::vector<std::string_view> uniqueDirs(dirs);
+    std::sort(uniqueDirs.begin(), uniqueDirs.end());
+    uniqueDirs.erase(std::unique(uniqueDirs.begin(), uniqueDirs.end()), uniqueDirs.end());
+
+    std::vector<unique_fd> dirFds(uniqueDirs.size());
+    android::incfs::details::parallelFor(uniqueDirs.size(), kMinIdsPerThread, [&](size_t i) {
+        if (uniqueDirs[i].empty() || registry().rootFor(uniqueDirs[i]) != root) {
+            return;
+        }
+        dirFds[i].reset(::open(std::string(uniqueDirs[i]).c_str(),
+                               O_PATH | O_DIRECTORY | O_CLOEXEC));
+    });
+
+    // There's no getxattrat(), but a path through /proc/self/fd/ only walks from the directory.
+    std::atomic<int> found = 0;
+    android::incfs::details::parallelFor(count, kMinIdsPerThread, [&](size_t i) {
+        if (!paths[i]) {
+            return;
+        }
+        const auto dir = std::lower_bound(uniqueDirs.begin(), uniqueDirs.end(), dirs[i]);
+        const auto& dirFd = dirFds[dir - uniqueDirs.begin()];
+        if (!dirFd.ok()) {
+            return;
+        }
+        const auto name = android::incfs::path::baseName(paths[i]);
+        char buffer[kIncFsFileIdStringLength];
+        const auto res = ::getxattr(StringPrintf("/proc/self/fd/%d/%.*s", dirFd.get(),
+                                                 int(name.size()), name.data())
+                                            .c_str(),
+                                    android::incfs::kIdAttrName, buffer, sizeof(buffer));
+        if (res != sizeof(buffer)) {
+            return;
+        }
+        ids[i] = toFileIdImpl({buffer, std::size(buffer)});
+        ++found;
+    });
+    return found;
 }
 
 static IncFsErrorCode getSignature(int fd, char buffer[], size_t* bufferSize) {
@@ -855,7 +1226,21 @@ IncFsErrorCode IncFs_GetSignatureById(const IncFsControl* control, IncFsFileId f
         return -EINVAL;
     }
 
-    const auto root = rootForCmd(control->cmd);
+    IncFsErrorCode res = 0;
+    if (control->signatureCache().find(fileId, [&](std::string_view signature) {
+            // Same contract as the ioctl path: too small a buffer gets the maximum size back.
+            if (signature.size() > *bufferSize) {
+                res = -E2BIG;
+                *bufferSize = INCFS_MAX_SIGNATURE_SIZE;
+            } else {
+                memcpy(buffer, signature.data(), signature.size());
+                *bufferSize = signature.size();
+            }
+        })) {
+        return res;
+    }
+
+    const auto& root = control->root();
     if (root.empty()) {
         return -EINVAL;
     }
@@ -864,7 +1249,11 @@ IncFsErrorCode IncFs_GetSignatureById(const IncFsControl* control, IncFsFileId f
     if (fd < 0) {
         return fd.get();
     }
-    return getSignature(fd, buffer, bufferSize);
+    res = getSignature(fd, buffer, bufferSize);
+    if (res == 0 && *bufferSize > 0) {
+        control->signatureCache().put(fileId, {buffer, *bufferSize});
+    }
+    return res;
 }
 
 IncFsErrorCode IncFs_GetSignatureByPath(const IncFsControl* control, const char* path,
@@ -892,21 +1281,14 @@ IncFsErrorCode IncFs_UnsafeGetSignatureByPath(const char* path, char buffer[], s
     return getSignature(fd, buffer, bufferSize);
 }
 
-IncFsErrorCode IncFs_Link(const IncFsControl* control, const char* fromPath,
-                          const char* wherePath) {
-    if (!control) {
-        return -EINVAL;
-    }
-
-    auto root = rootForCmd(control->cmd);
-    if (root.empty()) {
-        return -EINVAL;
-    }
-    auto cmdFrom = makeCommandPath(root, fromPath);
+static IncFsErrorCode link(std::string_view root, const char* fromPath, const char* wherePath,
+                           bool fast) {
+    const auto commandPath = fast ? makeCommandPathUnder : makeCommandPath;
+    auto cmdFrom = commandPath(root, fromPath);
     if (cmdFrom.empty()) {
         return -EINVAL;
     }
-    auto cmdWhere = makeCommandPath(root, wherePath);
+    auto cmdWhere = commandPath(root, wherePath);
     if (cmdWhere.empty()) {
         return -EINVAL;
     }
@@ -916,30 +1298,86 @@ IncFsErrorCode IncFs_Link(const IncFsControl* control, const char* fromPath,
     return 0;
 }
 
-IncFsErrorCode IncFs_Unlink(const IncFsControl* control, const char* path) {
+IncFsErrorCode IncFs_Link(const IncFsControl* control, const char* fromPath,
+                          const char* wherePath) {
     if (!control) {
         return -EINVAL;
     }
 
-    auto root = rootForCmd(control->cmd);
+    const auto& root = control->root();
     if (root.empty()) {
         return -EINVAL;
     }
-    auto cmdPath = makeCommandPath(root, path);
+    return link(root, fromPath, wherePath, false);
+}
+
+IncFsErrorCode IncFs_LinkAll(const IncFsControl* control, const char* const fromPaths[],
+                             const char* const wherePaths[], size_t count,
+                             IncFsErrorCode results[]) {
+    if (!control || (count && (!fromPaths || !wherePaths || !results))) {
+        return -EINVAL;
+    }
+    const auto& root = control->root();
+    if (root.empty()) {
+        return -EINVAL;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        results[i] = fromPaths[i] && wherePaths[i] ? link(root, fromPaths[i], wherePaths[i], true)
+                                                    : -EINVAL;
+    }
+    return countFailures(results, count);
+}
+
+static IncFsErrorCode unlink(const IncFsControl* control, const char* path, bool fast) {
+    const auto& root = control->root();
+    auto cmdPath = fast ? makeCommandPathUnder(root, path) : makeCommandPath(root, path);
     if (cmdPath.empty()) {
         return -EINVAL;
     }
+    // The id may be reused once the file is gone. Other links may keep it alive, but then the
+    // next lookup simply reads the attributes again.
+    const auto id = idForPath(cmdPath.c_str());
     if (::unlink(cmdPath.c_str())) {
         if (errno == EISDIR) {
             if (!::rmdir(cmdPath.c_str())) {
+                control->knownDirs().removeTree(cmdPath);
                 return 0;
             }
         }
         return -errno;
     }
+    if (android::incfs::isValidFileId(id)) {
+        control->metadataCache().erase(id);
+        control->signatureCache().erase(id);
+    }
     return 0;
 }
 
+IncFsErrorCode IncFs_Unlink(const IncFsControl* control, const char* path) {
+    if (!control) {
+        return -EINVAL;
+    }
+
+    if (control->root().empty()) {
+        return -EINVAL;
+    }
+    return unlink(control, path, false);
+}
+
+IncFsErrorCode IncFs_UnlinkAll(const IncFsControl* control, const char* const paths[],
+                               size_t count, IncFsErrorCode results[]) {
+    if (!control || (count && (!paths || !results))) {
+        return -EINVAL;
+    }
+    if (control->root().empty()) {
+        return -EINVAL;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        results[i] = paths[i] ? unlink(control, paths[i], true) : -EINVAL;
+    }
+    return countFailures(results, count);
+}
+
 static int waitForReads(int fd, int32_t timeoutMs, incfs_pending_read_info pendingReadsBuffer[],
                         size_t* pendingReadsBufferSize) {
     auto hrTimeout = std::chrono::steady_clock::duration(std::chrono::milliseconds(timeoutMs));
@@ -1035,6 +1473,15 @@ IncFsErrorCode IncFs_WaitForPageReads(const IncFsControl* control, int32_t timeo
         };
         memcpy(&buffer[i].id.data, pendingReads[i].file_id.bytes, sizeof(buffer[i].id.data));
     }
+    control->readLogMonitor().onRecords(buffer, *bufferSize);
+    return 0;
+}
+
+IncFsErrorCode IncFs_GetReadLogStats(const IncFsControl* control, IncFsReadLogStats* stats) {
+    if (!control || !stats) {
+        return -EINVAL;
+    }
+    *stats = control->readLogMonitor().stats();
     return 0;
 }
 
@@ -1145,24 +1592,377 @@ IncFsErrorCode IncFs_WriteBlocks(const IncFsDataBlock blocks[], size_t blocksCou
     return writtenCount ? writtenCount : count;
 }
 
-IncFsErrorCode IncFs_BindMount(const char* sourceDir, const char* targetDir) {
-    if (!android::incfs::enabled()) {
-        return -ENOTSUP;
+// Opens the new file by its id and fills it in a single FILL_BLOCKS call, hash blocks first.
+static IncFsErrorCode fillNewFile(const IncFsControl* control, const IncFsNewFilledFile& file,
+                                  std::vector<incfs_fill_block>* blocks) {
+    const auto indexPath = android::incfs::path::join(control->root(), android::incfs::kIndexDir,
+                                                      toStringImpl(file.id));
+    const unique_fd fd(openForSpecialOps(control->cmd, indexPath.c_str()));
+    if (fd < 0) {
+        return fd.get();
+    }
+    if (::fchmod(fd.get(), file.mode)) {
+        PLOG(WARNING) << "[incfs] couldn't change file mode to 0" << std::oct << file.mode;
     }
 
-    auto [sourceRoot, subpath] = registry().rootAndSubpathFor(sourceDir);
-    if (sourceRoot.empty()) {
+    blocks->clear();
+    const auto hashBlocks = IncFsBlockIndex(file.hashTree.size / INCFS_DATA_FILE_BLOCK_SIZE);
+    for (IncFsBlockIndex i = 0; i < hashBlocks; ++i) {
+        blocks->push_back(incfs_fill_block{
+                .block_index = (uint32_t)i,
+                .data_len = INCFS_DATA_FILE_BLOCK_SIZE,
+                .data = (uint64_t)(uintptr_t)(file.hashTree.data +
+                                              IncFsSize(i) * INCFS_DATA_FILE_BLOCK_SIZE),
+                .flags = INCFS_BLOCK_FLAGS_HASH,
+        });
+    }
+    for (IncFsSize offset = 0; offset < file.data.size; offset += INCFS_DATA_FILE_BLOCK_SIZE) {
+        blocks->push_back(incfs_fill_block{
+                .block_index = (uint32_t)(offset / INCFS_DATA_FILE_BLOCK_SIZE),
+                .data_len = (uint32_t)std::min<IncFsSize>(INCFS_DATA_FILE_BLOCK_SIZE,
+                                                          file.data.size - offset),
+                .data = (uint64_t)(uintptr_t)(file.data.data + offset),
+        });
+    }
+    const auto written = writeBlocks(fd.get(), blocks->data(), blocks->size());
+    if (written < 0) {
+        return written;
+    }
+    return written == int(blocks->size()) ? 0 : -EIO;
+}
+
+// Removes a file that got created but couldn't be filled: it would stay empty forever, and its
+// id would be taken.
+static void removeNewFile(const IncFsControl* control, std::string_view subpath, IncFsFileId id) {
+    const auto& root = control->root();
+    const auto idString = toStringImpl(id);
+    for (auto&& path : {android::incfs::path::join(root, subpath),
+                        android::incfs::path::join(root, android::incfs::kIndexDir, idString),
+                        android::incfs::path::join(root, android::incfs::kIncompleteDir,
+                                                   idString)}) {
+        if (::unlink(path.c_str()) && errno != ENOENT) {
+            PLOG(WARNING) << "[incfs] failed to remove the unfilled file " << path;
+        }
+    }
+    control->metadataCache().erase(id);
+    control->signatureCache().erase(id);
+}
+
+static IncFsErrorCode makeFilledFile(const IncFsControl* control, const std::string& root,
+                                     const IncFsNewFilledFile& file,
+                                     std::vector<incfs_fill_block>* blocks) {
+    if (!file.path || file.params.size < 0 || file.data.size != file.params.size ||
+        (!file.data.data && file.data.size > 0)) {
         return -EINVAL;
     }
-    if (subpath.empty()) {
-        LOG(WARNING) << "[incfs] Binding the root mount '" << sourceRoot << "' is not allowed";
+    if (file.hashTree.size != 0 &&
+        (!file.hashTree.data ||
+         file.hashTree.size !=
+                 android::incfs::hashtree::size(
+                         android::incfs::hashtree::geometry(file.params.size)))) {
         return -EINVAL;
     }
 
-    if (auto err = isValidMountTarget(targetDir); err != 0) {
+    // Relative paths skip the mount lookup.
+    std::string_view subpath = file.path;
+    std::string absoluteSubpath;
+    if (android::incfs::path::isAbsolute(subpath)) {
+        std::string pathRoot;
+        std::tie(pathRoot, absoluteSubpath) = registry().rootAndSubpathFor(subpath);
+        if (pathRoot != root) {
+            return -EINVAL;
+        }
+        subpath = absoluteSubpath;
+    }
+    if (const auto err = createFile(control, root, subpath, file.mode, file.id, file.params)) {
+        return err;
+    }
+    if (const auto err = fillNewFile(control, file, blocks)) {
+        removeNewFile(control, subpath, file.id);
+        return err;
+    }
+    return 0;
+}
+
+IncFsErrorCode IncFs_MakeFilledFiles(const IncFsControl* control,
+                                     const IncFsNewFilledFile files[], size_t filesCount,
+                                     IncFsErrorCode results[]) {
+    if (!control || (filesCount > 0 && (!files || !results))) {
+        return -EINVAL;
+    }
+    const auto& root = control->root();
+    if (root.empty()) {
+        return -EINVAL;
+    }
+
+    std::vector<incfs_fill_block> blocks;
+    for (size_t i = 0; i < filesCount; ++i) {
+        results[i] = makeFilledFile(control, root, files[i], &blocks);
+    }
+    return countFailures(results, filesCount);
+}
+
+// Up to 4MiB of data goes into a single FILL_BLOCKS ioctl when writing whole ranges.
+static constexpr auto kRangeBatchBlocks = 1024;
+// Source files get mapped in 16MiB windows for writeRangeFromFd().
+static constexpr IncFsSize kRangeMapWindow = 4 * kRangeBatchBlocks * INCFS_DATA_FILE_BLOCK_SIZE;
+
+static IncFsErrorCode checkWriteRange(int fd, IncFsSize offset, IncFsSize length,
+                                      IncFsWriteRangeParams params, IncFsSize* fileSize) {
+    if (fd < 0) {
+        return -EBADF;
+    }
+    if (offset < 0 || length < 0 || offset % INCFS_DATA_FILE_BLOCK_SIZE != 0) {
+        return -EINVAL;
+    }
+    if (params.compression != INCFS_COMPRESSION_KIND_NONE &&
+        params.compression != INCFS_COMPRESSION_KIND_LZ4) {
+        return -EINVAL;
+    }
+    struct stat st;
+    if (::fstat(fd, &st)) {
+        return -errno;
+    }
+    if (offset + length > st.st_size) {
+        return -EINVAL;
+    }
+    if (length % INCFS_DATA_FILE_BLOCK_SIZE != 0 && offset + length != st.st_size) {
+        return -EINVAL;
+    }
+    if (params.hashTree.size != 0 &&
+        (!params.hashTree.data ||
+         params.hashTree.size !=
+                 android::incfs::hashtree::size(android::incfs::hashtree::geometry(st.st_size)))) {
+        return -EINVAL;
+    }
+    *fileSize = st.st_size;
+    return 0;
+}
+
+static IncFsErrorCode writeCoveringHashBlocks(int fd, IncFsSize fileSize, IncFsBlockIndex begin,
+                                              IncFsBlockIndex end, IncFsSpan hashTree) {
+    if (hashTree.size == 0) {
+        return 0;
+    }
+    std::vector<incfs_fill_block> blocks;
+    const auto covering = android::incfs::hashtree::coveringRanges(
+            android::incfs::hashtree::geometry(fileSize), android::incfs::BlockRange{{begin, end}});
+    for (auto&& range : covering) {
+        for (auto index = range.begin; index < range.end; ++index) {
+            const auto data = hashTree.data + IncFsSize(index) * INCFS_DATA_FILE_BLOCK_SIZE;
+            blocks.push_back(incfs_fill_block{
+                    .block_index = (uint32_t)index,
+                    .data_len = INCFS_DATA_FILE_BLOCK_SIZE,
+                    .data = (uint64_t)(uintptr_t)data,
+                    .flags = INCFS_BLOCK_FLAGS_HASH,
+            });
+        }
+    }
+    const auto res = writeBlocks(fd, blocks.data(), blocks.size());
+    if (res < 0) {
+        return res;
+    }
+    return res == int(blocks.size()) ? 0 : -EIO;
+}
+
+// Writes |size| bytes of |data| as consecutive blocks starting from |firstBlock|. Returns the
+// number of data bytes written or -errno.
+static IncFsSize writeRangeBatch(int fd, IncFsBlockIndex firstBlock, const char* data,
+                                 IncFsSize size, IncFsCompressionKind compression,
+                                 std::vector<incfs_fill_block>* blocks,
+                                 std::vector<char>* compressed) {
+    const auto count = (size + INCFS_DATA_FILE_BLOCK_SIZE - 1) / INCFS_DATA_FILE_BLOCK_SIZE;
+    blocks->resize(count);
+    if (compression == INCFS_COMPRESSION_KIND_LZ4) {
+        compressed->resize(count * INCFS_DATA_FILE_BLOCK_SIZE);
+    }
+    for (IncFsSize i = 0; i < count; ++i) {
+        const auto blockData = data + i * INCFS_DATA_FILE_BLOCK_SIZE;
+        const auto blockSize =
+                (int)std::min<IncFsSize>(INCFS_DATA_FILE_BLOCK_SIZE,
+                                         size - i * INCFS_DATA_FILE_BLOCK_SIZE);
+        auto& block = (*blocks)[i];
+        block = incfs_fill_block{
+                .block_index = uint32_t(firstBlock + i),
+                .data_len = uint32_t(blockSize),
+                .data = (uint64_t)(uintptr_t)blockData,
+        };
+        if (compression == INCFS_COMPRESSION_KIND_LZ4) {
+            // Only keep the compressed version if it's actually smaller.
+            const auto out = compressed->data() + i * INCFS_DATA_FILE_BLOCK_SIZE;
+            const auto outSize = LZ4_compress_default(blockData, out, blockSize, blockSize - 1);
+            if (outSize > 0) {
+                block.data_len = uint32_t(outSize);
+                block.data = (uint64_t)(uintptr_t)out;
+                block.compression = COMPRESSION_LZ4;
+            }
+        }
+    }
+    const auto written = writeBlocks(fd, blocks->data(), blocks->size());
+    if (written < 0) {
+        return written;
+    }
+    return std::min<IncFsSize>(size, IncFsSize(written) * INCFS_DATA_FILE_BLOCK_SIZE);
+}
+
+IncFsSize IncFs_WriteRange(IncFsFd fd, IncFsSize offset, IncFsSpan data,
+                           IncFsWriteRangeParams params) {
+    if (!data.data && data.size > 0) {
+        return -EINVAL;
+    }
+    IncFsSize fileSize;
+    if (const auto err = checkWriteRange(fd, offset, data.size, params, &fileSize)) {
+        return err;
+    }
+    const auto firstBlock = IncFsBlockIndex(offset / INCFS_DATA_FILE_BLOCK_SIZE);
+    const auto endBlock = firstBlock + android::incfs::hashtree::dataBlocks(data.size);
+    if (const auto err =
+                writeCoveringHashBlocks(fd, fileSize, firstBlock, endBlock, params.hashTree)) {
         return err;
     }
 
+    std::vector<incfs_fill_block> blocks;
+    std::vector<char> compressed;
+    IncFsSize written = 0;
+    while (written < data.size) {
+        const auto chunk = std::min<IncFsSize>(data.size - written,
+                                               kRangeBatchBlocks * INCFS_DATA_FILE_BLOCK_SIZE);
+        const auto res = writeRangeBatch(fd, firstBlock + written / INCFS_DATA_FILE_BLOCK_SIZE,
+                                         data.data + written, chunk, params.compression, &blocks,
+                                         &compressed);
+        if (res < 0) {
+            return written ? written : res;
+        }
+        written += res;
+        if (res < chunk) {
+            break;
+        }
+    }
+    return written;
+}
+
+// Writes the source data straight out of its memory mapping, one window at a time, and lets the
+// kernel read the next window in while the current one is being written.
+static IncFsSize writeRangeMapped(int fd, IncFsBlockIndex firstBlock, int srcFd,
+                                  IncFsSize srcOffset, IncFsSize length,
+                                  IncFsCompressionKind compression) {
+    static const auto kPageSize = ::sysconf(_SC_PAGESIZE);
+
+    std::vector<incfs_fill_block> blocks;
+    std::vector<char> compressed;
+    IncFsSize written = 0;
+    while (written < length) {
+        const auto windowOffset = srcOffset + written;
+        const auto mapOffset = windowOffset - windowOffset % kPageSize;
+        const auto window = std::min<IncFsSize>(length - written, kRangeMapWindow);
+        const auto mapSize = size_t(window + (windowOffset - mapOffset));
+        // Only the first window needs to be populated synchronously, the rest get prefetched.
+        const auto map = ::mmap(nullptr, mapSize, PROT_READ,
+                                MAP_SHARED | (written == 0 ? MAP_POPULATE : 0), srcFd, mapOffset);
+        if (map == MAP_FAILED) {
+            return written ? written : -errno;
+        }
+        const auto unmap = android::base::make_scope_guard([&] { ::munmap(map, mapSize); });
+        ::madvise(map, mapSize, MADV_SEQUENTIAL);
+        if (const auto next = windowOffset + window; next < srcOffset + length) {
+            const auto nextSize = std::min<IncFsSize>(srcOffset + length - next, kRangeMapWindow);
+            ::posix_fadvise(srcFd, next, nextSize, POSIX_FADV_WILLNEED);
+        }
+
+        const auto data = (const char*)map + (windowOffset - mapOffset);
+        for (IncFsSize done = 0; done < window;) {
+            const auto chunk = std::min<IncFsSize>(window - done,
+                                                   kRangeBatchBlocks * INCFS_DATA_FILE_BLOCK_SIZE);
+            const auto res =
+                    writeRangeBatch(fd, firstBlock + (written + done) / INCFS_DATA_FILE_BLOCK_SIZE,
+                                    data + done, chunk, compression, &blocks, &compressed);
+            if (res < 0) {
+                return (written + done) ? written + done : res;
+            }
+            done += res;
+            if (res < chunk) {
+                return written + done;
+            }
+        }
+        written += window;
+    }
+    return written;
+}
+
+static IncFsSize writeRangeRead(int fd, IncFsBlockIndex firstBlock, int srcFd, IncFsSize srcOffset,
+                                IncFsSize length, IncFsCompressionKind compression) {
+    std::vector<char> buffer(std::min<IncFsSize>(length,
+                                                 kRangeBatchBlocks * INCFS_DATA_FILE_BLOCK_SIZE));
+    std::vector<incfs_fill_block> blocks;
+    std::vector<char> compressed;
+    IncFsSize written = 0;
+    while (written < length) {
+        const auto chunk = std::min<IncFsSize>(length - written, buffer.size());
+        IncFsSize read = 0;
+        while (read < chunk) {
+            const auto res = TEMP_FAILURE_RETRY(::pread64(srcFd, buffer.data() + read, chunk - read,
+                                                          srcOffset + written + read));
+            if (res <= 0) {
+                const auto error = res < 0 ? -errno : -EIO;
+                return written ? written : error;
+            }
+            read += res;
+        }
+        const auto res = writeRangeBatch(fd, firstBlock + written / INCFS_DATA_FILE_BLOCK_SIZE,
+                                         buffer.data(), chunk, compression, &blocks, &compressed);
+        if (res < 0) {
+            return written ? written : res;
+        }
+        written += res;
+        if (res < chunk) {
+            break;
+        }
+    }
+    return written;
+}
+
+IncFsSize IncFs_WriteRangeFromFd(IncFsFd fd, IncFsSize offset, IncFsFd srcFd, IncFsSize srcOffset,
+                                 IncFsSize length, IncFsWriteRangeParams params) {
+    if (srcFd < 0) {
+        return -EBADF;
+    }
+    if (srcOffset < 0) {
+        return -EINVAL;
+    }
+    IncFsSize fileSize;
+    if (const auto err = checkWriteRange(fd, offset, length, params, &fileSize)) {
+        return err;
+    }
+    struct stat st;
+    if (::fstat(srcFd, &st)) {
+        return -errno;
+    }
+    const bool canMap = S_ISREG(st.st_mode);
+    if (canMap && srcOffset + length > st.st_size) {
+        return -EINVAL;
+    }
+    const auto firstBlock = IncFsBlockIndex(offset / INCFS_DATA_FILE_BLOCK_SIZE);
+    const auto endBlock = firstBlock + android::incfs::hashtree::dataBlocks(length);
+    if (const auto err =
+                writeCoveringHashBlocks(fd, fileSize, firstBlock, endBlock, params.hashTree)) {
+        return err;
+    }
+    if (length == 0) {
+        return 0;
+    }
+
+    if (canMap) {
+        const auto res =
+                writeRangeMapped(fd, firstBlock, srcFd, srcOffset, length, params.compression);
+        // Some filesystems can't map their files, just read those.
+        if (res != -ENODEV) {
+            return res;
+        }
+    }
+    return writeRangeRead(fd, firstBlock, srcFd, srcOffset, length, params.compression);
+}
+
+static IncFsErrorCode bindMount(const char* sourceDir, const char* targetDir) {
     if (::mount(sourceDir, targetDir, nullptr, MS_BIND, nullptr)) {
         PLOG(ERROR) << "[incfs] Failed to bind mount '" << sourceDir << "' to '" << targetDir
                     << '\'';
@@ -1171,11 +1971,70 @@ IncFsErrorCode IncFs_BindMount(const char* sourceDir, const char* targetDir) {
     return 0;
 }
 
-IncFsErrorCode IncFs_Unmount(const char* dir) {
+static IncFsErrorCode checkBindSource(std::string_view sourceRoot, std::string_view subpath) {
+    if (sourceRoot.empty()) {
+        return -EINVAL;
+    }
+    if (subpath.empty()) {
+        LOG(WARNING) << "[incfs] Binding the root mount '" << sourceRoot << "' is not allowed";
+        return -EINVAL;
+    }
+    return 0;
+}
+
+IncFsErrorCode IncFs_BindMount(const char* sourceDir, const char* targetDir) {
     if (!android::incfs::enabled()) {
         return -ENOTSUP;
     }
 
+    auto [sourceRoot, subpath] = registry().rootAndSubpathFor(sourceDir);
+    if (auto err = checkBindSource(sourceRoot, subpath); err != 0) {
+        return err;
+    }
+
+    if (auto err = isValidMountTarget(targetDir); err != 0) {
+        return err;
+    }
+
+    return bindMount(sourceDir, targetDir);
+}
+
+IncFsErrorCode IncFs_BindMountAll(const char* const sourceDirs[], const char* const targetDirs[],
+                                  size_t count, int maxConcurrency, IncFsErrorCode results[]) {
+    if (count && (!sourceDirs || !targetDirs || !results)) {
+        return -EINVAL;
+    }
+    if (!android::incfs::enabled()) {
+        return -ENOTSUP;
+    }
+
+    // Resolve all sources before mounting anything: the registry stays valid for all of them.
+    for (size_t i = 0; i < count; ++i) {
+        if (!sourceDirs[i] || !targetDirs[i]) {
+            results[i] = -EINVAL;
+            continue;
+        }
+        auto [sourceRoot, subpath] = registry().rootAndSubpathFor(sourceDirs[i]);
+        results[i] = checkBindSource(sourceRoot, subpath);
+    }
+    android::incfs::details::parallelFor(
+            count, 1,
+            [&](size_t i) {
+                if (results[i] != 0) {
+                    return;
+                }
+                // The registry is stale once the first bind is done, check the target directly.
+                results[i] = isValidMountTargetFast(targetDirs[i]);
+                if (results[i] == 0) {
+                    results[i] = bindMount(sourceDirs[i], targetDirs[i]);
+                }
+            },
+            std::max(0, maxConcurrency));
+    registry().reload();
+    return countFailures(results, count);
+}
+
+static IncFsErrorCode unmount(const char* dir) {
     errno = 0;
     if (::umount2(dir, MNT_FORCE) == 0 || errno == EINVAL || errno == ENOENT) {
         // EINVAL - not a mount point, ENOENT - doesn't exist at all
@@ -1190,10 +2049,46 @@ IncFsErrorCode IncFs_Unmount(const char* dir) {
     return 0;
 }
 
+IncFsErrorCode IncFs_Unmount(const char* dir) {
+    if (!android::incfs::enabled()) {
+        return -ENOTSUP;
+    }
+    return unmount(dir);
+}
+
+IncFsErrorCode IncFs_UnmountAll(const char* const dirs[], size_t count, int maxConcurrency,
+                                IncFsErrorCode results[]) {
+    if (count && (!dirs || !results)) {
+        return -EINVAL;
+    }
+    if (!android::incfs::enabled()) {
+        return -ENOTSUP;
+    }
+
+    android::incfs::details::parallelFor(
+            count, 1, [&](size_t i) { results[i] = dirs[i] ? unmount(dirs[i]) : -EINVAL; },
+            std::max(0, maxConcurrency));
+    registry().reload();
+    return countFailures(results, count);
+}
+
 bool IncFs_IsIncFsPath(const char* path) {
     return isIncFsPath(path);
 }
 
+IncFsErrorCode IncFs_AreIncFsPaths(const char* const paths[], size_t count, bool results[]) {
+    if (count && (!paths || !results)) {
+        return -EINVAL;
+    }
+    const auto generation = registry().generation();
+    int incFsPaths = 0;
+    for (size_t i = 0; i < count; ++i) {
+        results[i] = paths[i] && isIncFsPathCached(paths[i], generation);
+        incFsPaths += results[i];
+    }
+    return incFsPaths;
+}
+
 IncFsErrorCode IncFs_GetFilledRanges(int fd, IncFsSpan outBuffer, IncFsFilledRanges* filledRanges) {
     return IncFs_GetFilledRangesStartingFrom(fd, 0, outBuffer, filledRanges);
 }
@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <optional>
+#include <set>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "incfs.h"
+
+namespace android::incfs {
+
+//
+// HashTreeVerifier - checks data blocks against a file's SHA-256 hash tree before they get
+//      written into IncFS, so corrupted data is caught by the loader instead of the kernel.
+//
+// The tree is collected from the hash blocks the loader fetches; each of them is verified
+// against its parent (or the root hash from the signature) before it's accepted.
+//
+
+class HashTreeVerifier final {
+public:
+    enum class Result {
+        Ok,
+        Corrupted,   // the data doesn't match its hash
+        MissingHash, // the hash block covering the data hasn't been added yet
+        Invalid,     // not a data block of this file, or can't be decompressed
+    };
+
+    HashTreeVerifier(Size fileSize, std::string_view rootHash);
+    // Takes the root hash from the file's IncFS signature.
+    static std::optional<HashTreeVerifier> fromSignature(Size fileSize,
+                                                         Span<const char> signature);
+
+    HashTreeVerifier(HashTreeVerifier&& other) noexcept;
+    HashTreeVerifier& operator=(HashTreeVerifier&& other) noexcept;
+
+    const std::string& rootHash() const { return mRootHash; }
+
+    // Accepts the hash blocks that check out against the tree. The ones with a parent block that
+    // isn't known yet are kept around and get checked once the parent arrives.
+    // Returns 0, or -EBADMSG if some blocks didn't match and were dropped; their indices are
+    // put into |rejected|, if it's passed. A malformed block (no data, wrong kind, size or index)
+    // fails the whole batch with -EINVAL and nothing is added.
+    ErrorCode addHashBlocks(Span<const DataBlock> blocks,
+                            std::vector<BlockIndex>* rejected = nullptr);
+    bool hasHashFor(BlockIndex dataBlock) const;
+
+    // Checks a batch of data blocks, using multiple threads for large batches.
+    std::vector<Result> verify(Span<const DataBlock> blocks) const;
+    // Returns 0 if all the |blocks| are verified, -EBADMSG otherwise.
+    ErrorCode verifyAll(Span<const DataBlock> blocks) const;
+
+private:
+    const char* expectedHashLocked(BlockIndex hashBlock) const;
+    const char* expectedDataHashLocked(BlockIndex dataBlock) const;
+    Result verifyLocked(const DataBlock& block) const;
+
+    Size mFileSize = 0;
+    std::string mRootHash;
+    ByteBuffer mTree;
+    std::vector<bool> mVerified;
+    std::set<BlockIndex> mUnverified;
+    mutable std::shared_mutex mLock;
+};
+
+} // namespace android::incfs
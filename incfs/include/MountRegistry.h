@@ -106,6 +106,8 @@ public:
     Mounts copyMounts();
 
     void reload();
+    // Changes every time the system's mounts change, not only the ones of this filesystem.
+    uint64_t generation();
 
 private:
     [[nodiscard]] std::unique_lock<std::mutex> ensureUpToDate();
@@ -114,6 +116,7 @@ private:
     const std::string mFilesystem;
     base::unique_fd mMountInfo;
     Mounts mMounts;
+    uint64_t mGeneration = 0;
     mutable std::mutex mDataMutex;
 };
 
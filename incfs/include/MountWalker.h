@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "incfs.h"
+
+namespace android::incfs {
+
+//
+// MountInventory - every file of an IncFS mount, stored column by column. All paths are
+//      relative to the mount root and share a single string arena.
+//
+
+struct MountInventory {
+    std::string pathArena;
+    std::vector<uint32_t> pathOffsets; // one past the end of the last path is pathArena.size()
+    std::vector<FileId> ids;
+    std::vector<Size> sizes;
+    std::vector<uint32_t> metadataSizes;
+    // Only filled if the walk was asked for it.
+    std::vector<LoadingState> loadingStates;
+
+    size_t size() const { return ids.size(); }
+    std::string_view path(size_t index) const {
+        const auto end =
+                index + 1 < pathOffsets.size() ? pathOffsets[index + 1] : pathArena.size();
+        return std::string_view(pathArena).substr(pathOffsets[index], end - pathOffsets[index]);
+    }
+};
+
+struct WalkOptions {
+    bool loadingState = false;
+    // 0 means one per core.
+    int threads = 0;
+};
+
+// Lists all files of the mount, walking the subdirectories in parallel. The order of the
+// files in the result is unspecified. Returns 0 or -errno.
+ErrorCode walkMount(const Control& control, MountInventory* inventory, WalkOptions options = {});
+
+} // namespace android::incfs
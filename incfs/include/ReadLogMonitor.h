@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <mutex>
+
+#include "incfs_ndk.h"
+
+namespace android::incfs {
+
+//
+// ReadLogMonitor - watches the page reads coming out of the .log file for lost records: the
+//      kernel numbers them sequentially, and silently overwrites the oldest ones when the ring
+//      buffer is full. The 32-bit serial numbers are allowed to wrap around.
+//
+class ReadLogMonitor final {
+public:
+    void onRecords(const IncFsReadInfo reads[], size_t count);
+    IncFsReadLogStats stats() const;
+
+private:
+    IncFsReadLogStats mStats = {};
+    uint32_t mLastSerial = 0;
+    uint64_t mLastTsUs = 0;
+    mutable std::mutex mLock;
+};
+
+} // namespace android::incfs
@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <optional>
+#include <string_view>
+
+#include "incfs.h"
+
+namespace android::incfs {
+
+//
+// SignatureView - a validated IncFS file signature. It only keeps offsets into the buffer it
+//      was parsed from, so that buffer has to outlive it.
+//
+// Layout: version, hashing info (size, algorithm, log2 block size, salt, root hash),
+//         signing info (size, contents).
+//
+
+class SignatureView final {
+public:
+    // Returns nothing if |signature| isn't a valid IncFS signature; |error| gets -ERANGE for
+    // a wrong total size and -EINVAL for anything else.
+    static std::optional<SignatureView> parse(Span<const char> signature,
+                                              ErrorCode* error = nullptr);
+
+    int32_t version() const { return mVersion; }
+    HashAlgorithm hashAlgorithm() const { return mHashAlgorithm; }
+    int log2BlockSize() const { return mLog2BlockSize; }
+    std::string_view hashingInfo() const { return section(mHashing); }
+    std::string_view salt() const { return section(mSalt); }
+    std::string_view rootHash() const { return section(mRootHash); }
+    std::string_view signingInfo() const { return section(mSigning); }
+    std::string_view raw() const { return {mData, mSize}; }
+
+private:
+    struct Section {
+        uint32_t offset = 0;
+        uint32_t size = 0;
+    };
+
+    SignatureView(const char* data, size_t size) : mData(data), mSize(size) {}
+    std::string_view section(Section s) const { return {mData + s.offset, s.size}; }
+
+    const char* mData;
+    size_t mSize;
+    int32_t mVersion = 0;
+    HashAlgorithm mHashAlgorithm = HashAlgorithm::none;
+    int8_t mLog2BlockSize = 0;
+    Section mHashing;
+    Section mSalt;
+    Section mRootHash;
+    Section mSigning;
+};
+
+} // namespace android::incfs
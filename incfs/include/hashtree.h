@@ -0,0 +1,171 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <vector>
+
+#include "incfs.h"
+
+//
+// Geometry of the hash tree IncFS keeps for verified files, and helpers to figure out which
+// hash blocks a range of data depends on. Everything here is constexpr-friendly except the
+// functions returning vectors.
+//
+
+namespace android::incfs::hashtree {
+
+constexpr int kDigestSize = INCFS_MAX_HASH_SIZE; // SHA-256
+constexpr int kHashesPerBlock = kBlockSize / kDigestSize;
+constexpr int kMaxLevels = 8; // INCFS_MAX_MTREE_LEVELS in the kernel
+
+// Layout of the hash tree for a file. Level 0 hashes the data blocks and is stored last; the
+// top level (a single block) comes first in the hash area.
+struct Geometry {
+    int depth = 0;
+    BlockIndex totalBlocks = 0;
+    std::array<BlockIndex, kMaxLevels> levelBlocks = {};
+    std::array<BlockIndex, kMaxLevels> levelOffset = {};
+};
+
+constexpr BlockIndex dataBlocks(Size fileSize) {
+    return BlockIndex((fileSize + kBlockSize - 1) / kBlockSize);
+}
+
+constexpr Geometry geometry(Size fileSize) {
+    Geometry result;
+    // A single data block is verified directly against the root hash.
+    for (auto blocks = dataBlocks(fileSize); blocks > 1 && result.depth < kMaxLevels;) {
+        blocks = (blocks + kHashesPerBlock - 1) / kHashesPerBlock;
+        result.levelBlocks[result.depth++] = blocks;
+        result.totalBlocks += blocks;
+    }
+    for (int level = result.depth - 1, offset = 0; level >= 0; --level) {
+        result.levelOffset[level] = offset;
+        offset += result.levelBlocks[level];
+    }
+    return result;
+}
+
+// Same, for the hashing algorithm from the file's signature; unverified files have no tree.
+constexpr Geometry geometry(Size fileSize, HashAlgorithm algorithm) {
+    return algorithm == HashAlgorithm::sha256 ? geometry(fileSize) : Geometry{};
+}
+
+constexpr Size size(const Geometry& geometry) {
+    return Size(geometry.totalBlocks) * kBlockSize;
+}
+
+// Returns the level |hashBlock| belongs to, or -1 if it's outside of the tree.
+constexpr int levelOf(const Geometry& geometry, BlockIndex hashBlock) {
+    for (int level = 0; level < geometry.depth; ++level) {
+        if (hashBlock >= geometry.levelOffset[level] &&
+            hashBlock < geometry.levelOffset[level] + geometry.levelBlocks[level]) {
+            return level;
+        }
+    }
+    return -1;
+}
+
+// Hash block ranges covering some data, one range per tree level, from the top level down.
+struct CoveringRanges {
+    std::array<BlockRange, kMaxLevels> ranges = {};
+    int count = 0;
+
+    constexpr const BlockRange* begin() const { return ranges.data(); }
+    constexpr const BlockRange* end() const { return ranges.data() + count; }
+    constexpr bool empty() const { return count == 0; }
+};
+
+constexpr CoveringRanges coveringRanges(const Geometry& geometry, BlockRange data) {
+    CoveringRanges result;
+    if (data.empty() || data.begin < 0) {
+        return result;
+    }
+    auto begin = data.begin;
+    auto last = data.end - 1;
+    result.count = geometry.depth;
+    for (int level = 0; level < geometry.depth; ++level) {
+        begin /= kHashesPerBlock;
+        last /= kHashesPerBlock;
+        result.ranges[geometry.depth - 1 - level] =
+                BlockRange{{geometry.levelOffset[level] + begin,
+                            geometry.levelOffset[level] + last + 1}};
+    }
+    return result;
+}
+
+// Merges the overlapping and adjacent ranges, sorting them first.
+inline void normalize(std::vector<BlockRange>* ranges) {
+    std::sort(ranges->begin(), ranges->end(),
+              [](const BlockRange& l, const BlockRange& r) { return l.begin < r.begin; });
+    auto out = ranges->begin();
+    for (auto it = ranges->begin(); it != ranges->end(); ++it) {
+        if (it->empty()) {
+            continue;
+        }
+        if (out != ranges->begin() && std::prev(out)->end >= it->begin) {
+            std::prev(out)->end = std::max(std::prev(out)->end, it->end);
+        } else {
+            *out++ = *it;
+        }
+    }
+    ranges->erase(out, ranges->end());
+}
+
+// All hash blocks the |data| ranges depend on, sorted and merged.
+inline std::vector<BlockRange> coveringHashBlocks(const Geometry& geometry,
+                                                  Span<const BlockRange> data) {
+    std::vector<BlockRange> result;
+    result.reserve(data.size() * geometry.depth);
+    for (auto&& range : data) {
+        const auto covering = coveringRanges(geometry, range);
+        result.insert(result.end(), covering.begin(), covering.end());
+    }
+    normalize(&result);
+    return result;
+}
+
+// The hash blocks the |data| ranges depend on that aren't in |filledHashes| yet, e.g. as
+// returned by getFilledRanges(). These need to be sent together with the data.
+inline std::vector<BlockRange> missingHashBlocks(const Geometry& geometry,
+                                                 Span<const BlockRange> data,
+                                                 Span<const BlockRange> filledHashes) {
+    auto needed = coveringHashBlocks(geometry, data);
+    std::vector<BlockRange> filled(filledHashes.begin(), filledHashes.end());
+    normalize(&filled);
+
+    std::vector<BlockRange> result;
+    auto filledIt = filled.begin();
+    for (auto range : needed) {
+        while (filledIt != filled.end() && filledIt->end <= range.begin) {
+            ++filledIt;
+        }
+        for (auto it = filledIt; it != filled.end() && it->begin < range.end; ++it) {
+            if (it->begin > range.begin) {
+                result.push_back(BlockRange{{range.begin, it->begin}});
+            }
+            range.begin = std::max(range.begin, it->end);
+        }
+        if (!range.empty() && range.begin < range.end) {
+            result.push_back(range);
+        }
+    }
+    return result;
+}
+
+} // namespace android::incfs::hashtree
@@ -34,6 +34,8 @@ using ByteBuffer = std::vector<char>;
 enum MountFlags {
     createOnly = INCFS_MOUNT_CREATE_ONLY,
     truncate = INCFS_MOUNT_TRUNCATE,
+    truncateAsync = INCFS_MOUNT_TRUNCATE_ASYNC,
+    fastSetup = INCFS_MOUNT_FAST_SETUP,
 };
 
 enum Features {
@@ -176,11 +178,37 @@ using BlockIndex = IncFsBlockIndex;
 using ErrorCode = IncFsErrorCode;
 using Fd = IncFsFd;
 using ReadInfo = IncFsReadInfo;
+using ReadLogStats = IncFsReadLogStats;
 using RawMetadata = ByteBuffer;
 using RawSignature = ByteBuffer;
 using MountOptions = IncFsMountOptions;
+using MountTimings = IncFsMountTimings;
 using DataBlock = IncFsDataBlock;
 using NewFileParams = IncFsNewFileParams;
+using WriteRangeParams = IncFsWriteRangeParams;
+using NewFilledFile = IncFsNewFilledFile;
+
+// Attributes of many files packed into one buffer. Once it's grown to fit the largest batch,
+// reusing it doesn't allocate anymore.
+class FileAttrBatch final {
+public:
+    size_t size() const { return mRanges.size(); }
+    // Empty for the files that failed.
+    Span<const char> operator[](size_t i) const {
+        return {mArena.data() + mRanges[i].first, mRanges[i].second};
+    }
+    ErrorCode error(size_t i) const { return mErrors[i]; }
+
+    // Calls |getter(i, buffer, bufferSize)| for each of the |count| files, with at least
+    // |maxSize| bytes of room in |buffer|; returns the number of failed calls.
+    template <class Getter>
+    ErrorCode fill(size_t count, size_t maxSize, Getter&& getter);
+
+private:
+    ByteBuffer mArena;
+    std::vector<std::pair<uint32_t, uint32_t>> mRanges;
+    std::vector<ErrorCode> mErrors;
+};
 
 constexpr auto kDefaultReadTimeout = std::chrono::milliseconds(INCFS_DEFAULT_READ_TIMEOUT_MS);
 constexpr int kBlockSize = INCFS_DATA_FILE_BLOCK_SIZE;
@@ -195,6 +223,8 @@ bool isIncFsPath(std::string_view path);
 
 UniqueControl mount(std::string_view backingPath, std::string_view targetDir,
                     IncFsMountOptions options);
+UniqueControl mount(std::string_view backingPath, std::string_view targetDir,
+                    IncFsMountOptions options, MountTimings* timings);
 UniqueControl open(std::string_view dir);
 UniqueControl createControl(IncFsFd cmd, IncFsFd pendingReads, IncFsFd logs);
 
@@ -202,23 +232,44 @@ ErrorCode setOptions(const Control& control, MountOptions newOptions);
 
 ErrorCode bindMount(std::string_view sourceDir, std::string_view targetDir);
 ErrorCode unmount(std::string_view dir);
+std::vector<ErrorCode> bindMountAll(Span<const std::string_view> sourceDirs,
+                                    Span<const std::string_view> targetDirs,
+                                    int maxConcurrency = 0);
+std::vector<ErrorCode> unmountAll(Span<const std::string_view> dirs, int maxConcurrency = 0);
 
 std::string root(const Control& control);
 
 ErrorCode makeFile(const Control& control, std::string_view path, int mode, FileId fileId,
                    NewFileParams params);
+std::vector<ErrorCode> makeFilledFiles(const Control& control, Span<const NewFilledFile> files);
 ErrorCode makeDir(const Control& control, std::string_view path, int mode = 0555);
 ErrorCode makeDirs(const Control& control, std::string_view path, int mode = 0555);
+std::vector<ErrorCode> makeDirsAll(const Control& control, Span<const std::string_view> paths,
+                                   int mode = 0555);
 
 RawMetadata getMetadata(const Control& control, FileId fileId);
 RawMetadata getMetadata(const Control& control, std::string_view path);
 FileId getFileId(const Control& control, std::string_view path);
+std::vector<FileId> getFileIds(const Control& control, Span<const std::string_view> paths);
 
 RawSignature getSignature(const Control& control, FileId fileId);
 RawSignature getSignature(const Control& control, std::string_view path);
 
+// Same as above, but reuse the capacity of |buffer|. Return 0 or -errno.
+ErrorCode getMetadata(const Control& control, FileId fileId, RawMetadata* buffer);
+ErrorCode getMetadata(const Control& control, std::string_view path, RawMetadata* buffer);
+ErrorCode getSignature(const Control& control, FileId fileId, RawSignature* buffer);
+ErrorCode getSignature(const Control& control, std::string_view path, RawSignature* buffer);
+
+// Fetch the attributes of all |fileIds| into |batch|. Return the number of failed files.
+ErrorCode getMetadata(const Control& control, Span<const FileId> fileIds, FileAttrBatch* batch);
+ErrorCode getSignature(const Control& control, Span<const FileId> fileIds, FileAttrBatch* batch);
+
 ErrorCode link(const Control& control, std::string_view sourcePath, std::string_view targetPath);
 ErrorCode unlink(const Control& control, std::string_view path);
+std::vector<ErrorCode> linkAll(const Control& control, Span<const std::string_view> sourcePaths,
+                               Span<const std::string_view> targetPaths);
+std::vector<ErrorCode> unlinkAll(const Control& control, Span<const std::string_view> paths);
 
 enum class WaitResult { HaveData, Timeout, Error };
 
@@ -226,10 +277,14 @@ WaitResult waitForPendingReads(const Control& control, std::chrono::milliseconds
                                std::vector<ReadInfo>* pendingReadsBuffer);
 WaitResult waitForPageReads(const Control& control, std::chrono::milliseconds timeout,
                             std::vector<ReadInfo>* pageReadsBuffer);
+ReadLogStats readLogStats(const Control& control);
 
 UniqueFd openForSpecialOps(const Control& control, FileId fileId);
 UniqueFd openForSpecialOps(const Control& control, std::string_view path);
 ErrorCode writeBlocks(Span<const DataBlock> blocks);
+Size writeRange(int fd, Size offset, Span<const char> data, WriteRangeParams params = {});
+Size writeRangeFromFd(int fd, Size offset, int srcFd, Size srcOffset, Size length,
+                      WriteRangeParams params = {});
 
 std::pair<ErrorCode, FilledRanges> getFilledRanges(int fd);
 std::pair<ErrorCode, FilledRanges> getFilledRanges(int fd, FilledRanges::RangeBuffer&& buffer);
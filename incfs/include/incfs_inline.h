@@ -17,6 +17,7 @@
 
 #include <errno.h>
 
+#include <algorithm>
 #include <optional>
 #include <string>
 
@@ -29,6 +30,7 @@ constexpr char kSizeAttrName[] = INCFS_XATTR_SIZE_NAME;
 constexpr char kMetadataAttrName[] = INCFS_XATTR_METADATA_NAME;
 
 constexpr char kIndexDir[] = ".index";
+constexpr char kIncompleteDir[] = ".incomplete";
 
 namespace details {
 
@@ -60,6 +62,34 @@ inline CStrWrapper c_str(std::string_view sv) {
     return {sv};
 }
 
+// Null-terminated copies of a batch of paths for the C API, all in a single buffer.
+class CStrArray {
+public:
+    explicit CStrArray(Span<const std::string_view> svs) {
+        size_t size = 0;
+        for (auto sv : svs) {
+            size += sv.size() + 1;
+        }
+        mBuffer.reserve(size);
+        mCstrs.reserve(svs.size());
+        for (auto sv : svs) {
+            mCstrs.push_back(mBuffer.data() + mBuffer.size());
+            mBuffer.append(sv);
+            mBuffer.push_back('\0');
+        }
+    }
+
+    CStrArray(const CStrArray&) = delete;
+    void operator=(const CStrArray&) = delete;
+
+    const char* const* get() const { return mCstrs.data(); }
+    operator const char* const*() const { return get(); }
+
+private:
+    std::string mBuffer;
+    std::vector<const char*> mCstrs;
+};
+
 } // namespace details
 
 inline bool enabled() {
@@ -128,6 +158,13 @@ inline UniqueControl mount(std::string_view backingPath, std::string_view target
     return UniqueControl(control);
 }
 
+inline UniqueControl mount(std::string_view backingPath, std::string_view targetDir,
+                           MountOptions options, MountTimings* timings) {
+    auto control = IncFs_MountWithTimings(details::c_str(backingPath), details::c_str(targetDir),
+                                          options, timings);
+    return UniqueControl(control);
+}
+
 inline UniqueControl open(std::string_view dir) {
     auto control = IncFs_Open(details::c_str(dir));
     return UniqueControl(control);
@@ -149,6 +186,33 @@ inline ErrorCode unmount(std::string_view dir) {
     return IncFs_Unmount(details::c_str(dir));
 }
 
+inline std::vector<ErrorCode> bindMountAll(Span<const std::string_view> sourceDirs,
+                                           Span<const std::string_view> targetDirs,
+                                           int maxConcurrency) {
+    std::vector<ErrorCode> results(sourceDirs.size());
+    if (const auto err = IncFs_BindMountAll(details::CStrArray(sourceDirs),
+                                            details::CStrArray(targetDirs),
+                                            std::min(sourceDirs.size(), targetDirs.size()),
+                                            maxConcurrency, results.data());
+        err < 0) {
+        std::fill(results.begin(), results.end(), err);
+    } else if (targetDirs.size() < sourceDirs.size()) {
+        std::fill(results.begin() + targetDirs.size(), results.end(), -EINVAL);
+    }
+    return results;
+}
+
+inline std::vector<ErrorCode> unmountAll(Span<const std::string_view> dirs,
+                                         int maxConcurrency) {
+    std::vector<ErrorCode> results(dirs.size());
+    if (const auto err = IncFs_UnmountAll(details::CStrArray(dirs), dirs.size(), maxConcurrency,
+                                          results.data());
+        err < 0) {
+        std::fill(results.begin(), results.end(), err);
+    }
+    return results;
+}
+
 inline std::string root(const Control& control) {
     std::string result;
     result.resize(PATH_MAX);
@@ -165,6 +229,16 @@ inline ErrorCode makeFile(const Control& control, std::string_view path, int mod
                           NewFileParams params) {
     return IncFs_MakeFile(control, details::c_str(path), mode, fileId, params);
 }
+inline std::vector<ErrorCode> makeFilledFiles(const Control& control,
+                                              Span<const NewFilledFile> files) {
+    std::vector<ErrorCode> results(files.size());
+    if (const auto err =
+                IncFs_MakeFilledFiles(control, files.data(), files.size(), results.data());
+        err < 0) {
+        std::fill(results.begin(), results.end(), err);
+    }
+    return results;
+}
 inline ErrorCode makeDir(const Control& control, std::string_view path, int mode) {
     return IncFs_MakeDir(control, details::c_str(path), mode);
 }
@@ -172,6 +246,17 @@ inline ErrorCode makeDirs(const Control& control, std::string_view path, int mod
     return IncFs_MakeDirs(control, details::c_str(path), mode);
 }
 
+inline std::vector<ErrorCode> makeDirsAll(const Control& control,
+                                          Span<const std::string_view> paths, int mode) {
+    std::vector<ErrorCode> results(paths.size());
+    if (const auto err = IncFs_MakeDirsAll(control, details::CStrArray(paths), paths.size(), mode,
+                                           results.data());
+        err < 0) {
+        std::fill(results.begin(), results.end(), err);
+    }
+    return results;
+}
+
 inline RawMetadata getMetadata(const Control& control, FileId fileId) {
     RawMetadata metadata(INCFS_MAX_FILE_ATTR_SIZE);
     size_t size = metadata.size();
@@ -212,9 +297,100 @@ inline RawSignature getSignature(const Control& control, std::string_view path)
     return signature;
 }
 
+namespace details {
+
+// Calls |getter(buffer, bufferSize)| with at least |maxSize| bytes of room in |buffer|.
+template <class Getter>
+ErrorCode fillAttr(ByteBuffer* buffer, size_t maxSize, Getter&& getter) {
+    buffer->resize(maxSize);
+    size_t size = buffer->size();
+    if (const auto err = getter(buffer->data(), &size); err < 0) {
+        buffer->clear();
+        return err;
+    }
+    buffer->resize(size);
+    return 0;
+}
+
+} // namespace details
+
+inline ErrorCode getMetadata(const Control& control, FileId fileId, RawMetadata* buffer) {
+    return details::fillAttr(buffer, INCFS_MAX_FILE_ATTR_SIZE, [&](char* data, size_t* size) {
+        return IncFs_GetMetadataById(control, fileId, data, size);
+    });
+}
+
+inline ErrorCode getMetadata(const Control& control, std::string_view path,
+                             RawMetadata* buffer) {
+    return details::fillAttr(buffer, INCFS_MAX_FILE_ATTR_SIZE, [&](char* data, size_t* size) {
+        return IncFs_GetMetadataByPath(control, details::c_str(path), data, size);
+    });
+}
+
+inline ErrorCode getSignature(const Control& control, FileId fileId, RawSignature* buffer) {
+    return details::fillAttr(buffer, INCFS_MAX_SIGNATURE_SIZE, [&](char* data, size_t* size) {
+        return IncFs_GetSignatureById(control, fileId, data, size);
+    });
+}
+
+inline ErrorCode getSignature(const Control& control, std::string_view path,
+                              RawSignature* buffer) {
+    return details::fillAttr(buffer, INCFS_MAX_SIGNATURE_SIZE, [&](char* data, size_t* size) {
+        return IncFs_GetSignatureByPath(control, details::c_str(path), data, size);
+    });
+}
+
+template <class Getter>
+ErrorCode FileAttrBatch::fill(size_t count, size_t maxSize, Getter&& getter) {
+    mRanges.resize(count);
+    mErrors.resize(count);
+    ErrorCode failures = 0;
+    size_t used = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (mArena.size() < used + maxSize) {
+            mArena.resize(used + maxSize);
+        }
+        size_t size = maxSize;
+        const auto err = getter(i, mArena.data() + used, &size);
+        mErrors[i] = std::min(err, 0);
+        if (err < 0) {
+            mRanges[i] = {used, 0};
+            ++failures;
+            continue;
+        }
+        mRanges[i] = {used, size};
+        used += size;
+    }
+    return failures;
+}
+
+inline ErrorCode getMetadata(const Control& control, Span<const FileId> fileIds,
+                             FileAttrBatch* batch) {
+    return batch->fill(fileIds.size(), INCFS_MAX_FILE_ATTR_SIZE,
+                       [&](size_t i, char* data, size_t* size) {
+                           return IncFs_GetMetadataById(control, fileIds[i], data, size);
+                       });
+}
+
+inline ErrorCode getSignature(const Control& control, Span<const FileId> fileIds,
+                              FileAttrBatch* batch) {
+    return batch->fill(fileIds.size(), INCFS_MAX_SIGNATURE_SIZE,
+                       [&](size_t i, char* data, size_t* size) {
+                           return IncFs_GetSignatureById(control, fileIds[i], data, size);
+                       });
+}
+
 inline FileId getFileId(const Control& control, std::string_view path) {
     return IncFs_GetId(control, details::c_str(path));
 }
+inline std::vector<FileId> getFileIds(const Control& control,
+                                      Span<const std::string_view> paths) {
+    std::vector<FileId> ids(paths.size());
+    if (IncFs_GetIds(control, details::CStrArray(paths), paths.size(), ids.data()) < 0) {
+        std::fill(ids.begin(), ids.end(), kIncFsInvalidFileId);
+    }
+    return ids;
+}
 
 inline ErrorCode link(const Control& control, std::string_view sourcePath,
                       std::string_view targetPath) {
@@ -225,6 +401,33 @@ inline ErrorCode unlink(const Control& control, std::string_view path) {
     return IncFs_Unlink(control, details::c_str(path));
 }
 
+inline std::vector<ErrorCode> linkAll(const Control& control,
+                                      Span<const std::string_view> sourcePaths,
+                                      Span<const std::string_view> targetPaths) {
+    std::vector<ErrorCode> results(sourcePaths.size());
+    if (const auto err = IncFs_LinkAll(control, details::CStrArray(sourcePaths),
+                                       details::CStrArray(targetPaths),
+                                       std::min(sourcePaths.size(), targetPaths.size()),
+                                       results.data());
+        err < 0) {
+        std::fill(results.begin(), results.end(), err);
+    } else if (targetPaths.size() < sourcePaths.size()) {
+        std::fill(results.begin() + targetPaths.size(), results.end(), -EINVAL);
+    }
+    return results;
+}
+
+inline std::vector<ErrorCode> unlinkAll(const Control& control,
+                                        Span<const std::string_view> paths) {
+    std::vector<ErrorCode> results(paths.size());
+    if (const auto err =
+                IncFs_UnlinkAll(control, details::CStrArray(paths), paths.size(), results.data());
+        err < 0) {
+        std::fill(results.begin(), results.end(), err);
+    }
+    return results;
+}
+
 inline WaitResult waitForPendingReads(const Control& control, std::chrono::milliseconds timeout,
                                       std::vector<ReadInfo>* pendingReadsBuffer) {
     static constexpr auto kDefaultBufferSize = INCFS_DEFAULT_PENDING_READ_BUFFER_SIZE;
@@ -264,6 +467,12 @@ inline WaitResult waitForPageReads(const Control& control, std::chrono::millisec
     return WaitResult(err);
 }
 
+inline ReadLogStats readLogStats(const Control& control) {
+    ReadLogStats stats = {};
+    IncFs_GetReadLogStats(control, &stats);
+    return stats;
+}
+
 inline UniqueFd openForSpecialOps(const Control& control, FileId fileId) {
     return UniqueFd(IncFs_OpenForSpecialOpsById(control, fileId));
 }
@@ -275,6 +484,15 @@ inline ErrorCode writeBlocks(Span<const DataBlock> blocks) {
     return IncFs_WriteBlocks(blocks.data(), blocks.size());
 }
 
+inline Size writeRange(int fd, Size offset, Span<const char> data, WriteRangeParams params) {
+    return IncFs_WriteRange(fd, offset, {data.data(), Size(data.size())}, params);
+}
+
+inline Size writeRangeFromFd(int fd, Size offset, int srcFd, Size srcOffset, Size length,
+                             WriteRangeParams params) {
+    return IncFs_WriteRangeFromFd(fd, offset, srcFd, srcOffset, length, params);
+}
+
 inline std::pair<ErrorCode, FilledRanges> getFilledRanges(int fd) {
     return getFilledRanges(fd, FilledRanges());
 }
@@ -73,6 +73,12 @@ typedef enum {
 typedef enum {
     INCFS_MOUNT_CREATE_ONLY = 1,
     INCFS_MOUNT_TRUNCATE = 2,
+    // With INCFS_MOUNT_TRUNCATE: move the old content into IncFsMountOptions::trashDir and
+    // delete it in the background.
+    INCFS_MOUNT_TRUNCATE_ASYNC = 4,
+    // Validate the target through a single fd, and open the control files on the new mount
+    // while their SELinux labels are being restored.
+    INCFS_MOUNT_FAST_SETUP = 8,
 } IncFsMountFlags;
 
 typedef enum {
@@ -85,8 +91,27 @@ typedef struct {
     int32_t defaultReadTimeoutMs;
     int32_t readLogBufferPages;
     int32_t readLogDisableAfterTimeoutMs;
+    // 0 keeps the default of no readahead.
+    int32_t readAheadPages;
+    // Wake up the read log readers once this many records are there; 0 means every record.
+    int32_t readLogWakeupCount;
+    // For INCFS_MOUNT_TRUNCATE_ASYNC: a caller-owned directory on the same filesystem as the
+    // backing dir. Everything inside it is deleted in the background. Without it the truncation
+    // is synchronous.
+    const char* trashDir;
 } IncFsMountOptions;
 
+// Time spent in each step of IncFs_MountWithTimings(), in microseconds.
+typedef struct {
+    int64_t validateUs;
+    int64_t prepareBackingUs;
+    int64_t mountUs;
+    int64_t restoreconUs;
+    int64_t controlUs;
+    // With INCFS_MOUNT_FAST_SETUP restorecon and control setup overlap, so it's less than the sum.
+    int64_t totalUs;
+} IncFsMountTimings;
+
 typedef enum {
     INCFS_COMPRESSION_KIND_NONE,
     INCFS_COMPRESSION_KIND_LZ4,
@@ -119,6 +144,17 @@ typedef struct {
     uint32_t serialNo;
 } IncFsReadInfo;
 
+// What IncFs_WaitForPageReads() has seen on a control so far. Missing serial numbers mean
+// the .log ring buffer overflowed before the records were read.
+typedef struct {
+    uint64_t records;
+    uint64_t droppedRecords;
+    // Number of times records went missing.
+    uint32_t gaps;
+    // Serial numbers or timestamps going backwards, e.g. after the log was reset.
+    uint32_t discontinuities;
+} IncFsReadLogStats;
+
 typedef struct {
     IncFsBlockIndex begin;
     IncFsBlockIndex end;
@@ -132,6 +168,26 @@ typedef struct {
     IncFsBlockIndex endIndex;
 } IncFsFilledRanges;
 
+typedef struct {
+    // INCFS_COMPRESSION_KIND_LZ4 compresses each block, keeping the ones that don't shrink as-is.
+    IncFsCompressionKind compression;
+    // Optional: the complete hash tree of the file, laid out the same way IncFS stores it. If
+    // present, the hash blocks covering the written range are written together with the data.
+    IncFsSpan hashTree;
+} IncFsWriteRangeParams;
+
+typedef struct {
+    // Absolute, or relative to the mount root.
+    const char* path;
+    int32_t mode;
+    IncFsFileId id;
+    IncFsNewFileParams params;
+    // All of the file's data, |params.size| bytes.
+    IncFsSpan data;
+    // Optional: the complete hash tree of a verified file, laid out the same way IncFS stores it.
+    IncFsSpan hashTree;
+} IncFsNewFilledFile;
+
 // All functions return -errno in case of failure.
 // All IncFsFd functions return >=0 in case of success.
 // All IncFsFileId functions return invalid IncFsFileId on error.
@@ -141,6 +197,8 @@ bool IncFs_IsEnabled();
 IncFsFeatures IncFs_Features();
 
 bool IncFs_IsIncFsPath(const char* path);
+// Checks all |paths| at once; returns the number of IncFS ones, or -errno.
+IncFsErrorCode IncFs_AreIncFsPaths(const char* const paths[], size_t count, bool results[]);
 
 static inline bool IncFs_IsValidFileId(IncFsFileId fileId) {
     return memcmp(&fileId, &kIncFsInvalidFileId, sizeof(fileId)) != 0;
@@ -150,9 +208,14 @@ int IncFs_FileIdToString(IncFsFileId id, char* out);
 IncFsFileId IncFs_FileIdFromString(const char* in);
 
 IncFsFileId IncFs_FileIdFromMetadata(IncFsSpan metadata);
+// Same as IncFs_FileIdFromMetadata() for each of |metadata|, multithreaded for large batches.
+IncFsErrorCode IncFs_FileIdsFromMetadata(const IncFsSpan metadata[], size_t count,
+                                         IncFsFileId ids[]);
 
 IncFsControl* IncFs_Mount(const char* backingPath, const char* targetDir,
                           IncFsMountOptions options);
+IncFsControl* IncFs_MountWithTimings(const char* backingPath, const char* targetDir,
+                                     IncFsMountOptions options, IncFsMountTimings* timings);
 IncFsControl* IncFs_Open(const char* dir);
 IncFsControl* IncFs_CreateControl(IncFsFd cmd, IncFsFd pendingReads, IncFsFd logs);
 void IncFs_DeleteControl(IncFsControl* control);
@@ -163,14 +226,37 @@ IncFsErrorCode IncFs_SetOptions(const IncFsControl* control, IncFsMountOptions o
 
 IncFsErrorCode IncFs_BindMount(const char* sourceDir, const char* targetDir);
 IncFsErrorCode IncFs_Unmount(const char* dir);
+// Batch versions of the above: run up to |maxConcurrency| operations at a time (0 - one per
+// core) and put what the single call would have returned into |results|. The mounts are
+// reloaded once at the end. Return the number of failed operations, or -errno.
+IncFsErrorCode IncFs_BindMountAll(const char* const sourceDirs[], const char* const targetDirs[],
+                                  size_t count, int maxConcurrency, IncFsErrorCode results[]);
+IncFsErrorCode IncFs_UnmountAll(const char* const dirs[], size_t count, int maxConcurrency,
+                                IncFsErrorCode results[]);
 
 IncFsErrorCode IncFs_Root(const IncFsControl* control, char buffer[], size_t* bufferSize);
 
 IncFsErrorCode IncFs_MakeFile(const IncFsControl* control, const char* path, int32_t mode,
                               IncFsFileId id, IncFsNewFileParams params);
 IncFsErrorCode IncFs_MakeDir(const IncFsControl* control, const char* path, int32_t mode);
+// Creates the files and writes all of their data and hash blocks. Meant for batches of small
+// files, but there's no batched kernel call: each file still costs a CREATE_FILE ioctl, an
+// open() and fchmod() of its .index entry and one FILL_BLOCKS ioctl. Compared to MakeFile(),
+// OpenForSpecialOpsById() and WriteBlocks() per file, this only saves the mount lookup for
+// relative paths and the per-call overhead.
+// A file that fails is removed if it got created, and the rest of the batch goes on. |results|
+// get 0 or -errno for each file; returns the number of failures, or -errno.
+IncFsErrorCode IncFs_MakeFilledFiles(const IncFsControl* control,
+                                     const IncFsNewFilledFile files[], size_t filesCount,
+                                     IncFsErrorCode results[]);
 IncFsErrorCode IncFs_MakeDirs(const IncFsControl* control, const char* path, int32_t mode);
+// Creates all |paths| with their parents, each directory only once. |results| get what
+// IncFs_MakeDirs() would return for each path; returns the number of failures, or -errno.
+IncFsErrorCode IncFs_MakeDirsAll(const IncFsControl* control, const char* const paths[],
+                                 size_t count, int32_t mode, IncFsErrorCode results[]);
 
+// The ById getters cache the values per |control|. Files created or unlinked through that
+// control update the cache, an id freed and reused by any other means may return stale values.
 IncFsErrorCode IncFs_GetMetadataById(const IncFsControl* control, IncFsFileId id, char buffer[],
                                      size_t* bufferSize);
 IncFsErrorCode IncFs_GetMetadataByPath(const IncFsControl* control, const char* path, char buffer[],
@@ -183,21 +269,43 @@ IncFsErrorCode IncFs_GetSignatureByPath(const IncFsControl* control, const char*
 IncFsErrorCode IncFs_UnsafeGetSignatureByPath(const char* path, char buffer[], size_t* bufferSize);
 
 IncFsFileId IncFs_GetId(const IncFsControl* control, const char* path);
+// Looks up the ids of many files at once; ids of the files that can't be found are set to
+// kIncFsInvalidFileId. Returns the number of ids found, or -errno.
+IncFsErrorCode IncFs_GetIds(const IncFsControl* control, const char* const paths[], size_t count,
+                            IncFsFileId ids[]);
 
 IncFsErrorCode IncFs_Link(const IncFsControl* control, const char* sourcePath,
                           const char* targetPath);
 IncFsErrorCode IncFs_Unlink(const IncFsControl* control, const char* path);
+// Batch versions of the above, resolving the mount root once for all paths. |results| get
+// the result for each item; return the number of failures, or -errno.
+IncFsErrorCode IncFs_LinkAll(const IncFsControl* control, const char* const sourcePaths[],
+                             const char* const targetPaths[], size_t count,
+                             IncFsErrorCode results[]);
+IncFsErrorCode IncFs_UnlinkAll(const IncFsControl* control, const char* const paths[],
+                               size_t count, IncFsErrorCode results[]);
 
 IncFsErrorCode IncFs_WaitForPendingReads(const IncFsControl* control, int32_t timeoutMs,
                                          IncFsReadInfo buffer[], size_t* bufferSize);
 IncFsErrorCode IncFs_WaitForPageReads(const IncFsControl* control, int32_t timeoutMs,
                                       IncFsReadInfo buffer[], size_t* bufferSize);
+IncFsErrorCode IncFs_GetReadLogStats(const IncFsControl* control, IncFsReadLogStats* stats);
 
 IncFsFd IncFs_OpenForSpecialOpsByPath(const IncFsControl* control, const char* path);
 IncFsFd IncFs_OpenForSpecialOpsById(const IncFsControl* control, IncFsFileId id);
 
 IncFsErrorCode IncFs_WriteBlocks(const IncFsDataBlock blocks[], size_t blocksCount);
 
+// Splits the data into blocks and writes it into the file opened for special ops |fd|, starting
+// at the block-aligned |offset|. Only the last block of the file may be written partially.
+// Returns the number of data bytes written, or -errno if nothing was.
+IncFsSize IncFs_WriteRange(IncFsFd fd, IncFsSize offset, IncFsSpan data,
+                           IncFsWriteRangeParams params);
+// Same as IncFs_WriteRange(), reading |length| bytes of data from |srcFd| at |srcOffset|.
+// Regular source files are memory-mapped and written without an intermediate copy.
+IncFsSize IncFs_WriteRangeFromFd(IncFsFd fd, IncFsSize offset, IncFsFd srcFd, IncFsSize srcOffset,
+                                 IncFsSize length, IncFsWriteRangeParams params);
+
 // Gets a collection of filled ranges in the file from IncFS. Uses the |outBuffer| memory, it has
 // to be big enough to fit all the ranges the caller is expecting.
 // Return codes:
@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace android::incfs::details {
+
+// Calls |func(i)| for every i in [0, count), spreading the calls over the available cores, or
+// over at most |maxThreads| threads if it's not 0.
+// Small inputs (less than |minPerThread| items for a second thread) run on the calling thread.
+template <class Func>
+void parallelFor(size_t count, size_t minPerThread, Func&& func, size_t maxThreads = 0) {
+    const auto cores = std::max<size_t>(1, std::thread::hardware_concurrency());
+    const auto threads = std::min<size_t>(maxThreads ? maxThreads : cores,
+                                          count / std::max<size_t>(1, minPerThread));
+    if (threads <= 1) {
+        for (size_t i = 0; i < count; ++i) {
+            func(i);
+        }
+        return;
+    }
+
+    std::atomic<size_t> next = 0;
+    const auto worker = [&] {
+        for (auto i = next++; i < count; i = next++) {
+            func(i);
+        }
+    };
+    std::vector<std::thread> pool;
+    pool.reserve(threads - 1);
+    for (size_t i = 1; i < threads; ++i) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (auto&& thread : pool) {
+        thread.join();
+    }
+}
+
+} // namespace android::incfs::details
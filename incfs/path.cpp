@@ -25,6 +25,7 @@
 #include <limits.h>
 #include <stdlib.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 
 using namespace std::literals;
@@ -231,6 +232,36 @@ std::pair<std::string_view, std::string_view> splitDirBase(std::string& full) {
     return res;
 }
 
+int forEachEntry(int dirFd, const std::function<int(const char* name, unsigned char type)>& func) {
+    struct linux_dirent64 {
+        uint64_t d_ino;
+        int64_t d_off;
+        unsigned short d_reclen;
+        unsigned char d_type;
+        char d_name[];
+    };
+    alignas(linux_dirent64) char buffer[32 * 1024];
+    for (;;) {
+        const auto size = ::syscall(SYS_getdents64, dirFd, buffer, sizeof(buffer));
+        if (size < 0) {
+            return -errno;
+        }
+        if (size == 0) {
+            return 0;
+        }
+        for (long offset = 0; offset < size;) {
+            const auto entry = reinterpret_cast<const linux_dirent64*>(buffer + offset);
+            offset += entry->d_reclen;
+            if (entry->d_name == "."sv || entry->d_name == ".."sv) {
+                continue;
+            }
+            if (const auto res = func(entry->d_name, entry->d_type)) {
+                return res;
+            }
+        }
+    }
+}
+
 int isEmptyDir(std::string_view dir) {
     const auto d = std::unique_ptr<DIR, decltype(&::closedir)>{::opendir(c_str(dir)), ::closedir};
     if (!d) {
@@ -16,6 +16,7 @@
 
 #pragma once
 
+#include <functional>
 #include <iterator>
 #include <optional>
 #include <string>
@@ -59,6 +60,11 @@ int isEmptyDir(std::string_view dir);
 bool startsWith(std::string_view path, std::string_view prefix);
 bool endsWith(std::string_view path, std::string_view prefix);
 
+// Calls |func(name, type)| for every entry of the open directory except "." and "..", reading
+// them with getdents64() straight into a buffer. |type| is the DT_* value, possibly DT_UNKNOWN.
+// Returns 0, the first nonzero |func| result, or -errno.
+int forEachEntry(int dirFd, const std::function<int(const char* name, unsigned char type)>& func);
+
 inline auto openDir(const char* path) {
     auto dir = std::unique_ptr<DIR, decltype(&closedir)>(::opendir(path), &::closedir);
     return dir;
@@ -0,0 +1,274 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "incfs-rmtree"
+
+#include "rmtree.h"
+
+#include <android-base/logging.h>
+#include <android-base/unique_fd.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "path.h"
+
+using android::base::unique_fd;
+
+namespace android::incfs::rmtree {
+
+namespace {
+
+// A directory being emptied. It gets removed from its parent once its own listing and all of
+// its subdirectories are done. Subdirectories are only opened once a worker takes them, so
+// the queued ones don't hold an fd.
+struct Node {
+    Node(std::shared_ptr<Node> parent, unique_fd fd, std::string name)
+          : parent(std::move(parent)), fd(std::move(fd)), name(std::move(name)) {}
+
+    std::shared_ptr<Node> parent;
+    unique_fd fd;
+    const std::string name;
+    std::atomic<int> pending = 1;
+};
+using NodePtr = std::shared_ptr<Node>;
+
+class Remover {
+public:
+    explicit Remover(unsigned threads) : mThreads(std::max(1u, threads)) {}
+
+    int operator()(unique_fd dir);
+
+private:
+    void enqueue(NodePtr node) {
+        std::lock_guard lock(mLock);
+        mQueue.push_back(std::move(node));
+        mCv.notify_one();
+    }
+    // Takes the newest node, so the walk goes depth first and the open fds are bounded by the
+    // tree depth (per thread), not by its width.
+    NodePtr takeLocked() {
+        auto node = std::move(mQueue.back());
+        mQueue.pop_back();
+        return node;
+    }
+    void setError(int error) {
+        int expected = 0;
+        mError.compare_exchange_strong(expected, error);
+    }
+    void run();
+    static int open(Node& node);
+    int empty(const NodePtr& node);
+    void finish(NodePtr node);
+
+    const unsigned mThreads;
+    std::mutex mLock;
+    std::condition_variable mCv;
+    std::deque<NodePtr> mQueue;
+    bool mDone = false;
+    std::atomic<int> mError = 0;
+};
+
+void Remover::run() {
+    for (;;) {
+        NodePtr node;
+        {
+            std::unique_lock lock(mLock);
+            mCv.wait(lock, [this] { return mDone || !mQueue.empty(); });
+            if (mQueue.empty()) {
+                return;
+            }
+            node = takeLocked();
+        }
+        if (!mError) {
+            auto err = open(*node);
+            if (err == 0) {
+                err = empty(node);
+            }
+            if (err) {
+                setError(err);
+            }
+        }
+        finish(std::move(node));
+    }
+}
+
+int Remover::open(Node& node) {
+    if (node.fd.ok()) {
+        return 0;
+    }
+    node.fd.reset(::openat(node.parent->fd.get(), node.name.c_str(),
+                           O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC));
+    return node.fd.ok() ? 0 : -errno;
+}
+
+// Unlinks the files right away and queues up the subdirectories.
+int Remover::empty(const NodePtr& node) {
+    const auto dirFd = node->fd.get();
+    return path::forEachEntry(dirFd, [&](const char* name, unsigned char type) {
+        if (type == DT_UNKNOWN) {
+            struct stat st;
+            if (::fstatat(dirFd, name, &st, AT_SYMLINK_NOFOLLOW)) {
+                return -errno;
+            }
+            type = S_ISDIR(st.st_mode) ? DT_DIR : DT_REG;
+        }
+        if (type != DT_DIR) {
+            return ::unlinkat(dirFd, name, 0) ? -errno : 0;
+        }
+        ++node->pending;
+        enqueue(std::make_shared<Node>(node, unique_fd(), name));
+        return 0;
+    });
+}
+
+void Remover::finish(NodePtr node) {
+    while (--node->pending == 0) {
+        auto parent = std::move(node->parent);
+        if (!parent) {
+            std::lock_guard lock(mLock);
+            mDone = true;
+            mCv.notify_all();
+            return;
+        }
+        node->fd.reset();
+        if (!mError && ::unlinkat(parent->fd.get(), node->name.c_str(), AT_REMOVEDIR)) {
+            setError(-errno);
+        }
+        node = std::move(parent);
+    }
+}
+
+int Remover::operator()(unique_fd dir) {
+    enqueue(std::make_shared<Node>(nullptr, std::move(dir), std::string()));
+    std::vector<std::thread> pool;
+    for (unsigned i = 1; i < mThreads; ++i) {
+        pool.emplace_back([this] { run(); });
+    }
+    run();
+    for (auto&& thread : pool) {
+        thread.join();
+    }
+    return mError;
+}
+
+} // namespace
+
+int removeContent(std::string_view dir) {
+    unique_fd fd(::open(std::string(dir).c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+    if (!fd.ok()) {
+        return -errno;
+    }
+    return Remover(std::thread::hardware_concurrency())(std::move(fd));
+}
+
+namespace {
+
+// Empties the trash directories one by one on a single thread, which only runs while there's
+// something to delete.
+class BackgroundDeleter {
+public:
+    // Only the entries that haven't started are deduplicated: the one being emptied may have
+    // been listed before |trash| got its new content.
+    void add(std::string trash) {
+        std::lock_guard lock(mLock);
+        if (std::find(mQueue.begin(), mQueue.end(), trash) != mQueue.end()) {
+            return;
+        }
+        mQueue.push_back(std::move(trash));
+        if (!mRunning) {
+            mRunning = true;
+            std::thread([this] { run(); }).detach();
+        }
+    }
+
+    void wait() {
+        std::unique_lock lock(mLock);
+        mIdle.wait(lock, [this] { return !mRunning; });
+    }
+
+private:
+    void run() {
+        for (;;) {
+            std::string trash;
+            {
+                std::lock_guard lock(mLock);
+                if (mQueue.empty()) {
+                    mRunning = false;
+                    mIdle.notify_all();
+                    return;
+                }
+                trash = std::move(mQueue.front());
+                mQueue.pop_front();
+            }
+            unique_fd fd(::open(trash.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+            if (!fd.ok()) {
+                PLOG(WARNING) << "Failed to open the trash " << trash;
+            } else if (const auto err = Remover(1)(std::move(fd))) {
+                LOG(WARNING) << "Failed to empty the trash " << trash << ": " << err;
+            }
+        }
+    }
+
+    std::mutex mLock;
+    std::condition_variable mIdle;
+    std::deque<std::string> mQueue;
+    bool mRunning = false;
+};
+
+// Never destroyed: the deleter thread may still be running at exit.
+BackgroundDeleter& backgroundDeleter() {
+    static auto deleter = new BackgroundDeleter();
+    return *deleter;
+}
+
+} // namespace
+
+int removeContentAsync(std::string_view dir, std::string_view trash) {
+    auto target = path::join(trash, "XXXXXX");
+    if (!::mkdtemp(target.data())) {
+        PLOG(WARNING) << "Failed to create a directory in the trash " << trash;
+        return removeContent(dir);
+    }
+    unique_fd from(::open(std::string(dir).c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+    unique_fd to(::open(target.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+    if (!from.ok() || !to.ok()) {
+        return -errno;
+    }
+    const auto err = path::forEachEntry(from.get(), [&](const char* name, unsigned char) {
+        return ::renameat(from.get(), name, to.get(), name) ? -errno : 0;
+    });
+    backgroundDeleter().add(std::string(trash));
+    // Whatever couldn't be moved has to go the slow way.
+    return err ? removeContent(dir) : 0;
+}
+
+void waitForBackgroundDeletion() {
+    backgroundDeleter().wait();
+}
+
+} // namespace android::incfs::rmtree
@@ -0,0 +1,36 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <string_view>
+
+namespace android::incfs::rmtree {
+
+// Deletes everything inside |dir|, but not the directory itself. Subdirectories get emptied
+// in parallel, all through directory fds. Returns 0 or -errno.
+int removeContent(std::string_view dir);
+
+// Moves everything inside |dir| into a new subdirectory of |trash|, and has the background
+// deleter empty |trash|, including any leftovers from earlier calls, e.g. from before a crash.
+// The deleter is a single thread shared by all calls. Whatever can't be moved, e.g. because
+// |trash| is on another filesystem, is removed synchronously.
+int removeContentAsync(std::string_view dir, std::string_view trash);
+
+// Blocks until the background deleter has nothing left to do.
+void waitForBackgroundDeletion();
+
+} // namespace android::incfs::rmtree
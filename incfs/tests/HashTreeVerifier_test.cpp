@@ -0,0 +1,197 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "HashTreeVerifier.h"
+
+#include <gtest/gtest.h>
+#include <lz4.h>
+#include <openssl/sha.h>
+
+using namespace android::incfs;
+
+using Result = HashTreeVerifier::Result;
+
+class HashTreeVerifierTest : public ::testing::Test {
+protected:
+    // Two leaf hash blocks and a top one.
+    static constexpr auto kBlocks = kBlockSize / INCFS_MAX_HASH_SIZE + 1;
+    static constexpr auto kSize = Size(kBlocks - 1) * kBlockSize + 100;
+
+    virtual void SetUp() {
+        data_.resize(kSize);
+        for (size_t i = 0; i < data_.size(); ++i) {
+            data_[i] = char(i * 7 / 5);
+        }
+        // The tree is stored top level first: [top, leaf 0, leaf 1].
+        tree_.resize(3 * kBlockSize);
+        std::vector<char> block(kBlockSize);
+        for (int i = 0; i < kBlocks; ++i) {
+            std::fill(block.begin(), block.end(), 0);
+            std::copy_n(data_.data() + i * kBlockSize,
+                        std::min<Size>(kBlockSize, kSize - i * kBlockSize), block.begin());
+            sha256(block.data(), tree_.data() + kBlockSize + i * INCFS_MAX_HASH_SIZE);
+        }
+        sha256(tree_.data() + kBlockSize, tree_.data());
+        sha256(tree_.data() + 2 * kBlockSize, tree_.data() + INCFS_MAX_HASH_SIZE);
+        rootHash_.resize(INCFS_MAX_HASH_SIZE);
+        sha256(tree_.data(), rootHash_.data());
+    }
+
+    static void sha256(const char* block, char* out) {
+        SHA256((const uint8_t*)block, kBlockSize, (uint8_t*)out);
+    }
+
+    DataBlock hashBlock(int index) const {
+        return {.pageIndex = index,
+                .compression = INCFS_COMPRESSION_KIND_NONE,
+                .kind = INCFS_BLOCK_KIND_HASH,
+                .dataSize = kBlockSize,
+                .data = tree_.data() + index * kBlockSize};
+    }
+
+    DataBlock dataBlock(int index) const {
+        return {.pageIndex = index,
+                .compression = INCFS_COMPRESSION_KIND_NONE,
+                .kind = INCFS_BLOCK_KIND_DATA,
+                .dataSize = uint32_t(std::min<Size>(kBlockSize, kSize - index * kBlockSize)),
+                .data = data_.data() + index * kBlockSize};
+    }
+
+    std::vector<char> data_;
+    std::vector<char> tree_;
+    std::string rootHash_;
+};
+
+TEST_F(HashTreeVerifierTest, HashBlocksOutOfOrder) {
+    HashTreeVerifier verifier(kSize, rootHash_);
+    EXPECT_FALSE(verifier.hasHashFor(0));
+
+    // the leaf can't be checked until its parent arrives
+    DataBlock leaf[] = {hashBlock(2)};
+    EXPECT_EQ(0, verifier.addHashBlocks(leaf));
+    EXPECT_FALSE(verifier.hasHashFor(kBlocks - 1));
+
+    DataBlock top[] = {hashBlock(0)};
+    EXPECT_EQ(0, verifier.addHashBlocks(top));
+    EXPECT_TRUE(verifier.hasHashFor(kBlocks - 1));
+    EXPECT_FALSE(verifier.hasHashFor(0));
+}
+
+TEST_F(HashTreeVerifierTest, RejectsCorruptedHashBlocks) {
+    HashTreeVerifier verifier(kSize, rootHash_);
+    auto corrupted = tree_;
+    corrupted[kBlockSize + 10] ^= 1;
+    DataBlock blocks[] = {hashBlock(0), hashBlock(1), hashBlock(2)};
+    blocks[1].data = corrupted.data() + kBlockSize;
+
+    std::vector<BlockIndex> rejected;
+    EXPECT_EQ(-EBADMSG, verifier.addHashBlocks(blocks, &rejected));
+    ASSERT_EQ(size_t(1), rejected.size());
+    EXPECT_EQ(1, rejected[0]);
+    EXPECT_FALSE(verifier.hasHashFor(0));
+    EXPECT_TRUE(verifier.hasHashFor(kBlocks - 1));
+}
+
+TEST_F(HashTreeVerifierTest, RejectsMalformedHashBlocks) {
+    HashTreeVerifier verifier(kSize, rootHash_);
+    DataBlock blocks[] = {hashBlock(0), hashBlock(1), hashBlock(2)};
+    blocks[1].data = nullptr;
+
+    std::vector<BlockIndex> rejected;
+    EXPECT_EQ(-EINVAL, verifier.addHashBlocks(blocks, &rejected));
+    ASSERT_EQ(size_t(1), rejected.size());
+    EXPECT_EQ(1, rejected[0]);
+    EXPECT_FALSE(verifier.hasHashFor(kBlocks - 1));
+
+    blocks[1] = hashBlock(1);
+    blocks[2].dataSize = kBlockSize - 1;
+    EXPECT_EQ(-EINVAL, verifier.addHashBlocks(blocks));
+    EXPECT_FALSE(verifier.hasHashFor(kBlocks - 1));
+
+    blocks[2] = hashBlock(2);
+    EXPECT_EQ(0, verifier.addHashBlocks(blocks));
+    EXPECT_TRUE(verifier.hasHashFor(kBlocks - 1));
+}
+
+TEST_F(HashTreeVerifierTest, VerifyData) {
+    HashTreeVerifier verifier(kSize, rootHash_);
+    DataBlock hashes[] = {hashBlock(0), hashBlock(1), hashBlock(2)};
+    ASSERT_EQ(0, verifier.addHashBlocks(hashes));
+
+    std::vector<DataBlock> blocks;
+    for (int i = 0; i < kBlocks; ++i) {
+        blocks.push_back(dataBlock(i));
+    }
+    EXPECT_EQ(0, verifier.verifyAll(blocks));
+
+    auto corrupted = data_;
+    corrupted[5 * kBlockSize] ^= 1;
+    blocks[5].data = corrupted.data() + 5 * kBlockSize;
+    blocks[6].dataSize = 100;
+    const auto results = verifier.verify(blocks);
+    ASSERT_EQ(blocks.size(), results.size());
+    EXPECT_EQ(Result::Ok, results[0]);
+    EXPECT_EQ(Result::Corrupted, results[5]);
+    EXPECT_EQ(Result::Invalid, results[6]);
+    EXPECT_EQ(Result::Ok, results.back());
+    EXPECT_EQ(-EBADMSG, verifier.verifyAll(blocks));
+}
+
+TEST_F(HashTreeVerifierTest, VerifyCompressedData) {
+    HashTreeVerifier verifier(kSize, rootHash_);
+    DataBlock hashes[] = {hashBlock(0), hashBlock(1)};
+    ASSERT_EQ(0, verifier.addHashBlocks(hashes));
+
+    std::vector<char> compressed(LZ4_compressBound(kBlockSize));
+    auto block = dataBlock(3);
+    const auto size = LZ4_compress_default(block.data, compressed.data(), block.dataSize,
+                                           compressed.size());
+    ASSERT_GT(size, 0);
+    block.compression = INCFS_COMPRESSION_KIND_LZ4;
+    block.dataSize = size;
+    block.data = compressed.data();
+    EXPECT_EQ(0, verifier.verifyAll({&block, 1}));
+
+    // no leaf hash for the last block yet
+    auto last = dataBlock(kBlocks - 1);
+    EXPECT_EQ(Result::MissingHash, verifier.verify({&last, 1})[0]);
+}
+
+TEST_F(HashTreeVerifierTest, FromSignature) {
+    struct __attribute__((packed)) Signature {
+        uint32_t version = INCFS_SIGNATURE_VERSION;
+        uint32_t hashingSize = sizeof(hashing);
+        struct __attribute__((packed)) Hashing {
+            uint32_t algo = INCFS_HASH_TREE_SHA256;
+            uint8_t log2Blocksize = 12;
+            uint32_t saltSize = 0;
+            uint32_t rootHashSize = INCFS_MAX_HASH_SIZE;
+            char rootHash[INCFS_MAX_HASH_SIZE] = {};
+        } hashing;
+        uint32_t signingSize = 0;
+    } signature;
+    memcpy(signature.hashing.rootHash, rootHash_.data(), rootHash_.size());
+
+    auto verifier = HashTreeVerifier::fromSignature(kSize, {(const char*)&signature,
+                                                            sizeof(signature)});
+    ASSERT_TRUE(verifier);
+    DataBlock top[] = {hashBlock(0)};
+    EXPECT_EQ(0, verifier->addHashBlocks(top));
+
+    signature.hashing.algo = 0;
+    EXPECT_FALSE(HashTreeVerifier::fromSignature(kSize, {(const char*)&signature,
+                                                         sizeof(signature)}));
+}
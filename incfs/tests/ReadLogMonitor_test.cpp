@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ReadLogMonitor.h"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+using namespace android::incfs;
+
+namespace {
+
+// Records with consecutive serial numbers and timestamps, starting at the given ones.
+std::vector<IncFsReadInfo> records(uint32_t serial, uint64_t tsUs, int count) {
+    std::vector<IncFsReadInfo> result;
+    for (int i = 0; i < count; ++i) {
+        result.push_back({.bootClockTsUs = tsUs + i, .serialNo = uint32_t(serial + i)});
+    }
+    return result;
+}
+
+void feed(ReadLogMonitor& monitor, const std::vector<IncFsReadInfo>& reads) {
+    monitor.onRecords(reads.data(), reads.size());
+}
+
+} // namespace
+
+TEST(ReadLogMonitorTest, Sequential) {
+    ReadLogMonitor monitor;
+    // The first record can have any serial number.
+    feed(monitor, records(100, 1000, 3));
+    feed(monitor, records(103, 2000, 2));
+    const auto stats = monitor.stats();
+    EXPECT_EQ(5u, stats.records);
+    EXPECT_EQ(0u, stats.droppedRecords);
+    EXPECT_EQ(0u, stats.gaps);
+    EXPECT_EQ(0u, stats.discontinuities);
+}
+
+TEST(ReadLogMonitorTest, Gaps) {
+    ReadLogMonitor monitor;
+    feed(monitor, records(1, 1000, 2));
+    feed(monitor, records(10, 2000, 1));
+    feed(monitor, records(12, 3000, 1));
+    const auto stats = monitor.stats();
+    EXPECT_EQ(4u, stats.records);
+    EXPECT_EQ(7u + 1u, stats.droppedRecords);
+    EXPECT_EQ(2u, stats.gaps);
+    EXPECT_EQ(0u, stats.discontinuities);
+}
+
+TEST(ReadLogMonitorTest, SerialWrap) {
+    ReadLogMonitor monitor;
+    feed(monitor, records(UINT32_MAX - 1, 1000, 4));
+    auto stats = monitor.stats();
+    EXPECT_EQ(4u, stats.records);
+    EXPECT_EQ(0u, stats.gaps);
+    EXPECT_EQ(0u, stats.discontinuities);
+
+    // A gap across the wrap.
+    ReadLogMonitor gapMonitor;
+    feed(gapMonitor, records(UINT32_MAX, 3000, 1));
+    feed(gapMonitor, records(2, 4000, 1));
+    stats = gapMonitor.stats();
+    EXPECT_EQ(2u, stats.droppedRecords);
+    EXPECT_EQ(1u, stats.gaps);
+    EXPECT_EQ(0u, stats.discontinuities);
+}
+
+TEST(ReadLogMonitorTest, Discontinuities) {
+    ReadLogMonitor monitor;
+    feed(monitor, records(50, 1000, 2));
+    // Serial numbers going backwards or repeating, e.g. after a log reset.
+    feed(monitor, records(10, 2000, 1));
+    feed(monitor, records(10, 3000, 1));
+    // Timestamps going backwards with the right serial number.
+    feed(monitor, records(11, 500, 1));
+    const auto stats = monitor.stats();
+    EXPECT_EQ(5u, stats.records);
+    EXPECT_EQ(3u, stats.discontinuities);
+    EXPECT_EQ(0u, stats.gaps);
+    EXPECT_EQ(0u, stats.droppedRecords);
+}
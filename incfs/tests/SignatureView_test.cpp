@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "SignatureView.h"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+using namespace android::incfs;
+
+namespace {
+
+struct __attribute__((packed)) Signature {
+    uint32_t version = INCFS_SIGNATURE_VERSION;
+    uint32_t hashingSize = sizeof(hashing);
+    struct __attribute__((packed)) Hashing {
+        uint32_t algo = INCFS_HASH_TREE_SHA256;
+        uint8_t log2Blocksize = 12;
+        uint32_t saltSize = 0;
+        uint32_t rootHashSize = INCFS_MAX_HASH_SIZE;
+        char rootHash[INCFS_MAX_HASH_SIZE] = {};
+    } hashing;
+    uint32_t signingSize = 8;
+    char signing[8] = {'s', 'i', 'g', 'n', 'i', 'n', 'g', '!'};
+};
+
+Span<const char> span(const Signature& signature) {
+    return {(const char*)&signature, sizeof(signature)};
+}
+
+} // namespace
+
+TEST(SignatureViewTest, Parse) {
+    Signature signature;
+    for (int i = 0; i < INCFS_MAX_HASH_SIZE; ++i) {
+        signature.hashing.rootHash[i] = char(i);
+    }
+
+    ErrorCode error = 1;
+    const auto view = SignatureView::parse(span(signature), &error);
+    ASSERT_TRUE(view);
+    EXPECT_EQ(1, error);
+    EXPECT_EQ(INCFS_SIGNATURE_VERSION, view->version());
+    EXPECT_EQ(HashAlgorithm::sha256, view->hashAlgorithm());
+    EXPECT_EQ(12, view->log2BlockSize());
+    EXPECT_EQ(sizeof(signature.hashing), view->hashingInfo().size());
+    EXPECT_TRUE(view->salt().empty());
+    EXPECT_EQ(std::string_view(signature.hashing.rootHash, INCFS_MAX_HASH_SIZE),
+              view->rootHash());
+    EXPECT_EQ("signing!", view->signingInfo());
+    // no copies, everything points into the original buffer
+    EXPECT_EQ(signature.hashing.rootHash, view->rootHash().data());
+    EXPECT_EQ((const char*)&signature, view->raw().data());
+    EXPECT_EQ(sizeof(signature), view->raw().size());
+}
+
+TEST(SignatureViewTest, Invalid) {
+    ErrorCode error = 0;
+    Signature signature;
+    EXPECT_FALSE(SignatureView::parse({(const char*)&signature, 20}, &error));
+    EXPECT_EQ(-ERANGE, error);
+
+    std::vector<char> huge(INCFS_MAX_SIGNATURE_SIZE + 1);
+    memcpy(huge.data(), &signature, sizeof(signature));
+    EXPECT_FALSE(SignatureView::parse(huge, &error));
+    EXPECT_EQ(-ERANGE, error);
+
+    signature.version = INCFS_SIGNATURE_VERSION + 1;
+    EXPECT_FALSE(SignatureView::parse(span(signature), &error));
+    EXPECT_EQ(-EINVAL, error);
+
+    signature = {};
+    signature.hashing.log2Blocksize = 13;
+    EXPECT_FALSE(SignatureView::parse(span(signature), &error));
+    EXPECT_EQ(-EINVAL, error);
+
+    signature = {};
+    signature.hashing.saltSize = 1;
+    EXPECT_FALSE(SignatureView::parse(span(signature), &error));
+    EXPECT_EQ(-EINVAL, error);
+
+    signature = {};
+    signature.signingSize = 7;
+    EXPECT_FALSE(SignatureView::parse(span(signature), &error));
+    EXPECT_EQ(-EINVAL, error);
+
+    signature = {};
+    signature.hashingSize = sizeof(signature);
+    EXPECT_FALSE(SignatureView::parse(span(signature), &error));
+    EXPECT_EQ(-EINVAL, error);
+}
@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "hashtree.h"
+
+#include <gtest/gtest.h>
+
+using namespace android::incfs;
+using namespace android::incfs::hashtree;
+
+static constexpr BlockRange range(BlockIndex begin, BlockIndex end) {
+    return BlockRange{{begin, end}};
+}
+
+namespace android::incfs {
+
+static bool operator==(const BlockRange& l, const BlockRange& r) {
+    return l.begin == r.begin && l.end == r.end;
+}
+
+static std::ostream& operator<<(std::ostream& os, const BlockRange& r) {
+    return os << '[' << r.begin << ", " << r.end << ')';
+}
+
+} // namespace android::incfs
+
+// 1 data block is checked against the root hash directly.
+static_assert(geometry(kBlockSize).depth == 0);
+static_assert(geometry(kBlockSize).totalBlocks == 0);
+// 129 data blocks need 2 leaf hash blocks and the top one, stored first.
+static_assert(geometry(129 * kBlockSize).depth == 2);
+static_assert(geometry(129 * kBlockSize).totalBlocks == 3);
+static_assert(geometry(129 * kBlockSize).levelOffset[0] == 1);
+static_assert(geometry(129 * kBlockSize).levelOffset[1] == 0);
+static_assert(geometry(129 * kBlockSize, HashAlgorithm::none).depth == 0);
+static_assert(levelOf(geometry(129 * kBlockSize), 0) == 1);
+static_assert(levelOf(geometry(129 * kBlockSize), 2) == 0);
+static_assert(levelOf(geometry(129 * kBlockSize), 3) == -1);
+static_assert(coveringRanges(geometry(129 * kBlockSize), range(128, 129)).count == 2);
+
+TEST(HashTreeTest, Geometry) {
+    // 1GiB needs 2048 leaf blocks, 16 blocks above them and the top one
+    const auto g = geometry(Size(1) << 30);
+    ASSERT_EQ(3, g.depth);
+    EXPECT_EQ(2048, g.levelBlocks[0]);
+    EXPECT_EQ(16, g.levelBlocks[1]);
+    EXPECT_EQ(1, g.levelBlocks[2]);
+    EXPECT_EQ(0, g.levelOffset[2]);
+    EXPECT_EQ(1, g.levelOffset[1]);
+    EXPECT_EQ(17, g.levelOffset[0]);
+    EXPECT_EQ(2065 * kBlockSize, size(g));
+}
+
+TEST(HashTreeTest, CoveringRanges) {
+    const auto g = geometry(Size(1) << 30);
+    const auto covering = coveringRanges(g, range(127, 129));
+    ASSERT_EQ(3, covering.count);
+    EXPECT_EQ(range(0, 1), covering.ranges[0]);
+    EXPECT_EQ(range(1, 2), covering.ranges[1]);
+    EXPECT_EQ(range(17, 19), covering.ranges[2]);
+
+    EXPECT_TRUE(coveringRanges(g, range(5, 5)).empty());
+}
+
+TEST(HashTreeTest, CoveringHashBlocks) {
+    const auto g = geometry(Size(1) << 30);
+    const BlockRange data[] = {range(129, 130), range(0, 1), range(128 * 128, 128 * 128 + 1)};
+    const auto blocks = coveringHashBlocks(g, data);
+    ASSERT_EQ(size_t(3), blocks.size());
+    EXPECT_EQ(range(0, 3), blocks[0]);
+    EXPECT_EQ(range(17, 19), blocks[1]);
+    EXPECT_EQ(range(17 + 128, 17 + 129), blocks[2]);
+}
+
+TEST(HashTreeTest, MissingHashBlocks) {
+    const auto g = geometry(Size(1) << 30);
+    const BlockRange data[] = {range(0, 3 * 128)};
+    // needs [0, 2) on the upper levels and [17, 20) for the leaves
+    const BlockRange filled[] = {range(0, 1), range(18, 19), range(100, 200)};
+    const auto missing = missingHashBlocks(g, data, filled);
+    ASSERT_EQ(size_t(3), missing.size());
+    EXPECT_EQ(range(1, 2), missing[0]);
+    EXPECT_EQ(range(17, 18), missing[1]);
+    EXPECT_EQ(range(19, 20), missing[2]);
+
+    const BlockRange all[] = {range(0, 2065)};
+    EXPECT_TRUE(missingHashBlocks(g, data, all).empty());
+    EXPECT_EQ(coveringHashBlocks(g, data), missingHashBlocks(g, data, {nullptr, 0}));
+}
@@ -24,10 +24,13 @@
 #include <sys/select.h>
 #include <unistd.h>
 
+#include <memory>
 #include <optional>
 #include <thread>
 
+#include "MountWalker.h"
 #include "path.h"
+#include "rmtree.h"
 
 using namespace android::incfs;
 using namespace std::literals;
@@ -196,6 +199,23 @@ protected:
     Control control_;
 };
 
+TEST(IncFsFileIdTest, FromMetadataBatch) {
+    std::vector<std::string> metadata = {"", "short", std::string(100, 'x')};
+    for (int i = 0; i < 5000; ++i) {
+        metadata.push_back("some/long/path/in/the/package/" + std::to_string(i));
+    }
+    std::vector<IncFsSpan> spans;
+    for (auto&& md : metadata) {
+        spans.push_back({md.data(), IncFsSize(md.size())});
+    }
+    std::vector<IncFsFileId> ids(spans.size());
+    ASSERT_EQ(0, IncFs_FileIdsFromMetadata(spans.data(), spans.size(), ids.data()));
+    for (size_t i = 0; i < spans.size(); ++i) {
+        ASSERT_EQ(IncFs_FileIdFromMetadata(spans[i]), ids[i]) << i;
+    }
+    EXPECT_EQ(-EINVAL, IncFs_FileIdsFromMetadata(nullptr, 1, ids.data()));
+}
+
 TEST_F(IncFsTest, GetIncfsFeatures) {
     ASSERT_NE(features(), none);
 }
@@ -217,6 +237,29 @@ TEST_F(IncFsTest, TrueIncfsPathForBindMount) {
     ASSERT_TRUE(isIncFsPath(tmp_dir_to_bind.path));
 }
 
+TEST_F(IncFsTest, AreIncFsPaths) {
+    TemporaryDir test_dir;
+    const auto dir = mountPath(test_dir_name_);
+    ASSERT_EQ(0, makeDir(control_, dir));
+    const char* const paths[] = {mount_dir_path_.c_str(), test_dir.path, dir.c_str(), nullptr};
+    bool results[std::size(paths)];
+    // The second round comes from the cache.
+    for (int i = 0; i < 2; ++i) {
+        ASSERT_EQ(2, IncFs_AreIncFsPaths(paths, std::size(paths), results));
+        EXPECT_TRUE(results[0]);
+        EXPECT_FALSE(results[1]);
+        EXPECT_TRUE(results[2]);
+        EXPECT_FALSE(results[3]);
+    }
+
+    // Mounts appearing later are picked up too.
+    TemporaryDir tmp_dir_to_bind;
+    ASSERT_FALSE(isIncFsPath(tmp_dir_to_bind.path));
+    ASSERT_EQ(0, bindMount(dir, tmp_dir_to_bind.path));
+    ScopedUnmount su(tmp_dir_to_bind.path);
+    ASSERT_TRUE(isIncFsPath(tmp_dir_to_bind.path));
+}
+
 TEST_F(IncFsTest, Control) {
     ASSERT_TRUE(control_);
     EXPECT_GE(IncFs_GetControlFd(control_, CMD), 0);
@@ -297,6 +340,85 @@ TEST_F(IncFsTest, BindMount) {
     }
 }
 
+TEST_F(IncFsTest, BindMountAll) {
+    constexpr int kBinds = 8;
+    std::vector<std::unique_ptr<TemporaryDir>> targets;
+    std::vector<std::string> sources;
+    std::vector<std::string_view> sourcePaths, targetPaths;
+    for (int i = 0; i < kBinds; ++i) {
+        sources.push_back(mountPath(std::string(test_dir_name_) + std::to_string(i)));
+        ASSERT_EQ(0, makeDir(control_, sources.back()));
+        targets.push_back(std::make_unique<TemporaryDir>());
+    }
+    for (int i = 0; i < kBinds; ++i) {
+        sourcePaths.push_back(sources[i]);
+        targetPaths.push_back(targets[i]->path);
+    }
+    // the root can't be bound, the rest still should be
+    sourcePaths.back() = mount_dir_path_;
+
+    const auto binds = bindMountAll(sourcePaths, targetPaths, 3);
+    ASSERT_EQ(size_t(kBinds), binds.size());
+    for (int i = 0; i < kBinds - 1; ++i) {
+        EXPECT_EQ(0, binds[i]) << i;
+        EXPECT_TRUE(isIncFsPath(targetPaths[i])) << i;
+    }
+    EXPECT_EQ(-EINVAL, binds.back());
+    EXPECT_FALSE(isIncFsPath(targetPaths.back()));
+
+    const auto unmounts = unmountAll(targetPaths, 3);
+    ASSERT_EQ(size_t(kBinds), unmounts.size());
+    for (int i = 0; i < kBinds - 1; ++i) {
+        EXPECT_EQ(0, unmounts[i]) << i;
+        EXPECT_FALSE(isIncFsPath(targetPaths[i])) << i;
+    }
+    // not a mount point
+    EXPECT_EQ(-EINVAL, unmounts.back());
+}
+
+TEST_F(IncFsTest, TruncateOnMount) {
+    const TemporaryDir trash;
+    const int asyncFlags = INCFS_MOUNT_TRUNCATE | INCFS_MOUNT_TRUNCATE_ASYNC;
+    for (int flags : {int(INCFS_MOUNT_TRUNCATE), asyncFlags}) {
+        ASSERT_EQ(0, makeDirs(control_, mountPath(test_dir_name_, "a")));
+        ASSERT_EQ(0,
+                  makeFile(control_, mountPath(test_dir_name_, "a", test_file_name_), 0555,
+                           fileId(1), {.size = test_file_size_}));
+        control_ = {};
+        ASSERT_EQ(0, unmount(mount_dir_path_));
+        control_ = mount(image_dir_path_, mount_dir_path_,
+                         MountOptions{.flags = IncFsMountFlags(flags), .trashDir = trash.path});
+        ASSERT_GE(control_.cmd(), 0);
+        EXPECT_FALSE(exists(mountPath(test_dir_name_)));
+    }
+    // Nothing is left behind, and nothing gets deleted after the test is done.
+    rmtree::waitForBackgroundDeletion();
+    EXPECT_EQ(0, path::isEmptyDir(trash.path));
+}
+
+TEST_F(IncFsTest, MountFastSetup) {
+    control_ = {};
+    ASSERT_EQ(0, unmount(mount_dir_path_));
+    MountTimings timings = {.totalUs = -1};
+    control_ = mount(image_dir_path_, mount_dir_path_,
+                     MountOptions{.flags = IncFsMountFlags(INCFS_MOUNT_FAST_SETUP)}, &timings);
+    ASSERT_GE(control_.cmd(), 0) << "Error: " << errno;
+    ASSERT_GE(control_.logs(), 0);
+    ASSERT_EQ(mount_dir_path_, root(control_));
+    checkRestoreconResult(mountPath(INCFS_PENDING_READS_FILENAME));
+    checkRestoreconResult(mountPath(INCFS_LOG_FILENAME));
+    EXPECT_GT(timings.mountUs, 0);
+    EXPECT_GE(timings.totalUs, timings.mountUs + timings.validateUs);
+
+    // still refuses to mount over IncFS
+    const TemporaryDir backing;
+    EXPECT_LT(mount(backing.path, mount_dir_path_,
+                    MountOptions{.flags = IncFsMountFlags(INCFS_MOUNT_FAST_SETUP)}, nullptr)
+                      .cmd(),
+              0);
+    EXPECT_EQ(EINVAL, errno);
+}
+
 TEST_F(IncFsTest, Root) {
     ASSERT_EQ(mount_dir_path_, root(control_)) << "Error: " << errno;
 }
@@ -357,6 +479,83 @@ TEST_F(IncFsTest, GetFileId) {
     EXPECT_EQ(kIncFsInvalidFileId, getFileId({}, mountPath(test_file_name_)));
 }
 
+TEST_F(IncFsTest, GetFileIds) {
+    ASSERT_EQ(0, makeDir(control_, mountPath(test_dir_name_)));
+    const auto first = mountPath(test_file_name_);
+    const auto second = mountPath(test_dir_name_, test_file_name_);
+    ASSERT_EQ(0, makeFile(control_, first, 0555, fileId(1), {.size = test_file_size_}));
+    ASSERT_EQ(0, makeFile(control_, second, 0555, fileId(2), {.size = test_file_size_}));
+    const auto missing = mountPath("asdf");
+    const char* const paths[] = {first.c_str(), missing.c_str(), second.c_str(), nullptr};
+    IncFsFileId ids[std::size(paths)];
+    ASSERT_EQ(2, IncFs_GetIds(control_, paths, std::size(paths), ids));
+    EXPECT_EQ(fileId(1), ids[0]);
+    EXPECT_EQ(kIncFsInvalidFileId, ids[1]);
+    EXPECT_EQ(fileId(2), ids[2]);
+    EXPECT_EQ(kIncFsInvalidFileId, ids[3]);
+
+    const std::string_view pathViews[] = {first, missing, second};
+    EXPECT_EQ(fileId(2), getFileIds(control_, pathViews)[2]);
+    EXPECT_EQ(-EINVAL, IncFs_GetIds(nullptr, paths, std::size(paths), ids));
+}
+
+TEST_F(IncFsTest, GetMetadataReusingBuffers) {
+    ASSERT_EQ(0,
+              makeFile(control_, mountPath(test_file_name_), 0555, fileId(1),
+                       {.size = test_file_size_, .metadata = metadata("first")}));
+    ASSERT_EQ(0, makeDir(control_, mountPath(test_dir_name_)));
+    ASSERT_EQ(0,
+              makeFile(control_, mountPath(test_dir_name_, test_file_name_), 0555, fileId(2),
+                       {.size = test_file_size_, .metadata = metadata("second one")}));
+
+    RawMetadata buffer;
+    ASSERT_EQ(0, getMetadata(control_, fileId(1), &buffer));
+    EXPECT_EQ("first", std::string_view(buffer.data(), buffer.size()));
+    const auto data = buffer.data();
+    ASSERT_EQ(0, getMetadata(control_, mountPath(test_dir_name_, test_file_name_), &buffer));
+    EXPECT_EQ("second one", std::string_view(buffer.data(), buffer.size()));
+    EXPECT_EQ(data, buffer.data());
+    EXPECT_GT(0, getMetadata(control_, fileId(3), &buffer));
+    EXPECT_TRUE(buffer.empty());
+
+    const FileId ids[] = {fileId(2), fileId(3), fileId(1)};
+    FileAttrBatch batch;
+    ASSERT_EQ(1, getMetadata(control_, ids, &batch));
+    ASSERT_EQ(3u, batch.size());
+    EXPECT_EQ("second one", std::string_view(batch[0].data(), batch[0].size()));
+    EXPECT_EQ(0, batch.error(0));
+    EXPECT_EQ(0u, batch[1].size());
+    EXPECT_GT(0, batch.error(1));
+    EXPECT_EQ("first", std::string_view(batch[2].data(), batch[2].size()));
+}
+
+TEST_F(IncFsTest, WalkMount) {
+    ASSERT_EQ(0, makeDirs(control_, mountPath(test_dir_name_, "a", "b")));
+    ASSERT_EQ(0,
+              makeFile(control_, mountPath(test_file_name_), 0555, fileId(1),
+                       {.size = test_file_size_, .metadata = metadata("md")}));
+    ASSERT_EQ(0, makeFile(control_, mountPath(test_dir_name_, "a", "b", test_file_name_), 0555,
+                          fileId(2), {.size = 0}));
+
+    MountInventory inventory;
+    ASSERT_EQ(0, walkMount(control_, &inventory, {.loadingState = true}));
+    ASSERT_EQ(size_t(2), inventory.size());
+    ASSERT_EQ(size_t(2), inventory.loadingStates.size());
+    for (size_t i = 0; i < inventory.size(); ++i) {
+        if (inventory.ids[i] == fileId(1)) {
+            EXPECT_EQ(test_file_name_, inventory.path(i));
+            EXPECT_EQ(test_file_size_, inventory.sizes[i]);
+            EXPECT_EQ(2u, inventory.metadataSizes[i]);
+            EXPECT_EQ(LoadingState::MissingBlocks, inventory.loadingStates[i]);
+        } else {
+            EXPECT_EQ(fileId(2), inventory.ids[i]);
+            EXPECT_EQ(path::join(test_dir_name_, "a", "b", test_file_name_), inventory.path(i));
+            EXPECT_EQ(0, inventory.sizes[i]);
+            EXPECT_EQ(LoadingState::Full, inventory.loadingStates[i]);
+        }
+    }
+}
+
 TEST_F(IncFsTest, GetMetaData) {
     const std::string_view md = "abc"sv;
     ASSERT_EQ(0,
@@ -376,6 +575,74 @@ TEST_F(IncFsTest, GetMetaData) {
     }
 }
 
+TEST_F(IncFsTest, GetMetadataAfterRecreate) {
+    ASSERT_EQ(0,
+              makeFile(control_, mountPath(test_file_name_), 0555, fileId(1),
+                       {.size = 0, .metadata = metadata("old")}));
+    auto raw_metadata = getMetadata(control_, fileId(1));
+    ASSERT_EQ("old", std::string(raw_metadata.begin(), raw_metadata.end()));
+
+    // The id is free again once all links to the file are gone.
+    ASSERT_EQ(0, unlink(control_, mountPath(test_file_name_)));
+    ASSERT_EQ(0, unlink(control_, mountPath(kIndexDir, toString(fileId(1)))));
+    ASSERT_EQ(0,
+              makeFile(control_, mountPath(test_file_name_), 0555, fileId(1),
+                       {.size = 0, .metadata = metadata("new one")}));
+    raw_metadata = getMetadata(control_, fileId(1));
+    EXPECT_EQ("new one", std::string(raw_metadata.begin(), raw_metadata.end()));
+    raw_metadata = getMetadata(control_, mountPath(test_file_name_));
+    EXPECT_EQ("new one", std::string(raw_metadata.begin(), raw_metadata.end()));
+}
+
+TEST_F(IncFsTest, GetSignatureAfterRecreate) {
+    struct __attribute__((packed)) Signature {
+        uint32_t version = INCFS_SIGNATURE_VERSION;
+        uint32_t hashingSize = sizeof(hashing);
+        struct __attribute__((packed)) Hashing {
+            uint32_t algo = INCFS_HASH_TREE_SHA256;
+            uint8_t log2Blocksize = 12;
+            uint32_t saltSize = 0;
+            uint32_t rootHashSize = INCFS_MAX_HASH_SIZE;
+            char rootHash[INCFS_MAX_HASH_SIZE] = {};
+        } hashing;
+        uint32_t signingSize = 0;
+    } signature;
+    const auto recreate = [&] {
+        return makeFile(control_, mountPath(test_file_name_), 0555, fileId(1),
+                        {.size = test_file_size_,
+                         .signature = {.data = (char*)&signature, .size = sizeof(signature)}});
+    };
+    const auto remove = [&] {
+        ASSERT_EQ(0, unlink(control_, mountPath(test_file_name_)));
+        ASSERT_EQ(0, unlink(control_, mountPath(kIndexDir, toString(fileId(1)))));
+        // Not every kernel has it, and it's gone for the complete files anyway.
+        unlink(control_, mountPath(".incomplete", toString(fileId(1))));
+    };
+
+    signature.hashing.rootHash[0] = 'a';
+    ASSERT_EQ(0, recreate());
+    auto raw_signature = getSignature(control_, fileId(1));
+    ASSERT_EQ(sizeof(signature), raw_signature.size());
+    EXPECT_EQ('a', raw_signature[offsetof(Signature, hashing.rootHash)]);
+    // A cached signature keeps the ioctl's contract for too small buffers.
+    char small[sizeof(signature) - 1];
+    size_t smallSize = sizeof(small);
+    EXPECT_EQ(-E2BIG, IncFs_GetSignatureById(control_, fileId(1), small, &smallSize));
+    EXPECT_EQ(size_t(INCFS_MAX_SIGNATURE_SIZE), smallSize);
+
+    remove();
+    signature.hashing.rootHash[0] = 'b';
+    ASSERT_EQ(0, recreate());
+    raw_signature = getSignature(control_, fileId(1));
+    ASSERT_EQ(sizeof(signature), raw_signature.size());
+    EXPECT_EQ('b', raw_signature[offsetof(Signature, hashing.rootHash)]);
+
+    // And an unsigned file with the same id has no signature at all.
+    remove();
+    ASSERT_EQ(0, makeFile(control_, mountPath(test_file_name_), 0555, fileId(1), {.size = 0}));
+    EXPECT_TRUE(getSignature(control_, fileId(1)).empty());
+}
+
 TEST_F(IncFsTest, LinkAndUnlink) {
     ASSERT_EQ(0, makeFile(control_, mountPath(test_file_name_), 0555, fileId(1), {.size = 0}));
     ASSERT_EQ(0, makeDir(control_, mountPath(test_dir_name_)));
@@ -388,6 +655,38 @@ TEST_F(IncFsTest, LinkAndUnlink) {
     ASSERT_FALSE(exists(linked_file_path));
 }
 
+TEST_F(IncFsTest, BatchLayout) {
+    const auto nested = mountPath(test_dir_name_, "a", "b");
+    const auto sibling = mountPath(test_dir_name_, "a", "c");
+    const std::string_view dirs[] = {nested, sibling, nested, "/"};
+    auto results = makeDirsAll(control_, dirs);
+    ASSERT_EQ(std::size(dirs), results.size());
+    EXPECT_EQ(0, results[0]);
+    EXPECT_EQ(0, results[1]);
+    EXPECT_EQ(0, results[2]);
+    EXPECT_NE(0, results[3]);
+    EXPECT_TRUE(exists(nested));
+    EXPECT_TRUE(exists(sibling));
+
+    ASSERT_EQ(0, makeFile(control_, mountPath(test_file_name_), 0555, fileId(1), {.size = 0}));
+    const auto link1 = path::join(nested, "1");
+    const auto link2 = path::join(sibling, "2");
+    const auto file = mountPath(test_file_name_);
+    const std::string_view sources[] = {file, file};
+    const std::string_view targets[] = {link1, link2};
+    EXPECT_EQ(std::vector<ErrorCode>(2, 0), linkAll(control_, sources, targets));
+    EXPECT_TRUE(exists(link1));
+    EXPECT_TRUE(exists(link2));
+
+    // removing a directory has to forget it, so it's created again next time
+    const std::string_view removed[] = {link1, nested, link2};
+    EXPECT_EQ(std::vector<ErrorCode>(3, 0), unlinkAll(control_, removed));
+    EXPECT_FALSE(exists(nested));
+    EXPECT_FALSE(exists(link2));
+    EXPECT_EQ(0, makeDirs(control_, nested));
+    EXPECT_TRUE(exists(nested));
+}
+
 TEST_F(IncFsTest, WriteBlocksAndPageRead) {
     const auto id = fileId(1);
     ASSERT_TRUE(control_.logs() >= 0);
@@ -421,6 +720,11 @@ TEST_F(IncFsTest, WriteBlocksAndPageRead) {
     char buf[INCFS_DATA_FILE_BLOCK_SIZE];
     ASSERT_TRUE(android::base::ReadFully(readFd, buf, sizeof(buf)));
     wait_page_read_thread.join();
+
+    const auto stats = readLogStats(control_);
+    EXPECT_GT(stats.records, 0u);
+    EXPECT_EQ(0u, stats.droppedRecords);
+    EXPECT_EQ(0u, stats.gaps);
 }
 
 TEST_F(IncFsTest, WaitForPendingReads) {
@@ -784,3 +1088,141 @@ TEST_F(IncFsTest, GetFilledRangesCpp) {
     }
     EXPECT_EQ(LoadingState::Full, isFullyLoaded(fd.get()));
 }
+
+TEST_F(IncFsTest, WriteRange) {
+    const auto size = 3 * INCFS_DATA_FILE_BLOCK_SIZE + 100;
+    ASSERT_EQ(0, makeFile(control_, mountPath(test_file_name_), 0555, fileId(1), {.size = size}));
+    auto fd = openForSpecialOps(control_, fileId(1));
+    ASSERT_GE(fd.get(), 0);
+
+    std::vector<char> data(size);
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = char(i / 1000);
+    }
+    EXPECT_EQ(-EINVAL, writeRange(fd.get(), 1, {data.data(), INCFS_DATA_FILE_BLOCK_SIZE}));
+    EXPECT_EQ(-EINVAL, writeRange(fd.get(), 0, {data.data(), 100}));
+    EXPECT_EQ(-EINVAL, writeRange(fd.get(), INCFS_DATA_FILE_BLOCK_SIZE, data));
+    EXPECT_EQ(LoadingState::MissingBlocks, isFullyLoaded(fd.get()));
+
+    EXPECT_EQ(size, writeRange(fd.get(), 0, data, {.compression = INCFS_COMPRESSION_KIND_LZ4}));
+    EXPECT_EQ(LoadingState::Full, isFullyLoaded(fd.get()));
+
+    std::string contents;
+    ASSERT_TRUE(android::base::ReadFileToString(mountPath(test_file_name_), &contents));
+    EXPECT_EQ(std::string(data.data(), data.size()), contents);
+}
+
+TEST_F(IncFsTest, WriteRangeWithHashTree) {
+    auto size = makeFileWithHash(1);
+    ASSERT_GT(size, 0);
+    auto fd = openForSpecialOps(control_, fileId(1));
+    ASSERT_GE(fd.get(), 0);
+
+    const auto lastPage = sizeToPages(size) - 1;
+    std::vector<char> data(INCFS_DATA_FILE_BLOCK_SIZE);
+    std::vector<char> hashTree(3 * INCFS_DATA_FILE_BLOCK_SIZE);
+    EXPECT_EQ(-EINVAL, writeRange(fd.get(), lastPage * INCFS_DATA_FILE_BLOCK_SIZE, data,
+                                  {.hashTree = {hashTree.data(), INCFS_DATA_FILE_BLOCK_SIZE}}));
+    EXPECT_EQ(INCFS_DATA_FILE_BLOCK_SIZE,
+              writeRange(fd.get(), lastPage * INCFS_DATA_FILE_BLOCK_SIZE, data,
+                         {.hashTree = {hashTree.data(), IncFsSize(hashTree.size())}}));
+
+    auto [res, ranges] = getFilledRanges(fd.get());
+    ASSERT_EQ(0, res);
+    ASSERT_EQ(size_t(1), ranges.dataRanges().size());
+    EXPECT_EQ(lastPage, ranges.dataRanges()[0].begin);
+    EXPECT_EQ(size_t(1), ranges.dataRanges()[0].size());
+    // the top level hash block and the second leaf one, covering the last data page
+    ASSERT_EQ(size_t(2), ranges.hashRanges().size());
+    EXPECT_EQ(0, ranges.hashRanges()[0].begin);
+    EXPECT_EQ(size_t(1), ranges.hashRanges()[0].size());
+    EXPECT_EQ(2, ranges.hashRanges()[1].begin);
+    EXPECT_EQ(size_t(1), ranges.hashRanges()[1].size());
+}
+
+TEST_F(IncFsTest, WriteRangeFromFd) {
+    const auto size = 2 * INCFS_DATA_FILE_BLOCK_SIZE + 1;
+    ASSERT_EQ(0, makeFile(control_, mountPath(test_file_name_), 0555, fileId(1), {.size = size}));
+    auto fd = openForSpecialOps(control_, fileId(1));
+    ASSERT_GE(fd.get(), 0);
+
+    // put the data at an unaligned offset in the source file to exercise the mapping code
+    const auto srcOffset = 100;
+    std::string data(size, 'a');
+    data[INCFS_DATA_FILE_BLOCK_SIZE] = 'b';
+    data.back() = 'c';
+    TemporaryFile src;
+    ASSERT_TRUE(android::base::WriteStringToFd(std::string(srcOffset, 'x') + data, src.fd));
+
+    EXPECT_EQ(-EINVAL, writeRangeFromFd(fd.get(), 0, src.fd, srcOffset + 1, size));
+    EXPECT_EQ(size, writeRangeFromFd(fd.get(), 0, src.fd, srcOffset, size));
+    EXPECT_EQ(LoadingState::Full, isFullyLoaded(fd.get()));
+
+    std::string contents;
+    ASSERT_TRUE(android::base::ReadFileToString(mountPath(test_file_name_), &contents));
+    EXPECT_EQ(data, contents);
+}
+
+TEST_F(IncFsTest, MakeFilledFiles) {
+    ASSERT_EQ(0, makeDir(control_, mountPath("dir")));
+    const std::string small = "small file";
+    const std::string bigger(INCFS_DATA_FILE_BLOCK_SIZE * 2 + 1, 'z');
+    const auto absolutePath = mountPath("dir", test_file_name_);
+    NewFilledFile files[] = {
+            {.path = "small",
+             .mode = 0555,
+             .id = fileId(1),
+             .params = {.size = IncFsSize(small.size())},
+             .data = {small.data(), IncFsSize(small.size())}},
+            {.path = absolutePath.c_str(),
+             .mode = 0444,
+             .id = fileId(2),
+             .params = {.size = IncFsSize(bigger.size())},
+             .data = {bigger.data(), IncFsSize(bigger.size())}},
+            // data size doesn't match the file size
+            {.path = "bad",
+             .mode = 0555,
+             .id = fileId(3),
+             .params = {.size = 100},
+             .data = {bigger.data(), 10}},
+    };
+    // The bad one doesn't stop the others, and gets its own error.
+    EXPECT_EQ((std::vector<ErrorCode>{0, 0, -EINVAL}), makeFilledFiles(control_, files));
+
+    std::string contents;
+    ASSERT_TRUE(android::base::ReadFileToString(mountPath("small"), &contents));
+    EXPECT_EQ(small, contents);
+    ASSERT_TRUE(android::base::ReadFileToString(absolutePath, &contents));
+    EXPECT_EQ(bigger, contents);
+    struct stat st;
+    ASSERT_EQ(0, stat(absolutePath.c_str(), &st));
+    EXPECT_EQ(0444, int(st.st_mode & 0777));
+    EXPECT_FALSE(exists(mountPath("bad")));
+
+    // Already there.
+    EXPECT_EQ(std::vector<ErrorCode>{-EEXIST}, makeFilledFiles(control_, {&files[0], 1}));
+}
+
+TEST_F(IncFsTest, MakeFilledFilesRemovesUnfilled) {
+    const std::string data(INCFS_DATA_FILE_BLOCK_SIZE * 2 + 1, 'z');
+    // IncFS refuses hash blocks for a file without a signature, after it got created.
+    const std::string tree(INCFS_DATA_FILE_BLOCK_SIZE, 'h');
+    NewFilledFile file = {
+            .path = "unfilled",
+            .mode = 0555,
+            .id = fileId(1),
+            .params = {.size = IncFsSize(data.size())},
+            .data = {data.data(), IncFsSize(data.size())},
+            .hashTree = {tree.data(), IncFsSize(tree.size())},
+    };
+    EXPECT_LT(makeFilledFiles(control_, {&file, 1})[0], 0);
+    EXPECT_FALSE(exists(mountPath("unfilled")));
+    EXPECT_FALSE(exists(mountPath(kIndexDir, toString(fileId(1)))));
+
+    // The id is free again.
+    file.hashTree = {};
+    ASSERT_EQ(std::vector<ErrorCode>{0}, makeFilledFiles(control_, {&file, 1}));
+    std::string contents;
+    ASSERT_TRUE(android::base::ReadFileToString(mountPath("unfilled"), &contents));
+    EXPECT_EQ(data, contents);
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+
+namespace android::dataloader {
+
+// A queue that blocks the producers when it's full. It gets closed once all of its producers
+// are done, and the consumers drain what's left.
+template <class T>
+class BoundedQueue {
+public:
+    BoundedQueue(int capacity, int producers)
+          : mCapacity(std::max(1, capacity)), mProducers(producers) {}
+
+    bool push(T&& item) {
+        std::unique_lock lock(mLock);
+        mNotFull.wait(lock, [&] { return mClosed || int(mItems.size()) < mCapacity; });
+        if (mClosed) {
+            return false;
+        }
+        mItems.push_back(std::move(item));
+        mNotEmpty.notify_one();
+        return true;
+    }
+
+    std::optional<T> pop() {
+        std::unique_lock lock(mLock);
+        mNotEmpty.wait(lock, [&] { return mClosed || !mItems.empty(); });
+        if (mItems.empty()) {
+            return {};
+        }
+        auto item = std::move(mItems.front());
+        mItems.pop_front();
+        mNotFull.notify_one();
+        return item;
+    }
+
+    void producerDone() {
+        std::lock_guard lock(mLock);
+        if (--mProducers == 0) {
+            closeLocked();
+        }
+    }
+
+    // Drops everything and wakes up all waiters.
+    void cancel() {
+        std::lock_guard lock(mLock);
+        mItems.clear();
+        closeLocked();
+    }
+
+private:
+    void closeLocked() {
+        mClosed = true;
+        mNotFull.notify_all();
+        mNotEmpty.notify_all();
+    }
+
+    const int mCapacity;
+    int mProducers;
+    bool mClosed = false;
+    std::deque<T> mItems;
+    std::mutex mLock;
+    std::condition_variable mNotFull;
+    std::condition_variable mNotEmpty;
+};
+
+} // namespace android::dataloader
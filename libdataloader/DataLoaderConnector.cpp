@@ -21,11 +21,17 @@
 #include <sys/stat.h>
 #include <utils/Looper.h>
 
+#include <deque>
 #include <thread>
 #include <unordered_map>
 
+#include "BoundedQueue.h"
 #include "JNIHelpers.h"
+#include "HashTreePrefill.h"
 #include "ManagedDataLoader.h"
+#include "ReadDeadlines.h"
+#include "ReadLogBatching.h"
+#include "WriteCoalescer.h"
 #include "dataloader.h"
 #include "incfs.h"
 
@@ -36,8 +42,14 @@ using namespace std::literals;
 using ReadInfo = android::dataloader::ReadInfo;
 
 using FileId = android::incfs::FileId;
-using RawMetadata = android::incfs::RawMetadata;
 using UniqueControl = android::incfs::UniqueControl;
+using FdFile = android::dataloader::FdFile;
+using FileIdCache = android::dataloader::FileIdCache;
+using WriteCoalescer = android::dataloader::WriteCoalescer;
+using ReadDeadlineTracker = android::dataloader::ReadDeadlineTracker;
+using ReadLogBatching = android::dataloader::ReadLogBatching;
+template <class T>
+using BoundedQueue = android::dataloader::BoundedQueue<T>;
 
 struct JniIds {
     struct {
@@ -239,9 +251,20 @@ struct Globals {
     DataLoaderFactory* managedDataLoaderFactory = nullptr;
     DataLoaderFactory* dataLoaderFactory = nullptr;
 
+    // Serializes the writers of the connectors map.
     std::mutex dataLoaderConnectorsLock;
-    // id->DataLoader map
-    DataLoaderConnectorsMap dataLoaderConnectors GUARDED_BY(dataLoaderConnectorsLock);
+    // id->DataLoader map. Never modified in place: readers grab the current snapshot, writers
+    // publish an updated copy. Use findConnector()/updateConnectors().
+    // The snapshot goes through std::atomic_load()/atomic_store(), which aren't lock-free:
+    // libc++ guards them with a global set of striped mutexes, held only to copy the pointer.
+    // Readers never wait for dataLoaderConnectorsLock or for a map copy, though. These free
+    // functions are deprecated in C++20 for std::atomic<std::shared_ptr>, which libc++ doesn't
+    // implement yet.
+    std::shared_ptr<const DataLoaderConnectorsMap> dataLoaderConnectors =
+            std::make_shared<const DataLoaderConnectorsMap>();
+
+    // Guards the looper threads creation.
+    std::mutex loopersLock;
 
     std::atomic_bool stopped;
     std::thread pendingReadsLooperThread;
@@ -255,6 +278,25 @@ static Globals& globals() {
     return globals;
 }
 
+static DataLoaderConnectorPtr findConnector(jint storageId) {
+    const auto connectors = std::atomic_load(&globals().dataLoaderConnectors);
+    const auto it = connectors->find(storageId);
+    return it == connectors->end() ? nullptr : it->second;
+}
+
+// Publishes a copy of the connectors map changed by |update|, which returns false to keep the
+// current one. Must be called under dataLoaderConnectorsLock.
+template <class Func>
+static bool updateConnectors(Func&& update) {
+    auto connectors = std::make_shared<DataLoaderConnectorsMap>(*globals().dataLoaderConnectors);
+    if (!update(*connectors)) {
+        return false;
+    }
+    std::atomic_store(&globals().dataLoaderConnectors,
+                      std::shared_ptr<const DataLoaderConnectorsMap>(std::move(connectors)));
+    return true;
+}
+
 struct IncFsLooper : public android::Looper {
     IncFsLooper() : Looper(/*allowNonCallbacks=*/false) {}
     ~IncFsLooper() {}
@@ -287,8 +329,44 @@ private:
 
 static constexpr auto kPendingReadsBufferSize = 256;
 
+// Writes out the blocks that stayed in the connector's write buffer for too long.
+class WriteFlushHandler : public android::MessageHandler {
+public:
+    explicit WriteFlushHandler(std::weak_ptr<DataLoaderConnector> connector)
+          : mConnector(std::move(connector)) {}
+    void handleMessage(const android::Message&) final;
+
+private:
+    std::weak_ptr<DataLoaderConnector> mConnector;
+};
+
+// Re-delivers the pending reads close to their timeout and drops the expired ones.
+class ReadDeadlineHandler : public android::MessageHandler {
+public:
+    explicit ReadDeadlineHandler(std::weak_ptr<DataLoaderConnector> connector)
+          : mConnector(std::move(connector)) {}
+    void handleMessage(const android::Message&) final;
+
+private:
+    std::weak_ptr<DataLoaderConnector> mConnector;
+};
+
+// Puts the read log back into the log looper after a batching delay.
+class LogWakeupHandler : public android::MessageHandler {
+public:
+    explicit LogWakeupHandler(std::weak_ptr<DataLoaderConnector> connector)
+          : mConnector(std::move(connector)) {}
+    void handleMessage(const android::Message&) final;
+
+private:
+    std::weak_ptr<DataLoaderConnector> mConnector;
+};
+
+static int onLogLooperEvent(int fd, int events, void* data);
+
 class DataLoaderConnector : public android::dataloader::FilesystemConnector,
-                            public android::dataloader::StatusListener {
+                            public android::dataloader::StatusListener,
+                            public std::enable_shared_from_this<DataLoaderConnector> {
 public:
     DataLoaderConnector(JNIEnv* env, jobject service, jint storageId, UniqueControl control,
                         jobject serviceConnector, jobject callbackControl, jobject listener)
@@ -346,6 +424,12 @@ public:
         if (checkAndClearJavaException(__func__)) {
             result = false;
         }
+        if (result && mControl.logs() >= 0) {
+            std::call_once(mLogWakeupHandlerOnce, [this] {
+                mLogWakeupHandler = new LogWakeupHandler(weak_from_this());
+            });
+        }
+        mLogBatching.reset();
         mRunning = result;
         return result;
     }
@@ -357,16 +441,37 @@ public:
         mRunning = false;
         std::lock_guard{mPendingReadsLooperBusy}; // NOLINT
         std::lock_guard{mLogLooperBusy}; // NOLINT
+        cancelWriteFlush();
+        cancelReadDeadline();
+        // A restarted loader gets the still pending reads reported again, so don't hedge the
+        // stale copies.
+        mReadDeadlines.clear();
+        if (mLogWakeupHandler) {
+            logLooper().removeMessages(mLogWakeupHandler);
+            // In case the wakeup got in just before the stop.
+            logLooper().removeFd(mControl.logs());
+        }
 
         mDataLoader->onStop(mDataLoader);
         checkAndClearJavaException(__func__);
+
+        if (const auto err = mWriteCoalescer.flush()) {
+            LOG(WARNING) << "Buffered writes failed for id(" << mStorageId << "): " << err;
+        }
     }
     void onDestroy() {
         CHECK(mDataLoader);
         mDataLoader->onDestroy(mDataLoader);
         checkAndClearJavaException(__func__);
+        mDestroyed = true;
     }
 
+    // Map lookups don't take dataLoaderConnectorsLock, so a call may still hold the connector
+    // after it got removed: onStart()/onStop()/onDestroy() run under this lock and check
+    // destroyed() first.
+    std::mutex& lifecycleLock() { return mLifecycleLock; }
+    bool destroyed() const { return mDestroyed; }
+
     bool onPrepareImage(const android::dataloader::DataLoaderInstallationFiles& addedFiles) {
         CHECK(mDataLoader);
         bool result =
@@ -387,6 +492,11 @@ public:
                 pendingReads.empty()) {
                 return 1;
             }
+            mWriteCoalescer.onPendingReads({pendingReads.data(), pendingReads.size()});
+            if (mReadDeadlines.enabled()) {
+                mReadDeadlines.onPendingReads(pendingReads);
+                scheduleReadDeadline();
+            }
             mDataLoader->onPendingReads(mDataLoader, pendingReads.data(), pendingReads.size());
         }
         return 1;
@@ -394,16 +504,47 @@ public:
     int onLogLooperEvent(std::vector<ReadInfo>& pageReads) {
         CHECK(mDataLoader);
         std::lock_guard lock{mLogLooperBusy};
+        size_t records = 0;
         while (mRunning.load(std::memory_order_relaxed)) {
             pageReads.clear();
             if (android::incfs::waitForPageReads(mControl, 0ms, &pageReads) !=
                         android::incfs::WaitResult::HaveData ||
                 pageReads.empty()) {
-                return 1;
+                break;
             }
+            records += pageReads.size();
             mDataLoader->onPageReads(mDataLoader, pageReads.data(), pageReads.size());
         }
-        return 1;
+        if (!mRunning.load(std::memory_order_relaxed) || !mLogWakeupHandler) {
+            return 1;
+        }
+        if (const auto stats = android::incfs::readLogStats(mControl);
+            stats.droppedRecords > mLogDroppedRecords) {
+            LOG(WARNING) << "Page read log overflowed for id(" << mStorageId << "): "
+                         << stats.droppedRecords - mLogDroppedRecords << " records lost, "
+                         << stats.droppedRecords << " of " << stats.records + stats.droppedRecords
+                         << " total";
+            mLogDroppedRecords = stats.droppedRecords;
+            mLogBatching.onDroppedRecords();
+        }
+        // The kernel wakes the log up for every record; stop listening for a while to let the
+        // records pile up, and pick them all up at once.
+        const auto delay = mLogBatching.onWakeup(records);
+        if (delay == 0ms) {
+            return 1;
+        }
+        logLooper().sendMessageDelayed(std::chrono::nanoseconds(delay).count(), mLogWakeupHandler,
+                                       android::Message());
+        return 0;
+    }
+
+    void onLogWakeupDelayElapsed() {
+        std::lock_guard lock{mLogLooperBusy};
+        if (!mRunning.load(std::memory_order_relaxed)) {
+            return;
+        }
+        logLooper().addFd(mControl.logs(), android::Looper::POLL_CALLBACK,
+                          android::Looper::EVENT_INPUT, &::onLogLooperEvent, this);
     }
 
     void writeData(jstring name, jlong offsetBytes, jlong lengthBytes, jobject incomingFd) const {
@@ -418,8 +559,100 @@ public:
         return android::incfs::openForSpecialOps(mControl, fid);
     }
 
-    int writeBlocks(android::dataloader::Span<const IncFsDataBlock> blocks) const {
-        return android::incfs::writeBlocks(blocks);
+    int writeBlocks(android::dataloader::Span<const IncFsDataBlock> blocks) {
+        const auto coalescing = mWriteCoalescer.enabled();
+        const auto tracking = mReadDeadlines.tracking();
+        if (!coalescing && !tracking) {
+            return android::incfs::writeBlocks(blocks);
+        }
+        // Both the coalescer and the deadline tracker need the files, resolve them only once.
+        std::vector<FdFile> files;
+        mFileIds.resolve(blocks, &files);
+        int res;
+        if (!coalescing) {
+            res = android::incfs::writeBlocks(blocks);
+        } else {
+            res = mWriteCoalescer.write(blocks, {files.data(), files.size()});
+            scheduleWriteFlush();
+        }
+        if (res > 0 && tracking) {
+            // Both report partial writes: only the first |res| blocks satisfy any reads.
+            const auto written = std::min(size_t(res), blocks.size());
+            mReadDeadlines.onBlocksWritten({blocks.data(), written}, {files.data(), written});
+        }
+        return res;
+    }
+
+    bool setWriteCoalescing(DataLoaderWriteCoalescingParams params) {
+        if (params.maxBufferedBytes > 0 && mControl.pendingReads() < 0) {
+            // No pending reads looper to run the deadline flushes on.
+            LOG(ERROR) << "Write coalescing isn't supported for id(" << mStorageId
+                       << "): no pending reads fd";
+            return false;
+        }
+        std::call_once(mWriteFlushHandlerOnce, [this] {
+            mWriteFlushHandler = new WriteFlushHandler(weak_from_this());
+        });
+        mWriteCoalescer.setParams(params);
+        return true;
+    }
+
+    bool setPrepareImageStreaming(DataLoaderPrepareImageStreamingParams params) {
+        if (params.chunkSize < 0 || (params.chunkSize > 0 && !params.onFiles)) {
+            return false;
+        }
+        std::lock_guard lock(mPrepareImageStreamingLock);
+        mPrepareImageStreaming = params;
+        return true;
+    }
+
+    DataLoaderPrepareImageStreamingParams prepareImageStreaming() const {
+        std::lock_guard lock(mPrepareImageStreamingLock);
+        return mPrepareImageStreaming;
+    }
+
+    bool setReadDeadlines(DataLoaderReadDeadlineParams params) {
+        if (params.readTimeoutMs > 0 && mControl.pendingReads() < 0) {
+            LOG(ERROR) << "Read deadlines aren't supported for id(" << mStorageId
+                       << "): no pending reads fd";
+            return false;
+        }
+        std::call_once(mReadDeadlineHandlerOnce, [this] {
+            mReadDeadlineHandler = new ReadDeadlineHandler(weak_from_this());
+        });
+        mReadDeadlines.setParams(params);
+        return true;
+    }
+
+    DataLoaderReadDeadlineStats readDeadlineStats() const { return mReadDeadlines.stats(); }
+
+    void onReadDeadline() {
+        mReadDeadlineScheduled = false;
+        std::lock_guard lock{mPendingReadsLooperBusy};
+        if (!mRunning.load(std::memory_order_relaxed)) {
+            return;
+        }
+        mHedgedReads.clear();
+        if (const auto timedOut = mReadDeadlines.onDeadlines(mHedgedReads)) {
+            LOG(WARNING) << timedOut << " pending reads timed out for id(" << mStorageId << ")";
+        }
+        if (!mHedgedReads.empty()) {
+            mDataLoader->onPendingReads(mDataLoader, mHedgedReads.data(), mHedgedReads.size());
+        }
+        scheduleReadDeadline();
+    }
+
+    int flushBlocks() { return mWriteCoalescer.flush(); }
+
+    int prefillHashTrees(android::dataloader::Span<const FileId> files,
+                         DataLoaderHashTreeSource source, void* cookie) const {
+        return android::dataloader::prefillHashTrees(mControl, files, source, cookie);
+    }
+
+    void onWriteFlushDeadline() {
+        mWriteFlushScheduled = false;
+        mWriteCoalescer.flushExpired();
+        scheduleWriteFlush();
     }
 
     int getRawMetadata(FileId fid, char buffer[], size_t* bufferSize) const {
@@ -477,13 +710,88 @@ private:
     jint const mStorageId;
     UniqueControl const mControl;
 
+    void scheduleWriteFlush() {
+        const auto deadline = mWriteCoalescer.nextDeadline();
+        if (!deadline || mWriteFlushScheduled.exchange(true)) {
+            return;
+        }
+        const auto delay = std::max(WriteCoalescer::Clock::duration::zero(),
+                                    *deadline - WriteCoalescer::Clock::now());
+        pendingReadsLooper().sendMessageDelayed(std::chrono::nanoseconds(delay).count(),
+                                                mWriteFlushHandler, android::Message());
+    }
+
+    void cancelWriteFlush() {
+        if (mWriteFlushHandler) {
+            pendingReadsLooper().removeMessages(mWriteFlushHandler);
+        }
+        mWriteFlushScheduled = false;
+    }
+
+    void scheduleReadDeadline() {
+        const auto delay = mReadDeadlines.nextDeadline();
+        if (!delay || mReadDeadlineScheduled.exchange(true)) {
+            return;
+        }
+        pendingReadsLooper().sendMessageDelayed(std::chrono::nanoseconds(*delay).count(),
+                                                mReadDeadlineHandler, android::Message());
+    }
+
+    void cancelReadDeadline() {
+        if (mReadDeadlineHandler) {
+            pendingReadsLooper().removeMessages(mReadDeadlineHandler);
+        }
+        mReadDeadlineScheduled = false;
+    }
+
     ::DataLoader* mDataLoader = nullptr;
 
+    std::mutex mLifecycleLock;
+    bool mDestroyed = false;
+
     std::mutex mPendingReadsLooperBusy;
     std::mutex mLogLooperBusy;
     std::atomic<bool> mRunning{false};
+
+    FileIdCache mFileIds;
+    WriteCoalescer mWriteCoalescer;
+    std::once_flag mWriteFlushHandlerOnce;
+    android::sp<android::MessageHandler> mWriteFlushHandler;
+    std::atomic<bool> mWriteFlushScheduled{false};
+
+    ReadDeadlineTracker mReadDeadlines;
+    std::once_flag mReadDeadlineHandlerOnce;
+    android::sp<android::MessageHandler> mReadDeadlineHandler;
+    std::atomic<bool> mReadDeadlineScheduled{false};
+    std::vector<ReadInfo> mHedgedReads;
+
+    mutable std::mutex mPrepareImageStreamingLock;
+    DataLoaderPrepareImageStreamingParams mPrepareImageStreaming = {};
+
+    ReadLogBatching mLogBatching;
+    uint64_t mLogDroppedRecords = 0;
+    std::once_flag mLogWakeupHandlerOnce;
+    android::sp<android::MessageHandler> mLogWakeupHandler;
 };
 
+void WriteFlushHandler::handleMessage(const android::Message&) {
+    if (auto connector = mConnector.lock()) {
+        connector->onWriteFlushDeadline();
+    }
+}
+
+void ReadDeadlineHandler::handleMessage(const android::Message&) {
+    if (auto connector = mConnector.lock()) {
+        connector->onReadDeadline();
+    }
+}
+
+void LogWakeupHandler::handleMessage(const android::Message&) {
+    if (auto connector = mConnector.lock()) {
+        connector->onLogWakeupDelayElapsed();
+    }
+}
+
 static int onPendingReadsLooperEvent(int fd, int events, void* data) {
     if (globals().stopped) {
         // No more listeners.
@@ -548,16 +856,15 @@ DataLoaderParamsPair DataLoaderParamsPair::createFromManaged(JNIEnv* env, jobjec
 
     const DataLoaderType type = (DataLoaderType)env->GetIntField(managedParams, jni.paramsType);
 
-    std::string packageName(
-            env->GetStringUTFChars((jstring)env->GetObjectField(managedParams,
-                                                                jni.paramsPackageName),
-                                   nullptr));
-    std::string className(
-            env->GetStringUTFChars((jstring)env->GetObjectField(managedParams, jni.paramsClassName),
-                                   nullptr));
-    std::string arguments(
-            env->GetStringUTFChars((jstring)env->GetObjectField(managedParams, jni.paramsArguments),
-                                   nullptr));
+    const auto getString = [&](jfieldID field) {
+        const auto str = (jstring)env->GetObjectField(managedParams, field);
+        auto result = GetStringUTF(env, str);
+        env->DeleteLocalRef(str);
+        return result;
+    };
+    std::string packageName = getString(jni.paramsPackageName);
+    std::string className = getString(jni.paramsClassName);
+    std::string arguments = getString(jni.paramsArguments);
 
     return DataLoaderParamsPair(android::dataloader::DataLoaderParams(type, std::move(packageName),
                                                                       std::move(className),
@@ -647,6 +954,49 @@ bool DataLoader_FilesystemConnector_setParams(DataLoaderFilesystemConnectorPtr i
     return connector->setParams(params);
 }
 
+bool DataLoader_FilesystemConnector_setWriteCoalescing(DataLoaderFilesystemConnectorPtr ifs,
+                                                       DataLoaderWriteCoalescingParams params) {
+    auto connector = static_cast<DataLoaderConnector*>(ifs);
+    return connector->setWriteCoalescing(params);
+}
+
+bool DataLoader_FilesystemConnector_setReadDeadlines(DataLoaderFilesystemConnectorPtr ifs,
+                                                     DataLoaderReadDeadlineParams params) {
+    auto connector = static_cast<DataLoaderConnector*>(ifs);
+    return connector->setReadDeadlines(params);
+}
+
+int DataLoader_FilesystemConnector_getReadDeadlineStats(DataLoaderFilesystemConnectorPtr ifs,
+                                                        DataLoaderReadDeadlineStats* stats) {
+    if (!stats) {
+        return -EINVAL;
+    }
+    auto connector = static_cast<DataLoaderConnector*>(ifs);
+    *stats = connector->readDeadlineStats();
+    return 0;
+}
+
+bool DataLoader_FilesystemConnector_setPrepareImageStreaming(
+        DataLoaderFilesystemConnectorPtr ifs, DataLoaderPrepareImageStreamingParams params) {
+    auto connector = static_cast<DataLoaderConnector*>(ifs);
+    return connector->setPrepareImageStreaming(params);
+}
+
+int DataLoader_FilesystemConnector_flushBlocks(DataLoaderFilesystemConnectorPtr ifs) {
+    auto connector = static_cast<DataLoaderConnector*>(ifs);
+    return connector->flushBlocks();
+}
+
+int DataLoader_FilesystemConnector_prefillHashTrees(DataLoaderFilesystemConnectorPtr ifs,
+                                                    const IncFsFileId fileIds[], int fileIdsCount,
+                                                    DataLoaderHashTreeSource source, void* cookie) {
+    if (fileIdsCount < 0 || (fileIdsCount > 0 && !fileIds)) {
+        return -EINVAL;
+    }
+    auto connector = static_cast<DataLoaderConnector*>(ifs);
+    return connector->prefillHashTrees({fileIds, size_t(fileIdsCount)}, source, cookie);
+}
+
 int DataLoader_StatusListener_reportStatus(DataLoaderStatusListenerPtr listener,
                                            DataLoaderStatus status) {
     auto connector = static_cast<DataLoaderConnector*>(listener);
@@ -655,13 +1005,9 @@ int DataLoader_StatusListener_reportStatus(DataLoaderStatusListenerPtr listener,
 
 bool DataLoaderService_OnCreate(JNIEnv* env, jobject service, jint storageId, jobject control,
                                 jobject params, jobject listener) {
-    {
-        std::lock_guard lock{globals().dataLoaderConnectorsLock};
-        auto dlIt = globals().dataLoaderConnectors.find(storageId);
-        if (dlIt != globals().dataLoaderConnectors.end()) {
-            ALOGI("id(%d): already exist, skipping creation.", storageId);
-            return true;
-        }
+    if (findConnector(storageId)) {
+        ALOGI("id(%d): already exist, skipping creation.", storageId);
+        return true;
     }
     auto nativeControl = createIncFsControlFromManaged(env, control);
     ALOGI("DataLoader::create1 cmd: %d|%s", nativeControl.cmd(),
@@ -689,23 +1035,24 @@ bool DataLoaderService_OnCreate(JNIEnv* env, jobject service, jint storageId, jo
             reportUnavailableOnExit(nullptr, reportUnavailable);
 
     auto dataLoaderConnector =
-            std::make_unique<DataLoaderConnector>(env, service, storageId, std::move(nativeControl),
+            std::make_shared<DataLoaderConnector>(env, service, storageId, std::move(nativeControl),
                                                   serviceConnector, callbackControl, listener);
     {
         std::lock_guard lock{globals().dataLoaderConnectorsLock};
-        auto [dlIt, dlInserted] =
-                globals().dataLoaderConnectors.try_emplace(storageId,
-                                                           std::move(dataLoaderConnector));
-        if (!dlInserted) {
+        if (globals().dataLoaderConnectors->count(storageId)) {
             ALOGE("id(%d): already exist, skipping creation.", storageId);
             return false;
         }
-        if (!dlIt->second->onCreate(nativeParams, params)) {
-            globals().dataLoaderConnectors.erase(dlIt);
+        // Only becomes visible to the lookups once created.
+        if (!dataLoaderConnector->onCreate(nativeParams, params)) {
             // Enable the reporter.
             reportUnavailableOnExit.reset(listener);
             return false;
         }
+        updateConnectors([&](DataLoaderConnectorsMap& connectors) {
+            connectors.emplace(storageId, std::move(dataLoaderConnector));
+            return true;
+        });
     }
 
     const auto& jni = jniIds(env);
@@ -726,51 +1073,55 @@ bool DataLoaderService_OnStart(JNIEnv* env, jint storageId) {
     std::unique_ptr<_jobject, decltype(destroyAndReportUnavailable)>
             destroyAndReportUnavailableOnExit(nullptr, destroyAndReportUnavailable);
 
-    const UniqueControl* control;
+    const auto dataLoaderConnector = findConnector(storageId);
+    if (!dataLoaderConnector) {
+        ALOGE("Failed to start id(%d): not found", storageId);
+        return false;
+    }
+    const UniqueControl* const control = &(dataLoaderConnector->control());
     jobject listener;
-    DataLoaderConnectorPtr dataLoaderConnector;
     {
-        std::lock_guard lock{globals().dataLoaderConnectorsLock};
-        auto dlIt = globals().dataLoaderConnectors.find(storageId);
-        if (dlIt == globals().dataLoaderConnectors.end()) {
-            ALOGE("Failed to start id(%d): not found", storageId);
+        std::lock_guard lock{dataLoaderConnector->lifecycleLock()};
+        if (dataLoaderConnector->destroyed()) {
+            ALOGE("Failed to start id(%d): already destroyed", storageId);
             return false;
         }
 
-        listener = dlIt->second->getListenerLocalRef(env);
+        listener = dataLoaderConnector->getListenerLocalRef(env);
 
-        dataLoaderConnector = dlIt->second;
         if (!dataLoaderConnector->onStart()) {
             ALOGE("Failed to start id(%d): onStart returned false", storageId);
             destroyAndReportUnavailableOnExit.reset(listener);
             return false;
         }
 
-        control = &(dataLoaderConnector->control());
-
-        // Create loopers while we are under lock.
-        if (control->pendingReads() >= 0 && !globals().pendingReadsLooperThread.joinable()) {
-            pendingReadsLooper();
-            globals().pendingReadsLooperThread = std::thread(&pendingReadsLooperThread);
-        }
-        if (control->logs() >= 0 && !globals().logLooperThread.joinable()) {
-            logLooper();
-            globals().logLooperThread = std::thread(&logLooperThread);
+        {
+            std::lock_guard lock{globals().loopersLock};
+            if (control->pendingReads() >= 0 && !globals().pendingReadsLooperThread.joinable()) {
+                pendingReadsLooper();
+                globals().pendingReadsLooperThread = std::thread(&pendingReadsLooperThread);
+            }
+            if (control->logs() >= 0 && !globals().logLooperThread.joinable()) {
+                logLooper();
+                globals().logLooperThread = std::thread(&logLooperThread);
+            }
         }
-    }
 
-    if (control->pendingReads() >= 0) {
-        pendingReadsLooper().addFd(control->pendingReads(), android::Looper::POLL_CALLBACK,
-                                   android::Looper::EVENT_INPUT, &onPendingReadsLooperEvent,
-                                   dataLoaderConnector.get());
-        pendingReadsLooper().wake();
-    }
+        // The loopers get the raw connector pointer: add the fds under the lifecycle lock, so
+        // a concurrent destroy either runs before (and we bail out above) or removes them.
+        if (control->pendingReads() >= 0) {
+            pendingReadsLooper().addFd(control->pendingReads(), android::Looper::POLL_CALLBACK,
+                                       android::Looper::EVENT_INPUT, &onPendingReadsLooperEvent,
+                                       dataLoaderConnector.get());
+            pendingReadsLooper().wake();
+        }
 
-    if (control->logs() >= 0) {
-        logLooper().addFd(control->logs(), android::Looper::POLL_CALLBACK,
-                          android::Looper::EVENT_INPUT, &onLogLooperEvent,
-                          dataLoaderConnector.get());
-        logLooper().wake();
+        if (control->logs() >= 0) {
+            logLooper().addFd(control->logs(), android::Looper::POLL_CALLBACK,
+                              android::Looper::EVENT_INPUT, &onLogLooperEvent,
+                              dataLoaderConnector.get());
+            logLooper().wake();
+        }
     }
 
     const auto& jni = jniIds(env);
@@ -780,37 +1131,32 @@ bool DataLoaderService_OnStart(JNIEnv* env, jint storageId) {
 }
 
 jobject DataLoaderService_OnStop_NoStatus(JNIEnv* env, jint storageId) {
-    const UniqueControl* control;
-    {
-        std::lock_guard lock{globals().dataLoaderConnectorsLock};
-        auto dlIt = globals().dataLoaderConnectors.find(storageId);
-        if (dlIt == globals().dataLoaderConnectors.end()) {
-            return nullptr;
-        }
-        control = &(dlIt->second->control());
-    }
-
-    if (control->pendingReads() >= 0) {
-        pendingReadsLooper().removeFd(control->pendingReads());
-        pendingReadsLooper().wake();
-    }
-    if (control->logs() >= 0) {
-        logLooper().removeFd(control->logs());
-        logLooper().wake();
+    const auto dataLoaderConnector = findConnector(storageId);
+    if (!dataLoaderConnector) {
+        return nullptr;
     }
+    const UniqueControl* const control = &(dataLoaderConnector->control());
 
     jobject listener = nullptr;
     {
-        std::lock_guard lock{globals().dataLoaderConnectorsLock};
-        auto dlIt = globals().dataLoaderConnectors.find(storageId);
-        if (dlIt == globals().dataLoaderConnectors.end()) {
-            ALOGI("Failed to stop id(%d): not found", storageId);
+        std::lock_guard lock{dataLoaderConnector->lifecycleLock()};
+        if (dataLoaderConnector->destroyed()) {
+            ALOGI("Failed to stop id(%d): already destroyed", storageId);
             return nullptr;
         }
 
-        listener = dlIt->second->getListenerLocalRef(env);
+        // Under the same lock as the addFd() calls in DataLoaderService_OnStart().
+        if (control->pendingReads() >= 0) {
+            pendingReadsLooper().removeFd(control->pendingReads());
+            pendingReadsLooper().wake();
+        }
+        if (control->logs() >= 0) {
+            logLooper().removeFd(control->logs());
+            logLooper().wake();
+        }
+
+        listener = dataLoaderConnector->getListenerLocalRef(env);
 
-        auto&& dataLoaderConnector = dlIt->second;
         dataLoaderConnector->onStop();
     }
     return listener;
@@ -835,16 +1181,27 @@ jobject DataLoaderService_OnDestroy_NoStatus(JNIEnv* env, jint storageId) {
         return nullptr;
     }
 
+    // Unpublish first, so only one of the concurrent destroys gets the connector.
+    DataLoaderConnectorPtr dataLoaderConnector;
     {
         std::lock_guard lock{globals().dataLoaderConnectorsLock};
-        auto dlIt = globals().dataLoaderConnectors.find(storageId);
-        if (dlIt == globals().dataLoaderConnectors.end()) {
-            return nullptr;
-        }
+        updateConnectors([&](DataLoaderConnectorsMap& connectors) {
+            auto dlIt = connectors.find(storageId);
+            if (dlIt == connectors.end()) {
+                return false;
+            }
+            dataLoaderConnector = std::move(dlIt->second);
+            connectors.erase(dlIt);
+            return true;
+        });
+    }
+    if (!dataLoaderConnector) {
+        return nullptr;
+    }
 
-        auto&& dataLoaderConnector = dlIt->second;
+    {
+        std::lock_guard lock{dataLoaderConnector->lifecycleLock()};
         dataLoaderConnector->onDestroy();
-        globals().dataLoaderConnectors.erase(dlIt);
     }
 
     return listener;
@@ -863,87 +1220,134 @@ bool DataLoaderService_OnDestroy(JNIEnv* env, jint storageId) {
     return true;
 }
 
-struct DataLoaderInstallationFilesPair {
-    static DataLoaderInstallationFilesPair createFromManaged(JNIEnv* env, jobjectArray jfiles);
-
-    using Files = std::vector<android::dataloader::DataLoaderInstallationFile>;
-    const Files& files() const { return mFiles; }
+// All installation files of a single call, with their names and metadata packed into one
+// buffer: a fixed number of allocations no matter how many files there are.
+class DataLoaderInstallationFilesArena {
+public:
+    // Converts the files [begin, end) of |jfiles|; end < 0 means all the rest.
+    static DataLoaderInstallationFilesArena createFromManaged(JNIEnv* env, jobjectArray jfiles,
+                                                              int begin = 0, int end = -1);
 
     using NDKFiles = std::vector<::DataLoaderInstallationFile>;
     const NDKFiles& ndkFiles() const { return mNDKFiles; }
 
 private:
-    DataLoaderInstallationFilesPair(Files&& files);
+    DataLoaderInstallationFilesArena() = default;
 
-    Files mFiles;
+    std::vector<char> mArena;
     NDKFiles mNDKFiles;
 };
 
-DataLoaderInstallationFilesPair DataLoaderInstallationFilesPair::createFromManaged(
-        JNIEnv* env, jobjectArray jfiles) {
+DataLoaderInstallationFilesArena DataLoaderInstallationFilesArena::createFromManaged(
+        JNIEnv* env, jobjectArray jfiles, int begin, int end) {
     const auto& jni = jniIds(env);
+    DataLoaderInstallationFilesArena result;
 
     // jfiles is a Java array of InstallationFileParcel
-    auto size = env->GetArrayLength(jfiles);
-    DataLoaderInstallationFilesPair::Files files;
-    files.reserve(size);
-
-    for (int i = 0; i < size; ++i) {
-        jobject jfile = env->GetObjectArrayElement(jfiles, i);
-
-        DataLoaderLocation location =
-                (DataLoaderLocation)env->GetIntField(jfile, jni.installationFileLocation);
-        std::string name =
-                env->GetStringUTFChars((jstring)env->GetObjectField(jfile,
-                                                                    jni.installationFileName),
-                                       nullptr);
-        IncFsSize size = env->GetLongField(jfile, jni.installationFileLengthBytes);
+    if (end < 0) {
+        end = env->GetArrayLength(jfiles);
+    }
+    const auto count = std::max(end - begin, 0);
+    auto& files = result.mNDKFiles;
+    files.resize(count);
+
+    // A single pass, so each string and array is measured and copied through the same local
+    // ref. The arena may move while it grows, so keep the offsets and fix the pointers after.
+    auto& arena = result.mArena;
+    std::vector<size_t> nameOffsets(count);
+    std::vector<size_t> metadataOffsets(count);
+    for (int i = 0; i < count; ++i) {
+        const auto jfile = env->GetObjectArrayElement(jfiles, begin + i);
+        const auto jname = (jstring)env->GetObjectField(jfile, jni.installationFileName);
+        const auto jmetadata = (jbyteArray)env->GetObjectField(jfile, jni.installationFileMetadata);
+
+        auto& file = files[i];
+        file.location = env->GetIntField(jfile, jni.installationFileLocation);
+        file.size = env->GetLongField(jfile, jni.installationFileLengthBytes);
+
+        nameOffsets[i] = arena.size();
+        arena.resize(arena.size() + (jname ? env->GetStringUTFLength(jname) : 0) + 1);
+        if (jname) {
+            GetStringUTFInto(env, jname, arena.data() + nameOffsets[i]);
+        } else {
+            arena.back() = '\0';
+        }
 
-        auto jmetadataBytes = (jbyteArray)env->GetObjectField(jfile, jni.installationFileMetadata);
-        auto metadataElements = env->GetByteArrayElements(jmetadataBytes, nullptr);
-        auto metadataLength = env->GetArrayLength(jmetadataBytes);
-        RawMetadata metadata(metadataElements, metadataElements + metadataLength);
-        env->ReleaseByteArrayElements(jmetadataBytes, metadataElements, 0);
+        metadataOffsets[i] = arena.size();
+        file.metadata.size = jmetadata ? env->GetArrayLength(jmetadata) : 0;
+        if (file.metadata.size > 0) {
+            arena.resize(arena.size() + file.metadata.size);
+            env->GetByteArrayRegion(jmetadata, 0, file.metadata.size,
+                                    (jbyte*)arena.data() + metadataOffsets[i]);
+        }
 
-        files.emplace_back(location, std::move(name), size, std::move(metadata));
+        env->DeleteLocalRef(jmetadata);
+        env->DeleteLocalRef(jname);
+        env->DeleteLocalRef(jfile);
+    }
+    for (int i = 0; i < count; ++i) {
+        files[i].name = arena.data() + nameOffsets[i];
+        files[i].metadata.data = arena.data() + metadataOffsets[i];
     }
 
-    return DataLoaderInstallationFilesPair(std::move(files));
+    return result;
 }
 
-DataLoaderInstallationFilesPair::DataLoaderInstallationFilesPair(Files&& files)
-      : mFiles(std::move(files)) {
-    const auto size = mFiles.size();
-    mNDKFiles.resize(size);
-    for (size_t i = 0; i < size; ++i) {
-        const auto& file = mFiles[i];
-        auto&& ndkFile = mNDKFiles[i];
+// At most this many converted chunks wait for the loader before the JNI thread blocks.
+static constexpr int kMaxPrepareImageChunksAhead = 4;
+
+// Converts |jfiles| chunk by chunk on the calling thread - JNI can't be used from anywhere else -
+// and hands each finished chunk to |streaming.onFiles| on a worker thread in the meantime.
+// Returns all the files, pointing into |chunks|.
+static DataLoaderInstallationFilesArena::NDKFiles streamFromManaged(
+        JNIEnv* env, jobjectArray jfiles, DataLoaderPrepareImageStreamingParams streaming,
+        std::deque<DataLoaderInstallationFilesArena>* chunks) {
+    const int count = env->GetArrayLength(jfiles);
+
+    BoundedQueue<const DataLoaderInstallationFilesArena*> queue(kMaxPrepareImageChunksAhead, 1);
+    std::thread worker([&queue, streaming] {
+        while (const auto chunk = queue.pop()) {
+            const auto& files = (*chunk)->ndkFiles();
+            streaming.onFiles(streaming.cookie, files.data(), files.size());
+        }
+    });
+    for (int begin = 0; begin < count; begin += streaming.chunkSize) {
+        const auto end = std::min(count, begin + streaming.chunkSize);
+        chunks->push_back(DataLoaderInstallationFilesArena::createFromManaged(env, jfiles, begin,
+                                                                             end));
+        queue.push(&chunks->back());
+    }
+    queue.producerDone();
+    worker.join();
 
-        ndkFile.location = file.location();
-        ndkFile.name = file.name().c_str();
-        ndkFile.size = file.size();
-        ndkFile.metadata.data = file.metadata().data();
-        ndkFile.metadata.size = file.metadata().size();
+    DataLoaderInstallationFilesArena::NDKFiles files;
+    files.reserve(count);
+    for (auto&& chunk : *chunks) {
+        files.insert(files.end(), chunk.ndkFiles().begin(), chunk.ndkFiles().end());
     }
+    return files;
 }
 
 bool DataLoaderService_OnPrepareImage(JNIEnv* env, jint storageId, jobjectArray addedFiles,
                                       jobjectArray removedFiles) {
-    jobject listener;
-    DataLoaderConnectorPtr dataLoaderConnector;
-    {
-        std::lock_guard lock{globals().dataLoaderConnectorsLock};
-        auto dlIt = globals().dataLoaderConnectors.find(storageId);
-        if (dlIt == globals().dataLoaderConnectors.end()) {
-            ALOGE("Failed to handle onPrepareImage for id(%d): not found", storageId);
-            return false;
-        }
-        listener = dlIt->second->getListenerLocalRef(env);
-        dataLoaderConnector = dlIt->second;
+    const auto dataLoaderConnector = findConnector(storageId);
+    if (!dataLoaderConnector) {
+        ALOGE("Failed to handle onPrepareImage for id(%d): not found", storageId);
+        return false;
+    }
+    jobject listener = dataLoaderConnector->getListenerLocalRef(env);
+
+    bool result;
+    if (const auto streaming = dataLoaderConnector->prepareImageStreaming();
+        streaming.chunkSize > 0) {
+        std::deque<DataLoaderInstallationFilesArena> chunks;
+        result = dataLoaderConnector->onPrepareImage(
+                streamFromManaged(env, addedFiles, streaming, &chunks));
+    } else {
+        const auto addedFilesArena =
+                DataLoaderInstallationFilesArena::createFromManaged(env, addedFiles);
+        result = dataLoaderConnector->onPrepareImage(addedFilesArena.ndkFiles());
     }
-
-    auto addedFilesPair = DataLoaderInstallationFilesPair::createFromManaged(env, addedFiles);
-    bool result = dataLoaderConnector->onPrepareImage(addedFilesPair.ndkFiles());
 
     const auto& jni = jniIds(env);
     reportStatusViaCallback(env, listener, storageId,
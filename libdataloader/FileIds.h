@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <dataloader.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace android::dataloader {
+
+// The IncFS id of the file open as |fd|, or kIncFsInvalidFileId if it's not an IncFS file.
+inline FileId fileIdForFd(int fd) {
+    char buffer[kIncFsFileIdStringLength];
+    if (::fgetxattr(fd, INCFS_XATTR_ID_NAME, buffer, sizeof(buffer)) != sizeof(buffer)) {
+        return kIncFsInvalidFileId;
+    }
+    return android::incfs::toFileId({buffer, sizeof(buffer)});
+}
+
+// The IncFS file behind a loader's fd.
+struct FdFile {
+    FileId id = kIncFsInvalidFileId;
+    ino_t ino = 0;
+};
+
+// Resolves the fds passed to writeBlocks() to their files. A known fd costs an fstat(), which
+// also notices the fds that got closed and reopened for another file; only new fds need the
+// fgetxattr() for the id.
+class FileIdCache final {
+public:
+    FdFile get(int fd) {
+        struct stat st;
+        if (::fstat(fd, &st)) {
+            return {};
+        }
+        {
+            std::lock_guard lock(mLock);
+            const auto it = mFiles.find(fd);
+            if (it != mFiles.end() && it->second.dev == st.st_dev &&
+                it->second.file.ino == st.st_ino) {
+                return it->second.file;
+            }
+        }
+        const FdFile file{fileIdForFd(fd), st.st_ino};
+        std::lock_guard lock(mLock);
+        if (mFiles.size() >= kMaxFds) {
+            mFiles.clear();
+        }
+        mFiles.insert_or_assign(fd, Entry{st.st_dev, file});
+        return file;
+    }
+
+    // Puts the file of each of the |blocks| into |files|, resolving every run of blocks with
+    // the same fd once.
+    void resolve(DataBlocks blocks, std::vector<FdFile>* files) {
+        files->resize(blocks.size());
+        for (size_t i = 0; i < blocks.size(); ++i) {
+            (*files)[i] = i > 0 && blocks[i].fileFd == blocks[i - 1].fileFd
+                    ? (*files)[i - 1]
+                    : get(blocks[i].fileFd);
+        }
+    }
+
+    void clear() {
+        std::lock_guard lock(mLock);
+        mFiles.clear();
+    }
+
+private:
+    static constexpr size_t kMaxFds = 1024;
+
+    struct Entry {
+        dev_t dev;
+        FdFile file;
+    };
+
+    std::mutex mLock;
+    std::unordered_map<int, Entry> mFiles;
+};
+
+} // namespace android::dataloader
@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#define LOG_TAG "incfs-dataloader-prefill"
+
+#include "HashTreePrefill.h"
+
+#include <android-base/logging.h>
+#include <hashtree.h>
+#include <parallel.h>
+#include <sys/stat.h>
+
+#include <atomic>
+#include <vector>
+
+namespace hashtree = android::incfs::hashtree;
+
+namespace android::dataloader {
+
+// Returns 1 if any hash blocks were written, 0 if there was nothing to do, or -errno.
+static int prefillHashTree(const android::incfs::Control& control, FileId fileId,
+                           DataLoaderHashTreeSource source, void* cookie) {
+    const auto fd = android::incfs::openForSpecialOps(control, fileId);
+    if (!fd.ok()) {
+        return fd.get();
+    }
+    struct stat st;
+    if (::fstat(fd.get(), &st)) {
+        return -errno;
+    }
+    auto [res, ranges] = android::incfs::getFilledRanges(fd.get());
+    if (res) {
+        return res;
+    }
+    // IncFS reports the total number of the data and hash blocks as the end index.
+    const auto dataBlocks = hashtree::dataBlocks(st.st_size);
+    const auto hashBlocks = ranges.internalRawRanges().endIndex - dataBlocks;
+    if (hashBlocks <= 0) {
+        return 0;
+    }
+    const auto geometry = hashtree::geometry(st.st_size);
+    if (geometry.totalBlocks != hashBlocks) {
+        LOG(ERROR) << "Unexpected hash tree size for " << android::incfs::toString(fileId)
+                   << ": " << hashBlocks << " blocks";
+        return -EINVAL;
+    }
+    const android::incfs::BlockRange allData[] = {{{0, dataBlocks}}};
+    const auto missing = hashtree::missingHashBlocks(geometry, allData,
+                                                     {ranges.hashRanges().data(),
+                                                      ranges.hashRanges().size()});
+    if (missing.empty()) {
+        return 0;
+    }
+
+    std::vector<char> tree(hashtree::size(geometry));
+    if (const auto err = source(cookie, fileId, tree.data(), tree.size())) {
+        return err;
+    }
+    std::vector<DataBlock> blocks;
+    for (auto&& range : missing) {
+        for (auto index = range.begin; index < range.end; ++index) {
+            blocks.push_back({
+                    .fileFd = fd.get(),
+                    .pageIndex = index,
+                    .compression = INCFS_COMPRESSION_KIND_NONE,
+                    .kind = INCFS_BLOCK_KIND_HASH,
+                    .dataSize = kBlockSize,
+                    .data = tree.data() + IncFsSize(index) * kBlockSize,
+            });
+        }
+    }
+    const auto written = android::incfs::writeBlocks(blocks);
+    if (written < 0) {
+        return written;
+    }
+    return size_t(written) == blocks.size() ? 1 : -EIO;
+}
+
+int prefillHashTrees(const android::incfs::Control& control, Span<const FileId> files,
+                     DataLoaderHashTreeSource source, void* cookie) {
+    if (!source) {
+        return -EINVAL;
+    }
+    std::atomic<int> prefilled = 0;
+    std::atomic<int> firstError = 0;
+    // Every file is worth a thread of its own.
+    android::incfs::details::parallelFor(files.size(), 1, [&](size_t i) {
+        const auto res = prefillHashTree(control, files[i], source, cookie);
+        if (res < 0) {
+            LOG(ERROR) << "Failed to prefill the hash tree for "
+                       << android::incfs::toString(files[i]) << ": " << res;
+            int expected = 0;
+            firstError.compare_exchange_strong(expected, res);
+        } else {
+            prefilled += res;
+        }
+    });
+    return firstError ? firstError.load() : prefilled.load();
+}
+
+} // namespace android::dataloader
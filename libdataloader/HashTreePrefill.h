@@ -0,0 +1,29 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <dataloader.h>
+
+namespace android::dataloader {
+
+// Writes the complete hash trees of the |files| before any of their data, so a pending read
+// on a verified file only needs its data block afterwards. Files get processed in parallel;
+// unverified files and the hash blocks IncFS already has are skipped.
+// Returns the number of files that got hash blocks written, or the first error.
+int prefillHashTrees(const android::incfs::Control& control, Span<const FileId> files,
+                     DataLoaderHashTreeSource source, void* cookie);
+
+} // namespace android::dataloader
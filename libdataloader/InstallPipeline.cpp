@@ -0,0 +1,580 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#define LOG_TAG "incfs-dataloader-install"
+
+#include "InstallPipeline.h"
+
+#include <HashTreeVerifier.h>
+#include <android-base/logging.h>
+#include <fcntl.h>
+#include <hashtree.h>
+#include <lz4.h>
+#include <openssl/sha.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <optional>
+#include <thread>
+#include <unordered_set>
+
+#include "BoundedQueue.h"
+
+namespace hashtree = android::incfs::hashtree;
+
+using Clock = std::chrono::steady_clock;
+
+namespace android::dataloader {
+
+static int preadFully(int fd, IncFsSize offset, Span<char> buffer) {
+    for (size_t done = 0; done < buffer.size();) {
+        const auto res = TEMP_FAILURE_RETRY(
+                ::pread(fd, buffer.data() + done, buffer.size() - done, offset + done));
+        if (res < 0) {
+            return -errno;
+        }
+        if (res == 0) {
+            return -EIO;
+        }
+        done += res;
+    }
+    return 0;
+}
+
+int LocalFileSource::read(const InstallFile& file, IncFsSize offset, Span<char> buffer) {
+    int fd;
+    {
+        std::lock_guard lock(mLock);
+        auto& cached = mFds[&file];
+        if (!cached.ok()) {
+            cached = android::incfs::UniqueFd(
+                    ::open((mDir + '/' + file.path).c_str(), O_RDONLY | O_CLOEXEC));
+            if (!cached.ok()) {
+                const auto err = -errno;
+                mFds.erase(&file);
+                return err;
+            }
+        }
+        fd = cached.get();
+    }
+    // Only this thread reads the file now, so nobody closes |fd| under us.
+    const auto res = preadFully(fd, offset, buffer);
+    if (res || offset + IncFsSize(buffer.size()) >= file.size) {
+        std::lock_guard lock(mLock);
+        mFds.erase(&file);
+    }
+    return res;
+}
+
+int PipeSource::read(const InstallFile& file, IncFsSize offset, Span<char> buffer) {
+    for (size_t done = 0; done < buffer.size();) {
+        const auto res = TEMP_FAILURE_RETRY(
+                ::read(mFd.get(), buffer.data() + done, buffer.size() - done));
+        if (res < 0) {
+            return -errno;
+        }
+        if (res == 0) {
+            return -EIO;
+        }
+        done += res;
+    }
+    return 0;
+}
+
+namespace {
+
+struct StageCounters {
+    explicit StageCounters(const char* name) : name(name) {}
+
+    const char* const name;
+    std::atomic<uint64_t> items = 0;
+    std::atomic<uint64_t> bytes = 0;
+    std::atomic<int64_t> busyNs = 0;
+    std::atomic<int64_t> waitingNs = 0;
+
+    InstallStageStats stats() const {
+        return {name, items, bytes, std::chrono::nanoseconds(busyNs.load()),
+                std::chrono::nanoseconds(waitingNs.load())};
+    }
+};
+
+// Adds the time since its creation to a counter.
+class ScopedTimer {
+public:
+    explicit ScopedTimer(std::atomic<int64_t>& counter) : mCounter(counter) {}
+    ~ScopedTimer() {
+        mCounter += std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - mStart)
+                            .count();
+    }
+
+private:
+    std::atomic<int64_t>& mCounter;
+    const Clock::time_point mStart = Clock::now();
+};
+
+struct FileState {
+    FileState(const InstallFile& file, android::incfs::UniqueFd fd, bool created)
+          : file(file),
+            fd(std::move(fd)),
+            created(created),
+            geometry(hashtree::geometry(file.size)) {}
+
+    bool verified() const { return !file.signature.empty(); }
+
+    const InstallFile& file;
+    const android::incfs::UniqueFd fd;
+    // Not there before the run, so it's fine to remove it if its data turns out to be bad.
+    const bool created;
+    const hashtree::Geometry geometry;
+    // Verified files only: the tree being built, and the hash of the only data block of the
+    // files that are too small for a tree.
+    std::vector<char> tree;
+    char dataHash[hashtree::kDigestSize] = {};
+    std::atomic<int> chunksToHash = 0;
+};
+using FileStatePtr = std::shared_ptr<FileState>;
+
+struct Chunk {
+    FileStatePtr file;
+    IncFsSize offset = 0;
+    std::vector<char> data;
+    // Ready for writing.
+    std::vector<char> compressed;
+    std::vector<DataBlock> blocks;
+};
+
+void sha256(const char* data, size_t size, char* digest) {
+    ::SHA256((const uint8_t*)data, size, (uint8_t*)digest);
+}
+
+// Hashes the chunk's data blocks into the leaf level of the file's tree.
+void hashChunk(const Chunk& chunk) {
+    auto& file = *chunk.file;
+    const auto firstBlock = chunk.offset / kBlockSize;
+    for (size_t offset = 0; offset < chunk.data.size(); offset += kBlockSize) {
+        const auto size = std::min<size_t>(kBlockSize, chunk.data.size() - offset);
+        const char* data = chunk.data.data() + offset;
+        // The last block is hashed zero-padded to the full block size.
+        char padded[kBlockSize];
+        if (size < size_t(kBlockSize)) {
+            memcpy(padded, data, size);
+            memset(padded + size, 0, sizeof(padded) - size);
+            data = padded;
+        }
+        const auto index = firstBlock + offset / kBlockSize;
+        char* digest = file.geometry.depth == 0
+                ? file.dataHash
+                : file.tree.data() + IncFsSize(file.geometry.levelOffset[0]) * kBlockSize +
+                        index * hashtree::kDigestSize;
+        sha256(data, kBlockSize, digest);
+    }
+}
+
+// Fills in the levels above the leaves once all data is hashed, and checks the result against
+// the signature. Returns 0 or -errno.
+int finishTree(FileState& file) {
+    const auto& geometry = file.geometry;
+    for (int level = 1; level < geometry.depth; ++level) {
+        const auto* children =
+                file.tree.data() + IncFsSize(geometry.levelOffset[level - 1]) * kBlockSize;
+        auto* hashes = file.tree.data() + IncFsSize(geometry.levelOffset[level]) * kBlockSize;
+        for (int i = 0; i < geometry.levelBlocks[level - 1]; ++i) {
+            sha256(children + IncFsSize(i) * kBlockSize, kBlockSize,
+                   hashes + i * hashtree::kDigestSize);
+        }
+    }
+    auto verifier = android::incfs::HashTreeVerifier::fromSignature(
+            file.file.size, {file.file.signature.data(), file.file.signature.size()});
+    if (!verifier) {
+        return -EINVAL;
+    }
+    if (geometry.depth == 0) {
+        // Nothing to check a file without data against.
+        return file.file.size == 0 ||
+                        memcmp(file.dataHash, verifier->rootHash().data(),
+                               hashtree::kDigestSize) == 0
+                ? 0
+                : -EBADMSG;
+    }
+    // The top block is the one checked against the root hash.
+    const DataBlock top = {
+            .fileFd = file.fd.get(),
+            .pageIndex = 0,
+            .compression = INCFS_COMPRESSION_KIND_NONE,
+            .kind = INCFS_BLOCK_KIND_HASH,
+            .dataSize = kBlockSize,
+            .data = file.tree.data(),
+    };
+    return verifier->addHashBlocks({&top, 1});
+}
+
+Chunk hashBlocksChunk(FileStatePtr file) {
+    Chunk chunk;
+    chunk.blocks.reserve(file->geometry.totalBlocks);
+    for (int i = 0; i < file->geometry.totalBlocks; ++i) {
+        chunk.blocks.push_back({
+                .fileFd = file->fd.get(),
+                .pageIndex = i,
+                .compression = INCFS_COMPRESSION_KIND_NONE,
+                .kind = INCFS_BLOCK_KIND_HASH,
+                .dataSize = kBlockSize,
+                .data = file->tree.data() + IncFsSize(i) * kBlockSize,
+        });
+    }
+    chunk.file = std::move(file);
+    return chunk;
+}
+
+// Turns the chunk's data into blocks, LZ4-compressing the ones that get smaller.
+void prepareBlocks(Chunk* chunk, bool compress) {
+    const auto count = (chunk->data.size() + kBlockSize - 1) / kBlockSize;
+    chunk->blocks.reserve(count);
+    if (compress) {
+        chunk->compressed.resize(count * LZ4_COMPRESSBOUND(kBlockSize));
+    }
+    const auto firstBlock = chunk->offset / kBlockSize;
+    size_t compressedSize = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const auto offset = i * kBlockSize;
+        const auto size = std::min<size_t>(kBlockSize, chunk->data.size() - offset);
+        DataBlock block = {
+                .fileFd = chunk->file->fd.get(),
+                .pageIndex = IncFsBlockIndex(firstBlock + i),
+                .compression = INCFS_COMPRESSION_KIND_NONE,
+                .kind = INCFS_BLOCK_KIND_DATA,
+                .dataSize = uint32_t(size),
+                .data = chunk->data.data() + offset,
+        };
+        if (compress) {
+            auto* out = chunk->compressed.data() + compressedSize;
+            const auto res = LZ4_compress_default(block.data, out, size,
+                                                  chunk->compressed.size() - compressedSize);
+            if (res > 0 && size_t(res) < size) {
+                block.compression = INCFS_COMPRESSION_KIND_LZ4;
+                block.dataSize = res;
+                block.data = out;
+                compressedSize += res;
+            }
+        }
+        chunk->blocks.push_back(block);
+    }
+}
+
+class Run {
+public:
+    Run(const android::incfs::Control& control, InstallSource& source,
+        const InstallPipelineParams& params)
+          : mControl(control),
+            mSource(source),
+            mParams(params),
+            mChunkSize(std::max<IncFsSize>(kBlockSize,
+                                           params.chunkSize / kBlockSize * kBlockSize)),
+            mFilesQueue(params.queueDepth, 1),
+            mHashQueue(params.queueDepth, 1),
+            // Unverified files skip the hashing.
+            mCompressQueue(params.queueDepth, 2),
+            // Hash blocks skip the compression.
+            mWriteQueue(params.queueDepth, 2) {}
+
+    int operator()(const InstallManifest& files);
+    std::vector<InstallStageStats> stats() const {
+        return {mMakeFile.stats(), mFetch.stats(), mHash.stats(), mCompress.stats(),
+                mWrite.stats()};
+    }
+
+private:
+    void fail(int error) {
+        int expected = 0;
+        if (mError.compare_exchange_strong(expected, error)) {
+            mFilesQueue.cancel();
+            mHashQueue.cancel();
+            mCompressQueue.cancel();
+            mWriteQueue.cancel();
+        }
+    }
+
+    template <class T>
+    std::optional<T> pop(BoundedQueue<T>& queue, StageCounters& counters) {
+        ScopedTimer timer(counters.waitingNs);
+        return queue.pop();
+    }
+    template <class T>
+    bool push(BoundedQueue<T>& queue, T&& item, StageCounters& counters) {
+        ScopedTimer timer(counters.waitingNs);
+        return queue.push(std::move(item));
+    }
+
+    void removeFile(const FileState& file);
+    void makeFiles(const InstallManifest& files);
+    void fetch();
+    void hash();
+    void compress();
+    void write();
+
+    const android::incfs::Control& mControl;
+    InstallSource& mSource;
+    const InstallPipelineParams& mParams;
+    const IncFsSize mChunkSize;
+    std::atomic<int> mError = 0;
+
+    BoundedQueue<FileStatePtr> mFilesQueue;
+    BoundedQueue<Chunk> mHashQueue;
+    BoundedQueue<Chunk> mCompressQueue;
+    BoundedQueue<Chunk> mWriteQueue;
+
+    StageCounters mMakeFile{"makeFile"};
+    StageCounters mFetch{"fetch"};
+    StageCounters mHash{"hash"};
+    StageCounters mCompress{"compress"};
+    StageCounters mWrite{"write"};
+};
+
+void Run::makeFiles(const InstallManifest& files) {
+    const auto root = android::incfs::root(mControl);
+    if (root.empty()) {
+        fail(-EINVAL);
+        return;
+    }
+    const auto batchSize = size_t(std::max(1, mParams.makeFileBatch));
+    std::vector<FileStatePtr> batch;
+    std::unordered_set<std::string> knownDirs;
+    std::vector<std::string> newDirs;
+    for (size_t begin = 0; begin < files.size() && !mError; begin += batchSize) {
+        {
+            ScopedTimer timer(mMakeFile.busyNs);
+            const auto end = std::min(files.size(), begin + batchSize);
+            for (auto i = begin; i < end; ++i) {
+                const auto slash = files[i].path.rfind('/');
+                if (slash != std::string::npos &&
+                    knownDirs.insert(files[i].path.substr(0, slash)).second) {
+                    newDirs.push_back(root + '/' + files[i].path.substr(0, slash));
+                }
+            }
+            if (!newDirs.empty()) {
+                const std::vector<std::string_view> dirs(newDirs.begin(), newDirs.end());
+                const auto results = android::incfs::makeDirsAll(mControl, dirs);
+                for (size_t i = 0; i < results.size(); ++i) {
+                    if (results[i]) {
+                        LOG(ERROR) << "Failed to create " << newDirs[i] << ": " << results[i];
+                        return fail(results[i]);
+                    }
+                }
+                newDirs.clear();
+            }
+            for (auto i = begin; i < end; ++i) {
+                auto&& file = files[i];
+                const auto err = android::incfs::makeFile(
+                        mControl, root + '/' + file.path, file.mode, file.id,
+                        {.size = file.size,
+                         .metadata = {file.metadata.data(), IncFsSize(file.metadata.size())},
+                         .signature = {file.signature.data(), IncFsSize(file.signature.size())}});
+                if (err && err != -EEXIST) {
+                    LOG(ERROR) << "Failed to create " << file.path << ": " << err;
+                    return fail(err);
+                }
+                auto fd = android::incfs::openForSpecialOps(mControl, file.id);
+                if (!fd.ok()) {
+                    LOG(ERROR) << "Failed to open " << file.path << ": " << fd.get();
+                    return fail(fd.get());
+                }
+                batch.push_back(std::make_shared<FileState>(file, std::move(fd), err == 0));
+                ++mMakeFile.items;
+            }
+        }
+        for (auto&& file : batch) {
+            if (!push(mFilesQueue, std::move(file), mMakeFile)) {
+                return;
+            }
+        }
+        batch.clear();
+    }
+}
+
+// IncFS only checks the tree when the data is read, so a file whose tree doesn't match the
+// signature gets removed instead, data and all.
+void Run::removeFile(const FileState& file) {
+    if (!file.created) {
+        return;
+    }
+    const auto root = android::incfs::root(mControl);
+    const auto id = android::incfs::toString(file.file.id);
+    for (auto&& path : {root + '/' + file.file.path,
+                        root + '/' + android::incfs::kIndexDir + '/' + id,
+                        root + '/' + android::incfs::kIncompleteDir + '/' + id}) {
+        if (const auto err = android::incfs::unlink(mControl, path); err && err != -ENOENT) {
+            LOG(WARNING) << "Failed to remove " << path << ": " << err;
+        }
+    }
+}
+
+void Run::fetch() {
+    while (auto file = pop(mFilesQueue, mFetch)) {
+        auto& state = **file;
+        const auto size = state.file.size;
+        const auto chunks = int((size + mChunkSize - 1) / mChunkSize);
+        if (state.verified()) {
+            state.tree.resize(hashtree::size(state.geometry));
+            state.chunksToHash = chunks;
+            if (chunks == 0) {
+                // Still needs the signature checked.
+                if (const auto err = finishTree(state)) {
+                    fail(err);
+                    return removeFile(state);
+                }
+            }
+        }
+        for (IncFsSize offset = 0; offset < size; offset += mChunkSize) {
+            Chunk chunk{.file = *file, .offset = offset};
+            {
+                ScopedTimer timer(mFetch.busyNs);
+                chunk.data.resize(std::min(mChunkSize, size - offset));
+                if (const auto err =
+                            mSource.read(state.file, offset,
+                                         {chunk.data.data(), chunk.data.size()})) {
+                    LOG(ERROR) << "Failed to fetch " << state.file.path << " at " << offset
+                               << ": " << err;
+                    return fail(err);
+                }
+            }
+            ++mFetch.items;
+            mFetch.bytes += chunk.data.size();
+            if (!push(state.verified() ? mHashQueue : mCompressQueue, std::move(chunk), mFetch)) {
+                return;
+            }
+        }
+    }
+}
+
+void Run::hash() {
+    while (auto chunk = pop(mHashQueue, mHash)) {
+        auto file = chunk->file;
+        {
+            ScopedTimer timer(mHash.busyNs);
+            hashChunk(*chunk);
+        }
+        ++mHash.items;
+        mHash.bytes += chunk->data.size();
+        // The data goes on right away, so only the queues bound the memory in use.
+        if (!push(mCompressQueue, std::move(*chunk), mHash)) {
+            return;
+        }
+        if (--file->chunksToHash != 0) {
+            continue;
+        }
+        {
+            ScopedTimer timer(mHash.busyNs);
+            if (const auto err = finishTree(*file)) {
+                LOG(ERROR) << "Hash tree of " << file->file.path
+                           << " doesn't match its signature: " << err;
+                // Cancels the queues first, so no more of its data gets written after this.
+                fail(err);
+                return removeFile(*file);
+            }
+        }
+        // The hash blocks go last, once the whole tree is known.
+        if (file->geometry.totalBlocks > 0 &&
+            !push(mWriteQueue, hashBlocksChunk(std::move(file)), mHash)) {
+            return;
+        }
+    }
+}
+
+void Run::compress() {
+    while (auto chunk = pop(mCompressQueue, mCompress)) {
+        {
+            ScopedTimer timer(mCompress.busyNs);
+            prepareBlocks(&*chunk, mParams.compress);
+        }
+        ++mCompress.items;
+        mCompress.bytes += chunk->data.size();
+        if (!push(mWriteQueue, std::move(*chunk), mCompress)) {
+            return;
+        }
+    }
+}
+
+void Run::write() {
+    while (auto chunk = pop(mWriteQueue, mWrite)) {
+        ScopedTimer timer(mWrite.busyNs);
+        const auto written = android::incfs::writeBlocks(chunk->blocks);
+        if (written < 0 || size_t(written) != chunk->blocks.size()) {
+            LOG(ERROR) << "Failed to write " << chunk->file->file.path << " at block "
+                       << chunk->blocks.front().pageIndex << ": " << written;
+            return fail(written < 0 ? written : -EIO);
+        }
+        ++mWrite.items;
+        for (auto&& block : chunk->blocks) {
+            mWrite.bytes += block.dataSize;
+        }
+    }
+}
+
+int Run::operator()(const InstallManifest& files) {
+    const auto cores = int(std::max(1u, std::thread::hardware_concurrency()));
+    const auto threadsFor = [cores](int threads) { return threads > 0 ? threads : cores; };
+
+    std::vector<std::thread> pool;
+    // Starts the stage's workers; the last one to finish closes the stage's output queues.
+    const auto startStage = [&](int threads, void (Run::*body)(),
+                                std::vector<BoundedQueue<Chunk>*> outputs) {
+        auto running = std::make_shared<std::atomic<int>>(threads);
+        for (int i = 0; i < threads; ++i) {
+            pool.emplace_back([this, body, outputs, running] {
+                (this->*body)();
+                if (--*running == 0) {
+                    for (auto queue : outputs) {
+                        queue->producerDone();
+                    }
+                }
+            });
+        }
+    };
+    startStage(mSource.sequential() ? 1 : threadsFor(mParams.fetchThreads), &Run::fetch,
+               {&mHashQueue, &mCompressQueue});
+    startStage(threadsFor(mParams.hashThreads), &Run::hash, {&mCompressQueue, &mWriteQueue});
+    startStage(threadsFor(mParams.compressThreads), &Run::compress, {&mWriteQueue});
+    startStage(threadsFor(mParams.writeThreads), &Run::write, {});
+
+    makeFiles(files);
+    mFilesQueue.producerDone();
+    for (auto&& thread : pool) {
+        thread.join();
+    }
+    return mError;
+}
+
+} // namespace
+
+InstallPipeline::InstallPipeline(const android::incfs::Control& control, InstallSource& source,
+                                 InstallPipelineParams params)
+      : mControl(control), mSource(source), mParams(params) {}
+
+int InstallPipeline::run(const InstallManifest& files) {
+    const auto start = Clock::now();
+    Run run(mControl, mSource, mParams);
+    const auto res = run(files);
+    mStats = run.stats();
+    mElapsed = Clock::now() - start;
+    for (auto&& stage : mStats) {
+        LOG(DEBUG) << "Install stage " << stage.name << ": " << stage.items << " items, "
+                   << stage.bytes << " bytes, busy " << stage.busy.count() / 1000000
+                   << "ms, waiting " << stage.waiting.count() / 1000000 << "ms";
+    }
+    return res;
+}
+
+} // namespace android::dataloader
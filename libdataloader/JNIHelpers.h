@@ -18,6 +18,8 @@
 #include <jni.h>
 #include <log/log.h>
 
+#include <string>
+
 // JNI helpers.
 static inline jclass FindClassOrDie(JNIEnv* env, const char* class_name) {
     jclass clazz = env->FindClass(class_name);
@@ -59,6 +61,24 @@ static inline jint GetStaticIntFieldValueOrDie(JNIEnv* env, jclass clazz, const
     return env->GetStaticIntField(clazz, res);
 }
 
+// Copies the modified UTF-8 of |str| straight into |out|, which has to have room for
+// GetStringUTFLength() + 1 bytes. Returns the length written, not counting the final '\0'.
+static inline jsize GetStringUTFInto(JNIEnv* env, jstring str, char* out) {
+    const auto length = env->GetStringUTFLength(str);
+    env->GetStringUTFRegion(str, 0, env->GetStringLength(str), out);
+    out[length] = '\0';
+    return length;
+}
+
+static inline std::string GetStringUTF(JNIEnv* env, jstring str) {
+    if (!str) {
+        return {};
+    }
+    std::string result(env->GetStringUTFLength(str), '\0');
+    GetStringUTFInto(env, str, result.data());
+    return result;
+}
+
 static inline JNIEnv* GetJNIEnvironment(JavaVM* vm) {
     JNIEnv* env;
     if (vm->GetEnv(reinterpret_cast<void**>(&env), JNI_VERSION_1_6) != JNI_OK) {
@@ -0,0 +1,181 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#define LOG_TAG "incfs-dataloader-deadlines"
+
+#include "ReadDeadlines.h"
+
+#include <time.h>
+
+#include <algorithm>
+
+namespace android::dataloader {
+
+// Pending read timestamps come from CLOCK_BOOTTIME.
+static uint64_t bootClockNowUs() {
+    timespec ts;
+    ::clock_gettime(CLOCK_BOOTTIME, &ts);
+    return uint64_t(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+void ReadDeadlineTracker::setParams(DataLoaderReadDeadlineParams params) {
+    const uint64_t timeoutUs = std::max(0, params.readTimeoutMs) * 1000ull;
+
+    std::lock_guard lock(mLock);
+    mTimeoutUs = timeoutUs;
+    mHedgeAfterUs = timeoutUs * std::clamp(params.hedgePercent, 0, 100) / 100;
+    mNearMissUs = timeoutUs * std::clamp(params.nearMissPercent, 0, 100) / 100;
+    clearLocked();
+    mStats = {};
+}
+
+bool ReadDeadlineTracker::enabled() const {
+    std::lock_guard lock(mLock);
+    return mTimeoutUs > 0;
+}
+
+bool ReadDeadlineTracker::tracking() const {
+    std::lock_guard lock(mLock);
+    return !mByDeadline.empty();
+}
+
+void ReadDeadlineTracker::clear() {
+    std::lock_guard lock(mLock);
+    clearLocked();
+}
+
+void ReadDeadlineTracker::clearLocked() {
+    mReadsByBlock.clear();
+    mByDeadline.clear();
+    mToHedge.clear();
+}
+
+void ReadDeadlineTracker::onPendingReads(std::vector<ReadInfo>& reads) {
+    const auto now = bootClockNowUs();
+    {
+        std::lock_guard lock(mLock);
+        if (!mTimeoutUs) {
+            return;
+        }
+        for (auto&& read : reads) {
+            if (mByDeadline.size() >= kMaxTrackedReads) {
+                break;
+            }
+            auto& blocks = mReadsByBlock[read.id];
+            if (blocks.count(read.block)) {
+                continue;
+            }
+            // A timestamp from the future can't be right, assume the read has just started.
+            const Key key{std::min(read.bootClockTsUs, now) + mTimeoutUs, read.serialNo};
+            blocks.emplace(read.block, key);
+            mByDeadline.emplace(key, read);
+            if (mHedgeAfterUs) {
+                mToHedge.insert(key);
+            }
+            ++mStats.reads;
+        }
+    }
+    // All reads get the same timeout, so the earliest started one is the earliest to expire.
+    std::stable_sort(reads.begin(), reads.end(), [](const ReadInfo& l, const ReadInfo& r) {
+        return l.bootClockTsUs < r.bootClockTsUs;
+    });
+}
+
+void ReadDeadlineTracker::onBlocksWritten(DataBlocks blocks, Span<const FdFile> files) {
+    const auto now = bootClockNowUs();
+    std::lock_guard lock(mLock);
+    for (size_t i = 0; i < blocks.size() && !mByDeadline.empty(); ++i) {
+        if (blocks[i].kind != INCFS_BLOCK_KIND_DATA) {
+            continue;
+        }
+        const auto fileIt = mReadsByBlock.find(files[i].id);
+        if (fileIt == mReadsByBlock.end()) {
+            continue;
+        }
+        const auto blockIt = fileIt->second.find(blocks[i].pageIndex);
+        if (blockIt == fileIt->second.end()) {
+            continue;
+        }
+        const auto key = blockIt->second;
+        const auto deadline = key.first;
+        forgetLocked(key);
+        if (deadline <= now) {
+            // Too late, the app has already got its EIO.
+            ++mStats.timeouts;
+            continue;
+        }
+        ++mStats.satisfied;
+        if (deadline - now < mNearMissUs) {
+            ++mStats.nearMisses;
+        }
+    }
+}
+
+int ReadDeadlineTracker::onDeadlines(std::vector<ReadInfo>& hedged) {
+    const auto now = bootClockNowUs();
+    std::lock_guard lock(mLock);
+    int timedOut = 0;
+    while (!mByDeadline.empty() && mByDeadline.begin()->first.first <= now) {
+        const auto key = mByDeadline.begin()->first;
+        forgetLocked(key);
+        ++timedOut;
+    }
+    mStats.timeouts += timedOut;
+
+    // Crossed the threshold if less than (timeout - hedge delay) is left.
+    const auto hedgeUpTo = now + (mTimeoutUs - mHedgeAfterUs);
+    while (!mToHedge.empty() && mToHedge.begin()->first <= hedgeUpTo) {
+        hedged.push_back(mByDeadline.at(*mToHedge.begin()));
+        mToHedge.erase(mToHedge.begin());
+        ++mStats.hedged;
+    }
+    return timedOut;
+}
+
+std::optional<std::chrono::microseconds> ReadDeadlineTracker::nextDeadline() const {
+    std::lock_guard lock(mLock);
+    if (mByDeadline.empty()) {
+        return {};
+    }
+    auto next = mByDeadline.begin()->first.first;
+    if (!mToHedge.empty()) {
+        next = std::min(next, mToHedge.begin()->first - (mTimeoutUs - mHedgeAfterUs));
+    }
+    const auto now = bootClockNowUs();
+    return std::chrono::microseconds(next > now ? next - now : 0);
+}
+
+DataLoaderReadDeadlineStats ReadDeadlineTracker::stats() const {
+    std::lock_guard lock(mLock);
+    return mStats;
+}
+
+void ReadDeadlineTracker::forgetLocked(const Key& key) {
+    const auto it = mByDeadline.find(key);
+    if (it == mByDeadline.end()) {
+        return;
+    }
+    const auto fileIt = mReadsByBlock.find(it->second.id);
+    if (fileIt != mReadsByBlock.end()) {
+        fileIt->second.erase(it->second.block);
+        if (fileIt->second.empty()) {
+            mReadsByBlock.erase(fileIt);
+        }
+    }
+    mToHedge.erase(key);
+    mByDeadline.erase(it);
+}
+
+} // namespace android::dataloader
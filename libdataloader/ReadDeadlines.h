@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <dataloader.h>
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "FileIds.h"
+
+namespace android::dataloader {
+
+//
+// ReadDeadlineTracker - follows the pending reads of a storage until their blocks get written,
+//      ordered by their deadlines. Reads that cross the hedge threshold are handed back for
+//      another delivery; the ones that got their data with little time left and the ones that
+//      never got it are counted.
+//
+class ReadDeadlineTracker final {
+public:
+    // Keeps the bookkeeping bounded if the loader never writes anything.
+    static constexpr size_t kMaxTrackedReads = 4096;
+
+    ReadDeadlineTracker() = default;
+
+    ReadDeadlineTracker(const ReadDeadlineTracker&) = delete;
+    ReadDeadlineTracker& operator=(const ReadDeadlineTracker&) = delete;
+
+    // Changing the parameters forgets the tracked reads and resets the stats.
+    void setParams(DataLoaderReadDeadlineParams params);
+    bool enabled() const;
+    // Whether there are any reads waiting for their blocks.
+    bool tracking() const;
+    // Forgets the tracked reads, e.g. when the loader stops; keeps the stats.
+    void clear();
+
+    // Starts tracking the new reads, and sorts |reads| by their deadlines, earliest first.
+    void onPendingReads(std::vector<ReadInfo>& reads);
+    // Stops tracking the reads satisfied by |blocks|; |files| has the file of each block, see
+    // FileIdCache::resolve().
+    void onBlocksWritten(DataBlocks blocks, Span<const FdFile> files);
+    // Puts the reads that crossed the hedge threshold into |hedged|, earliest deadline first,
+    // and drops the expired ones. Returns the number of reads that timed out.
+    int onDeadlines(std::vector<ReadInfo>& hedged);
+    // Time left until onDeadlines() has something to do, if anything is tracked.
+    std::optional<std::chrono::microseconds> nextDeadline() const;
+
+    DataLoaderReadDeadlineStats stats() const;
+
+private:
+    // (deadline, serial number): unique for every read, and sorted the way they need servicing.
+    using Key = std::pair<uint64_t, uint32_t>;
+
+    void forgetLocked(const Key& key);
+    void clearLocked();
+
+    mutable std::mutex mLock;
+    uint64_t mTimeoutUs = 0;
+    uint64_t mHedgeAfterUs = 0;
+    uint64_t mNearMissUs = 0;
+    std::unordered_map<FileId, std::unordered_map<IncFsBlockIndex, Key>> mReadsByBlock;
+    std::map<Key, ReadInfo> mByDeadline;
+    std::set<Key> mToHedge;
+    DataLoaderReadDeadlineStats mStats = {};
+};
+
+} // namespace android::dataloader
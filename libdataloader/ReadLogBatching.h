@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+
+namespace android::dataloader {
+
+// Decides how long the log looper leaves the read log alone after each wakeup. Small batches
+// mean a wakeup for every few page reads, so the delay grows; large ones mean the kernel
+// buffer fills up quickly, so it shrinks. A quiet log still gets delivered within kMaxDelay.
+class ReadLogBatching {
+public:
+    using Delay = std::chrono::milliseconds;
+
+    static constexpr size_t kTargetBatch = 64;
+    static constexpr Delay kMinDelay = Delay(1);
+    static constexpr Delay kMaxDelay = Delay(50);
+
+    Delay onWakeup(size_t records) {
+        if (records >= kTargetBatch) {
+            mDelay = mDelay / 2 < kMinDelay ? Delay::zero() : mDelay / 2;
+        } else {
+            mDelay = std::min(mMaxDelay, std::max(kMinDelay, mDelay * 2));
+        }
+        return mDelay;
+    }
+    // The log overflowed while waiting: wait at most half as long from now on, down to reading
+    // on every wakeup.
+    void onDroppedRecords() {
+        mMaxDelay = mMaxDelay / 2 < kMinDelay ? Delay::zero() : mMaxDelay / 2;
+        mDelay = std::min(mDelay, mMaxDelay);
+    }
+    void reset() {
+        mDelay = Delay::zero();
+        mMaxDelay = kMaxDelay;
+    }
+
+private:
+    Delay mDelay = Delay::zero();
+    Delay mMaxDelay = kMaxDelay;
+};
+
+} // namespace android::dataloader
@@ -0,0 +1,341 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#define LOG_TAG "incfs-dataloader-coalescer"
+
+#include "WriteCoalescer.h"
+
+#include <android-base/logging.h>
+#include <fcntl.h>
+
+#include <algorithm>
+
+namespace android::dataloader {
+
+// Don't keep more than this many free buffers around after the flushes.
+static constexpr auto kMaxPooledBuffers = 16;
+// Or more than this many fd copies.
+static constexpr auto kMaxSpareFds = 64;
+// Nobody waits for a read for longer than the kernel timeout, forget such old reads.
+static constexpr auto kMaxPendingReads = 4096;
+static constexpr uint64_t kPendingReadLifetimeUs =
+        std::chrono::microseconds(android::incfs::kDefaultReadTimeout).count();
+
+static size_t dataSize(DataBlocks blocks) {
+    size_t size = 0;
+    for (auto&& block : blocks) {
+        size += block.dataSize;
+    }
+    return size;
+}
+
+WriteCoalescer::~WriteCoalescer() {
+    flush();
+}
+
+void WriteCoalescer::setParams(DataLoaderWriteCoalescingParams params) {
+    FileBuffers buffers;
+    {
+        std::lock_guard lock(mLock);
+        mMaxBufferedBytes = std::max(0, params.maxBufferedBytes);
+        mMaxDelay = std::chrono::milliseconds(std::max(0, params.maxDelayMs));
+        buffers = extractAllLocked();
+        if (!mMaxBufferedBytes) {
+            mPendingBlocks.clear();
+            mPendingOrder.clear();
+            mPool.clear();
+            mSpareFds.clear();
+        }
+    }
+    submitAll(std::move(buffers));
+}
+
+bool WriteCoalescer::enabled() const {
+    std::lock_guard lock(mLock);
+    return mMaxBufferedBytes > 0;
+}
+
+int WriteCoalescer::write(DataBlocks blocks, Span<const FdFile> files) {
+    int accepted = 0;
+    for (auto begin = blocks.begin(); begin != blocks.end();) {
+        const auto fd = begin->fileFd;
+        const auto end = std::find_if(begin, blocks.end(),
+                                      [fd](const DataBlock& block) { return block.fileFd != fd; });
+        const auto run = DataBlocks(begin, end - begin);
+        const auto res = writeFile(fd, files[begin - blocks.begin()], run);
+        if (res < 0) {
+            return accepted ? accepted : res;
+        }
+        accepted += res;
+        if (size_t(res) != run.size()) {
+            break;
+        }
+        begin = end;
+    }
+    return accepted;
+}
+
+int WriteCoalescer::writeFile(int fd, const FdFile& file, DataBlocks blocks) {
+    const auto id = file.id;
+    if (!android::incfs::isValidFileId(id)) {
+        // Can't match it to the pending reads or to the other writes, so just pass it through.
+        return android::incfs::writeBlocks(blocks);
+    }
+
+    std::unique_lock lock(mLock);
+    if (!mMaxBufferedBytes) {
+        lock.unlock();
+        return android::incfs::writeBlocks(blocks);
+    }
+    if (takePendingLocked(id, blocks) || dataSize(blocks) >= mMaxBufferedBytes) {
+        // Either someone is waiting for this data, or it's big enough on its own: send it out
+        // right away, together with whatever got buffered for the same file before.
+        auto buffer = extractLocked(id);
+        lock.unlock();
+        return submit(std::move(buffer), fd, blocks);
+    }
+
+    auto [it, inserted] = mFiles.try_emplace(id);
+    auto& buffer = it->second;
+    if (inserted) {
+        buffer.id = id;
+        buffer.ino = file.ino;
+        buffer.fd = takeFdLocked(fd, file);
+        if (!buffer.fd.ok()) {
+            PLOG(WARNING) << "failed to dup fd " << fd << " for the write buffer";
+            mFiles.erase(it);
+            lock.unlock();
+            return android::incfs::writeBlocks(blocks);
+        }
+        if (!mPool.empty()) {
+            buffer.data = std::move(mPool.back());
+            mPool.pop_back();
+        }
+        buffer.deadline = Clock::now() + mMaxDelay;
+    }
+    bufferLocked(buffer, blocks);
+    if (mBufferedBytes >= mMaxBufferedBytes) {
+        auto buffers = extractAllLocked();
+        lock.unlock();
+        submitAll(std::move(buffers));
+    }
+    return blocks.size();
+}
+
+android::incfs::UniqueFd WriteCoalescer::takeFdLocked(int fd, const FdFile& file) {
+    const auto it = mSpareFds.find(file.id);
+    if (it != mSpareFds.end()) {
+        auto spare = std::move(it->second);
+        mSpareFds.erase(it);
+        if (spare.ino == file.ino) {
+            return std::move(spare.fd);
+        }
+    }
+    // The loader is free to close its fd after the call, so keep our own copy. It goes back to
+    // mSpareFds after the flush, so a file only gets dup()ed once.
+    return android::incfs::UniqueFd(::fcntl(fd, F_DUPFD_CLOEXEC, 0));
+}
+
+void WriteCoalescer::bufferLocked(FileBuffer& buffer, DataBlocks blocks) {
+    for (auto block : blocks) {
+        const auto offset = buffer.data.size();
+        buffer.data.insert(buffer.data.end(), block.data, block.data + block.dataSize);
+        block.data = (const char*)offset;
+        buffer.blocks.push_back(block);
+        mBufferedBytes += block.dataSize;
+    }
+}
+
+int WriteCoalescer::flush() {
+    FileBuffers buffers;
+    {
+        std::lock_guard lock(mLock);
+        buffers = extractAllLocked();
+    }
+    submitAll(std::move(buffers));
+
+    std::lock_guard lock(mLock);
+    return std::exchange(mLastError, 0);
+}
+
+void WriteCoalescer::flushExpired() {
+    FileBuffers buffers;
+    {
+        std::lock_guard lock(mLock);
+        const auto now = Clock::now();
+        for (auto it = mFiles.begin(); it != mFiles.end();) {
+            if (it->second.deadline > now) {
+                ++it;
+                continue;
+            }
+            mBufferedBytes -= dataSize({it->second.blocks.data(), it->second.blocks.size()});
+            buffers.push_back(std::move(it->second));
+            it = mFiles.erase(it);
+        }
+    }
+    submitAll(std::move(buffers));
+}
+
+auto WriteCoalescer::nextDeadline() const -> std::optional<Clock::time_point> {
+    std::lock_guard lock(mLock);
+    std::optional<Clock::time_point> result;
+    for (auto&& [_, buffer] : mFiles) {
+        if (!result || buffer.deadline < *result) {
+            result = buffer.deadline;
+        }
+    }
+    return result;
+}
+
+void WriteCoalescer::onPendingReads(PendingReads pendingReads) {
+    FileBuffers buffers;
+    {
+        std::lock_guard lock(mLock);
+        if (!mMaxBufferedBytes) {
+            return;
+        }
+        for (auto&& read : pendingReads) {
+            const auto it = mFiles.find(read.id);
+            if (it == mFiles.end()) {
+                addPendingLocked(read);
+                continue;
+            }
+            const auto& blocks = it->second.blocks;
+            if (std::none_of(blocks.begin(), blocks.end(), [&read](const DataBlock& block) {
+                    return block.kind == INCFS_BLOCK_KIND_DATA && block.pageIndex == read.block;
+                })) {
+                addPendingLocked(read);
+                continue;
+            }
+            buffers.push_back(extractLocked(read.id));
+        }
+    }
+    submitAll(std::move(buffers));
+}
+
+bool WriteCoalescer::takePendingLocked(FileId id, DataBlocks blocks) {
+    const auto it = mPendingBlocks.find(id);
+    if (it == mPendingBlocks.end()) {
+        return false;
+    }
+    bool found = false;
+    for (auto&& block : blocks) {
+        if (block.kind == INCFS_BLOCK_KIND_DATA && it->second.erase(block.pageIndex)) {
+            found = true;
+        }
+    }
+    if (it->second.empty()) {
+        mPendingBlocks.erase(it);
+    }
+    return found;
+}
+
+void WriteCoalescer::addPendingLocked(const ReadInfo& read) {
+    const auto forget = [this](const PendingRead& old) {
+        const auto it = mPendingBlocks.find(old.id);
+        if (it != mPendingBlocks.end()) {
+            it->second.erase(old.block);
+            if (it->second.empty()) {
+                mPendingBlocks.erase(it);
+            }
+        }
+    };
+    while (!mPendingOrder.empty() &&
+           (mPendingOrder.size() >= kMaxPendingReads ||
+            mPendingOrder.front().bootClockTsUs + kPendingReadLifetimeUs < read.bootClockTsUs)) {
+        forget(mPendingOrder.front());
+        mPendingOrder.pop_front();
+    }
+    if (mPendingBlocks[read.id].insert(read.block).second) {
+        mPendingOrder.push_back({read.id, read.block, read.bootClockTsUs});
+    }
+}
+
+auto WriteCoalescer::extractLocked(FileId id) -> FileBuffer {
+    const auto it = mFiles.find(id);
+    if (it == mFiles.end()) {
+        return {};
+    }
+    auto buffer = std::move(it->second);
+    mFiles.erase(it);
+    mBufferedBytes -= dataSize({buffer.blocks.data(), buffer.blocks.size()});
+    return buffer;
+}
+
+auto WriteCoalescer::extractAllLocked() -> FileBuffers {
+    FileBuffers buffers;
+    buffers.reserve(mFiles.size());
+    for (auto&& [_, buffer] : mFiles) {
+        buffers.push_back(std::move(buffer));
+    }
+    mFiles.clear();
+    mBufferedBytes = 0;
+    return buffers;
+}
+
+int WriteCoalescer::submit(FileBuffer&& buffer, int fd, DataBlocks urgentBlocks) {
+    // The urgent blocks go first so a pending read gets unblocked as soon as possible. Use the
+    // same fd for everything to end up with a single ioctl() per file.
+    std::vector<DataBlock> blocks;
+    blocks.reserve(urgentBlocks.size() + buffer.blocks.size());
+    blocks.insert(blocks.end(), urgentBlocks.begin(), urgentBlocks.end());
+    for (auto block : buffer.blocks) {
+        block.fileFd = fd;
+        block.data = buffer.data.data() + (uintptr_t)block.data;
+        blocks.push_back(block);
+    }
+    const auto res = android::incfs::writeBlocks({blocks.data(), blocks.size()});
+
+    std::lock_guard lock(mLock);
+    if (res < 0 || size_t(res) < blocks.size()) {
+        LOG(WARNING) << "coalesced write of " << blocks.size() << " blocks to fd " << fd
+                     << " returned " << res;
+        if (!buffer.blocks.empty()) {
+            mLastError = res < 0 ? res : -EIO;
+        }
+    }
+    recycleLocked(std::move(buffer));
+    if (res < 0) {
+        return res;
+    }
+    return std::min<int>(res, urgentBlocks.size());
+}
+
+void WriteCoalescer::submitAll(FileBuffers&& buffers) {
+    for (auto&& buffer : buffers) {
+        const auto fd = buffer.fd.get();
+        submit(std::move(buffer), fd, {nullptr, 0});
+    }
+}
+
+void WriteCoalescer::recycleLocked(FileBuffer&& buffer) {
+    if (!mMaxBufferedBytes) {
+        return;
+    }
+    if (buffer.fd.ok()) {
+        if (mSpareFds.size() >= kMaxSpareFds && !mSpareFds.count(buffer.id)) {
+            mSpareFds.erase(mSpareFds.begin());
+        }
+        mSpareFds.insert_or_assign(buffer.id, SpareFd{buffer.ino, std::move(buffer.fd)});
+    }
+    auto& data = buffer.data;
+    if (data.capacity() == 0 || mPool.size() >= kMaxPooledBuffers) {
+        return;
+    }
+    data.clear();
+    mPool.push_back(std::move(data));
+}
+
+} // namespace android::dataloader
@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <dataloader.h>
+
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "FileIds.h"
+
+namespace android::dataloader {
+
+//
+// WriteCoalescer - accumulates small writeBlocks() batches per file and submits them to IncFS
+//      in bigger chunks: once the buffered size crosses a threshold, when the oldest buffered
+//      block gets too old, or right away if a block satisfies an outstanding pending read.
+//
+class WriteCoalescer final {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    WriteCoalescer() = default;
+    ~WriteCoalescer();
+
+    WriteCoalescer(const WriteCoalescer&) = delete;
+    WriteCoalescer& operator=(const WriteCoalescer&) = delete;
+
+    // Changing the parameters flushes everything buffered so far.
+    void setParams(DataLoaderWriteCoalescingParams params);
+    bool enabled() const;
+
+    // |files| has the file of each block, see FileIdCache::resolve().
+    // Returns the number of accepted blocks (written or buffered), or -errno.
+    int write(DataBlocks blocks, Span<const FdFile> files);
+    // Writes out everything that's buffered. Returns 0 or the last deferred write error.
+    int flush();
+    // Writes out the files that stayed in the buffer for longer than allowed.
+    void flushExpired();
+    // When the earliest buffered file has to be written out, if there's anything buffered.
+    std::optional<Clock::time_point> nextDeadline() const;
+
+    // Remembers the reads the kernel is waiting for, so blocks satisfying them skip the buffer.
+    // Flushes the files that already have such blocks buffered.
+    void onPendingReads(PendingReads pendingReads);
+
+private:
+    struct FileBuffer {
+        FileId id = kIncFsInvalidFileId;
+        ino_t ino = 0;
+        android::incfs::UniqueFd fd;
+        std::vector<char> data;
+        std::vector<DataBlock> blocks; // |data| field is an offset into |data| until the flush
+        Clock::time_point deadline;
+    };
+    using FileBuffers = std::vector<FileBuffer>;
+
+    // Our copy of a loader's fd, kept between the flushes.
+    struct SpareFd {
+        ino_t ino;
+        android::incfs::UniqueFd fd;
+    };
+
+    struct PendingRead {
+        FileId id;
+        IncFsBlockIndex block;
+        uint64_t bootClockTsUs;
+    };
+
+    int writeFile(int fd, const FdFile& file, DataBlocks blocks);
+    android::incfs::UniqueFd takeFdLocked(int fd, const FdFile& file);
+    void bufferLocked(FileBuffer& buffer, DataBlocks blocks);
+    bool takePendingLocked(FileId id, DataBlocks blocks);
+    void addPendingLocked(const ReadInfo& read);
+    FileBuffer extractLocked(FileId id);
+    FileBuffers extractAllLocked();
+    int submit(FileBuffer&& buffer, int fd, DataBlocks urgentBlocks);
+    void submitAll(FileBuffers&& buffers);
+    void recycleLocked(FileBuffer&& buffer);
+
+    mutable std::mutex mLock;
+    size_t mMaxBufferedBytes = 0;
+    std::chrono::milliseconds mMaxDelay{};
+    size_t mBufferedBytes = 0;
+    std::unordered_map<FileId, FileBuffer> mFiles;
+    std::vector<std::vector<char>> mPool;
+    std::unordered_map<FileId, SpareFd> mSpareFds;
+    std::unordered_map<FileId, std::unordered_set<IncFsBlockIndex>> mPendingBlocks;
+    std::deque<PendingRead> mPendingOrder;
+    int mLastError = 0;
+};
+
+} // namespace android::dataloader
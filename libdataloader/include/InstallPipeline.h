@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "dataloader.h"
+
+namespace android::dataloader {
+
+struct InstallFile {
+    std::string path; // relative to the mount root
+    FileId id;
+    IncFsSize size = 0;
+    int mode = 0555;
+    RawMetadata metadata;
+    // Optional. For verified files the pipeline builds the hash tree while the data is being
+    // written, and checks it against the signature's root hash once the whole file is hashed.
+    // The hash blocks are written only then; a file that doesn't match is removed, if the run
+    // created it.
+    std::vector<char> signature;
+};
+using InstallManifest = std::vector<InstallFile>;
+
+// Where the install pipeline gets the files' data from.
+struct InstallSource {
+    virtual ~InstallSource() = default;
+
+    // Sources that can only be read front to back get a single fetching thread, and are read
+    // in the manifest order.
+    virtual bool sequential() const { return false; }
+    // Fills the whole |buffer| with the file data starting at |offset|. Each file is read
+    // front to back by a single thread. Returns 0 or -errno.
+    virtual int read(const InstallFile& file, IncFsSize offset, Span<char> buffer) = 0;
+};
+
+// Reads the files by their manifest paths from a local directory. Each file stays open from
+// its first chunk until the last one.
+class LocalFileSource final : public InstallSource {
+public:
+    explicit LocalFileSource(std::string dir) : mDir(std::move(dir)) {}
+    int read(const InstallFile& file, IncFsSize offset, Span<char> buffer) final;
+
+private:
+    const std::string mDir;
+    std::mutex mLock;
+    std::unordered_map<const InstallFile*, android::incfs::UniqueFd> mFds;
+};
+
+// Reads the data of all files concatenated in the manifest order, e.g. from a pipe or a socket.
+class PipeSource final : public InstallSource {
+public:
+    explicit PipeSource(android::incfs::UniqueFd fd) : mFd(std::move(fd)) {}
+    bool sequential() const final { return true; }
+    int read(const InstallFile& file, IncFsSize offset, Span<char> buffer) final;
+
+private:
+    const android::incfs::UniqueFd mFd;
+};
+
+struct InstallPipelineParams {
+    // Files get created in batches of this size before their data is fetched: all parent
+    // directories of a batch with a single makeDirsAll() call, then one IncFS create per file,
+    // as there's no batched create.
+    int makeFileBatch = 64;
+    // Threads per stage; 0 means one per core.
+    int fetchThreads = 2;
+    int hashThreads = 0;
+    int compressThreads = 0;
+    int writeThreads = 2;
+    // Chunks in flight between any two stages.
+    int queueDepth = 32;
+    // Size of a chunk flowing through the pipeline, rounded down to the block size.
+    IncFsSize chunkSize = 1024 * 1024;
+    bool compress = true;
+};
+
+struct InstallStageStats {
+    const char* name = nullptr;
+    uint64_t items = 0;
+    uint64_t bytes = 0;
+    std::chrono::nanoseconds busy{};
+    // Time spent blocked on the stage's input or output queue.
+    std::chrono::nanoseconds waiting{};
+};
+
+//
+// InstallPipeline - installs a whole manifest of files into an IncFS mount. The files flow
+// through bounded queues between the stages: makeFile -> fetch -> hash -> compress -> write,
+// each stage running on its own threads. A full queue makes the stages before it wait.
+//
+// Files that already exist in the mount are filled in as-is.
+//
+class InstallPipeline final {
+public:
+    InstallPipeline(const android::incfs::Control& control, InstallSource& source,
+                    InstallPipelineParams params = {});
+
+    // Returns 0 or the first error; the rest of the work is cancelled after an error.
+    int run(const InstallManifest& files);
+
+    // For the last run.
+    const std::vector<InstallStageStats>& stats() const { return mStats; }
+    std::chrono::nanoseconds elapsed() const { return mElapsed; }
+
+private:
+    const android::incfs::Control& mControl;
+    InstallSource& mSource;
+    const InstallPipelineParams mParams;
+    std::vector<InstallStageStats> mStats;
+    std::chrono::nanoseconds mElapsed{};
+};
+
+} // namespace android::dataloader
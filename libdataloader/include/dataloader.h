@@ -50,6 +50,8 @@ using PendingReads = Span<const ReadInfo>;
 using PageReads = Span<const ReadInfo>;
 using RawMetadata = std::vector<char>;
 using DataBlocks = Span<const DataBlock>;
+// Puts the whole hash tree of the file into the span, returns 0 or -errno.
+using HashTreeSource = std::function<int(FileId, Span<char> tree)>;
 
 constexpr int kBlockSize = INCFS_DATA_FILE_BLOCK_SIZE;
 
@@ -68,6 +70,8 @@ struct DataLoader {
 
     // FS callbacks.
     virtual bool onPrepareImage(DataLoaderInstallationFiles addedFiles) = 0;
+    // Chunks of the added files, ahead of onPrepareImage(); see setPrepareImageStreaming().
+    virtual void onPrepareImageFiles(DataLoaderInstallationFiles addedFiles) {}
 
     // IFS callbacks.
     virtual void onPendingReads(PendingReads pendingReads) = 0;
@@ -111,6 +115,13 @@ struct FilesystemConnector : public DataLoaderFilesystemConnector {
     int writeBlocks(DataBlocks blocks);
     RawMetadata getRawMetadata(FileId fid);
     bool setParams(DataLoaderFilesystemParams);
+    bool setWriteCoalescing(DataLoaderWriteCoalescingParams);
+    bool setReadDeadlines(DataLoaderReadDeadlineParams);
+    DataLoaderReadDeadlineStats readDeadlineStats();
+    // Streams the added files into |loader|->onPrepareImageFiles(); 0 |chunkSize| disables it.
+    bool setPrepareImageStreaming(int chunkSize, DataLoader* loader);
+    int flushBlocks();
+    int prefillHashTrees(Span<const FileId> files, const HashTreeSource& source);
 };
 
 struct StatusListener : public DataLoaderStatusListener {
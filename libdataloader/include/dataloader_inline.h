@@ -136,6 +136,47 @@ inline bool FilesystemConnector::setParams(DataLoaderFilesystemParams params) {
     return DataLoader_FilesystemConnector_setParams(this, params);
 }
 
+inline bool FilesystemConnector::setWriteCoalescing(DataLoaderWriteCoalescingParams params) {
+    return DataLoader_FilesystemConnector_setWriteCoalescing(this, params);
+}
+
+inline bool FilesystemConnector::setReadDeadlines(DataLoaderReadDeadlineParams params) {
+    return DataLoader_FilesystemConnector_setReadDeadlines(this, params);
+}
+
+inline DataLoaderReadDeadlineStats FilesystemConnector::readDeadlineStats() {
+    DataLoaderReadDeadlineStats stats = {};
+    DataLoader_FilesystemConnector_getReadDeadlineStats(this, &stats);
+    return stats;
+}
+
+inline bool FilesystemConnector::setPrepareImageStreaming(int chunkSize, DataLoader* loader) {
+    return DataLoader_FilesystemConnector_setPrepareImageStreaming(
+            this,
+            {.chunkSize = chunkSize,
+             .onFiles =
+                     [](void* cookie, const ::DataLoaderInstallationFile files[], int filesCount) {
+                         static_cast<DataLoader*>(cookie)->onPrepareImageFiles(
+                                 DataLoaderInstallationFiles(files, filesCount));
+                     },
+             .cookie = loader});
+}
+
+inline int FilesystemConnector::flushBlocks() {
+    return DataLoader_FilesystemConnector_flushBlocks(this);
+}
+
+inline int FilesystemConnector::prefillHashTrees(Span<const FileId> files,
+                                                 const HashTreeSource& source) {
+    return DataLoader_FilesystemConnector_prefillHashTrees(
+            this, files.data(), files.size(),
+            [](void* cookie, IncFsFileId fileId, char* tree, IncFsSize treeSize) {
+                return (*static_cast<const HashTreeSource*>(cookie))(fileId,
+                                                                     {tree, size_t(treeSize)});
+            },
+            const_cast<HashTreeSource*>(&source));
+}
+
 inline bool StatusListener::reportStatus(DataLoaderStatus status) {
     return DataLoader_StatusListener_reportStatus(this, status);
 }
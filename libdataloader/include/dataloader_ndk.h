@@ -62,6 +62,54 @@ typedef struct {
     bool readLogsEnabled;
 } DataLoaderFilesystemParams;
 
+typedef struct {
+    // Maximum size of the block data to keep in the buffer before writing it into IncFS.
+    // 0 disables write coalescing.
+    int32_t maxBufferedBytes;
+    // Maximum time a block may stay in the buffer.
+    int32_t maxDelayMs;
+} DataLoaderWriteCoalescingParams;
+
+typedef struct {
+    // How long the kernel lets a read wait before failing it, same as the mount's read timeout.
+    // 0 disables deadline tracking.
+    int32_t readTimeoutMs;
+    // Reads still pending after this percentage of the timeout are passed to onPendingReads()
+    // again, so the loader can retry or re-prioritize them. 0 disables the re-delivery.
+    int32_t hedgePercent;
+    // Reads satisfied with less than this percentage of the timeout left count as near misses.
+    int32_t nearMissPercent;
+} DataLoaderReadDeadlineParams;
+
+typedef struct {
+    // Pending reads seen since deadline tracking was enabled.
+    uint64_t reads;
+    // Reads whose blocks got written in time, and the ones of them that barely made it.
+    uint64_t satisfied;
+    uint64_t nearMisses;
+    // Reads passed to onPendingReads() again for crossing the hedge threshold.
+    uint64_t hedged;
+    // Reads that were still waiting for data when their timeout ran out.
+    uint64_t timeouts;
+} DataLoaderReadDeadlineStats;
+
+// Gets a chunk of the files onPrepareImage() is about to be called with.
+typedef void (*DataLoaderInstallationFilesCallback)(void* cookie,
+                                                    const DataLoaderInstallationFile files[],
+                                                    int filesCount);
+
+typedef struct {
+    // Number of files per chunk. 0 disables streaming.
+    int32_t chunkSize;
+    DataLoaderInstallationFilesCallback onFiles;
+    void* cookie;
+} DataLoaderPrepareImageStreamingParams;
+
+// Puts the complete hash tree of the file into |tree| of |treeSize| bytes, laid out the same way
+// IncFS stores it. Returns 0 or -errno. May be called from multiple threads at once.
+typedef int (*DataLoaderHashTreeSource)(void* cookie, IncFsFileId fileId, char* tree,
+                                        IncFsSize treeSize);
+
 #ifdef __cplusplus
 
 typedef class DataLoaderFilesystemConnector {
@@ -119,6 +167,32 @@ int DataLoader_FilesystemConnector_getRawMetadata(DataLoaderFilesystemConnectorP
 bool DataLoader_FilesystemConnector_setParams(DataLoaderFilesystemConnectorPtr,
                                               DataLoaderFilesystemParams params);
 
+// Makes writeBlocks() buffer small writes and submit them in bigger batches. Blocks that satisfy
+// an outstanding pending read are written immediately.
+bool DataLoader_FilesystemConnector_setWriteCoalescing(DataLoaderFilesystemConnectorPtr,
+                                                       DataLoaderWriteCoalescingParams params);
+// Tracks the pending reads until the blocks they wait for get written with writeBlocks(), and
+// delivers them to onPendingReads() earliest deadline first. See DataLoaderReadDeadlineParams.
+bool DataLoader_FilesystemConnector_setReadDeadlines(DataLoaderFilesystemConnectorPtr,
+                                                     DataLoaderReadDeadlineParams params);
+// Returns 0 or -errno.
+int DataLoader_FilesystemConnector_getReadDeadlineStats(DataLoaderFilesystemConnectorPtr,
+                                                        DataLoaderReadDeadlineStats* stats);
+// Makes onPrepareImage() hand the added files to |params.onFiles| chunk by chunk, on a separate
+// thread, while the rest of them are still being received. Lets the loader start creating files
+// early; onPrepareImage() itself is still called with all the files once the last chunk is done.
+bool DataLoader_FilesystemConnector_setPrepareImageStreaming(
+        DataLoaderFilesystemConnectorPtr, DataLoaderPrepareImageStreamingParams params);
+// Writes out all buffered blocks. Returns 0 or the error of a failed buffered write.
+int DataLoader_FilesystemConnector_flushBlocks(DataLoaderFilesystemConnectorPtr);
+
+// Writes the complete hash trees of the verified files first, in parallel across the files, so
+// their pending reads only need the data blocks afterwards. Meant for onPrepareImage()/onStart().
+// Returns the number of files that got hash blocks written, or -errno.
+int DataLoader_FilesystemConnector_prefillHashTrees(DataLoaderFilesystemConnectorPtr,
+                                                    const IncFsFileId fileIds[], int fileIdsCount,
+                                                    DataLoaderHashTreeSource source, void* cookie);
+
 int DataLoader_StatusListener_reportStatus(DataLoaderStatusListenerPtr listener,
                                            DataLoaderStatus status);
 
@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "HashTreePrefill.h"
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <string>
+#include <unordered_map>
+
+#include "IncFsTestMount.h"
+
+using namespace android::dataloader;
+using namespace android::dataloader::test;
+
+class HashTreePrefillTest : public IncFsTestMount {
+protected:
+    // Creates a file with |data|, signed if |withTree|; doesn't write anything into it.
+    void makeFile(std::string_view name, FileId id, const std::string& data, bool withTree) {
+        std::vector<char> signature;
+        if (withTree) {
+            signature = makeSignature(data, &trees_[id]);
+        }
+        ASSERT_EQ(0,
+                  android::incfs::makeFile(control_, mountPath(name), 0555, id,
+                                           {.size = IncFsSize(data.size()),
+                                            .signature = {signature.data(),
+                                                          IncFsSize(signature.size())}}));
+    }
+
+    int prefill(std::vector<FileId> ids) {
+        return prefillHashTrees(control_, {ids.data(), ids.size()}, &HashTreePrefillTest::source,
+                                this);
+    }
+
+    static int source(void* cookie, FileId id, char* tree, IncFsSize treeSize) {
+        auto self = (HashTreePrefillTest*)cookie;
+        const auto it = self->trees_.find(id);
+        if (it == self->trees_.end() || IncFsSize(it->second.size()) != treeSize) {
+            return -EINVAL;
+        }
+        std::copy(it->second.begin(), it->second.end(), tree);
+        ++self->calls_;
+        return 0;
+    }
+
+    android::incfs::FilledRanges ranges(FileId id) {
+        const auto fd = android::incfs::openForSpecialOps(control_, id);
+        auto [res, ranges] = android::incfs::getFilledRanges(fd.get());
+        EXPECT_EQ(0, res);
+        return std::move(ranges);
+    }
+
+    std::unordered_map<FileId, std::vector<char>> trees_;
+    std::atomic<int> calls_ = 0;
+};
+
+TEST_F(HashTreePrefillTest, FillsSignedFiles) {
+    // Small files have no tree to fill.
+    const std::string big(300 * kBlockSize + 5, 'b');
+    const std::string other(3 * kBlockSize, 'o');
+    makeFile("big", fileId(1), big, true);
+    makeFile("other", fileId(2), other, true);
+    makeFile("unsigned", fileId(3), big, false);
+    makeFile("small", fileId(4), "small", true);
+
+    EXPECT_EQ(2, prefill({fileId(1), fileId(2), fileId(3), fileId(4)}));
+    EXPECT_EQ(2, calls_);
+    for (auto id : {fileId(1), fileId(2)}) {
+        const auto filled = ranges(id);
+        ASSERT_EQ(1u, filled.hashRanges().size());
+        EXPECT_EQ(IncFsSize(trees_[id].size()) / kBlockSize,
+                  IncFsSize(filled.hashRanges()[0].size()));
+        EXPECT_EQ(0u, filled.dataRanges().size());
+    }
+
+    // The tree got accepted: the data can be written and read back.
+    const auto fd = android::incfs::openForSpecialOps(control_, fileId(1));
+    std::vector<DataBlock> blocks;
+    for (IncFsSize offset = 0; offset < IncFsSize(big.size()); offset += kBlockSize) {
+        blocks.push_back({
+                .fileFd = fd.get(),
+                .pageIndex = IncFsBlockIndex(offset / kBlockSize),
+                .compression = INCFS_COMPRESSION_KIND_NONE,
+                .kind = INCFS_BLOCK_KIND_DATA,
+                .dataSize = uint32_t(std::min<IncFsSize>(kBlockSize, big.size() - offset)),
+                .data = big.data() + offset,
+        });
+    }
+    ASSERT_EQ(int(blocks.size()), android::incfs::writeBlocks(blocks));
+    std::string contents;
+    ASSERT_TRUE(android::base::ReadFileToString(mountPath("big"), &contents));
+    EXPECT_EQ(big, contents);
+
+    // Nothing left to do the second time.
+    EXPECT_EQ(0, prefill({fileId(1), fileId(2)}));
+    EXPECT_EQ(2, calls_);
+}
+
+TEST_F(HashTreePrefillTest, SourceErrors) {
+    makeFile("file", fileId(1), std::string(3 * kBlockSize, 'f'), true);
+    trees_.clear();
+    EXPECT_EQ(-EINVAL, prefill({fileId(1)}));
+    EXPECT_EQ(0u, ranges(fileId(1)).hashRanges().size());
+    EXPECT_EQ(-EINVAL, prefillHashTrees(control_, {nullptr, 0}, nullptr, nullptr));
+}
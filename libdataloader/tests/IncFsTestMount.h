@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+#include <hashtree.h>
+#include <openssl/sha.h>
+#include <string.h>
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "dataloader.h"
+
+namespace android::dataloader::test {
+
+// A fresh IncFS mount over temporary directories for every test.
+class IncFsTestMount : public ::testing::Test {
+protected:
+    void SetUp() override {
+        if (!android::incfs::enabled()) {
+            GTEST_SKIP() << "test not supported: IncFS is not enabled";
+        }
+        tmp_dir_for_mount_.emplace();
+        tmp_dir_for_image_.emplace();
+        control_ = android::incfs::mount(tmp_dir_for_image_->path, tmp_dir_for_mount_->path,
+                                         {.defaultReadTimeoutMs = 0});
+        ASSERT_GE(control_.cmd(), 0) << "Failed to mount IncFS: " << control_.cmd();
+    }
+
+    void TearDown() override {
+        if (tmp_dir_for_mount_) {
+            android::incfs::unmount(tmp_dir_for_mount_->path);
+        }
+    }
+
+    std::string mountPath(std::string_view name) const {
+        return std::string(tmp_dir_for_mount_->path) + '/' + std::string(name);
+    }
+
+    static FileId fileId(uint64_t i) {
+        FileId id = {};
+        memcpy(id.data, &i, sizeof(i));
+        return id;
+    }
+
+    std::optional<TemporaryDir> tmp_dir_for_mount_;
+    std::optional<TemporaryDir> tmp_dir_for_image_;
+    android::incfs::UniqueControl control_;
+};
+
+// Builds the hash tree of |data| in the IncFS layout and returns a signature with its root
+// hash; |corrupt| flips a bit of the root hash.
+inline std::vector<char> makeSignature(std::string_view data, std::vector<char>* tree = nullptr,
+                                       bool corrupt = false) {
+    namespace hashtree = android::incfs::hashtree;
+    const auto sha256 = [](const char* bytes, size_t size, char* digest) {
+        ::SHA256((const uint8_t*)bytes, size, (uint8_t*)digest);
+    };
+    const auto blockHash = [&](IncFsSize index, char* digest) {
+        char block[kBlockSize] = {};
+        const auto offset = index * kBlockSize;
+        memcpy(block, data.data() + offset, std::min<size_t>(kBlockSize, data.size() - offset));
+        sha256(block, kBlockSize, digest);
+    };
+
+    struct __attribute__((packed)) Signature {
+        uint32_t version = INCFS_SIGNATURE_VERSION;
+        uint32_t hashingSize = sizeof(hashing);
+        struct __attribute__((packed)) Hashing {
+            uint32_t algo = INCFS_HASH_TREE_SHA256;
+            uint8_t log2Blocksize = 12;
+            uint32_t saltSize = 0;
+            uint32_t rootHashSize = INCFS_MAX_HASH_SIZE;
+            char rootHash[INCFS_MAX_HASH_SIZE] = {};
+        } hashing;
+        uint32_t signingSize = 0;
+    } signature;
+
+    const auto geometry = hashtree::geometry(data.size());
+    std::vector<char> levels(hashtree::size(geometry));
+    if (geometry.depth == 0) {
+        if (!data.empty()) {
+            blockHash(0, signature.hashing.rootHash);
+        }
+    } else {
+        auto* leaves = levels.data() + IncFsSize(geometry.levelOffset[0]) * kBlockSize;
+        for (IncFsSize i = 0; i < hashtree::dataBlocks(data.size()); ++i) {
+            blockHash(i, leaves + i * hashtree::kDigestSize);
+        }
+        for (int level = 1; level < geometry.depth; ++level) {
+            const auto* children =
+                    levels.data() + IncFsSize(geometry.levelOffset[level - 1]) * kBlockSize;
+            auto* hashes = levels.data() + IncFsSize(geometry.levelOffset[level]) * kBlockSize;
+            for (int i = 0; i < geometry.levelBlocks[level - 1]; ++i) {
+                sha256(children + IncFsSize(i) * kBlockSize, kBlockSize,
+                       hashes + i * hashtree::kDigestSize);
+            }
+        }
+        // The top level comes first and has a single block.
+        sha256(levels.data(), kBlockSize, signature.hashing.rootHash);
+    }
+    if (corrupt) {
+        signature.hashing.rootHash[0] ^= 1;
+    }
+    if (tree) {
+        *tree = std::move(levels);
+    }
+    const auto raw = (const char*)&signature;
+    return {raw, raw + sizeof(signature)};
+}
+
+} // namespace android::dataloader::test
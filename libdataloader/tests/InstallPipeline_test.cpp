@@ -0,0 +1,177 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "InstallPipeline.h"
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <random>
+#include <string>
+#include <thread>
+
+#include "IncFsTestMount.h"
+
+using namespace android::dataloader;
+using namespace android::dataloader::test;
+using namespace std::literals;
+
+namespace {
+
+constexpr IncFsSize kSizes[] = {0, 1, kBlockSize, kBlockSize + 1, 3 * 1024 * 1024 + 123};
+
+// Half compressible, half random, so both kinds of blocks get written.
+std::string makeData(IncFsSize size, unsigned seed) {
+    std::string data(size, '\0');
+    std::mt19937 random(seed);
+    for (IncFsSize i = 0; i < size; ++i) {
+        data[i] = i < size / 2 ? char(i % 251) : char(random());
+    }
+    return data;
+}
+
+} // namespace
+
+class InstallPipelineTest : public IncFsTestMount {
+protected:
+    void SetUp() override {
+        IncFsTestMount::SetUp();
+        if (IsSkipped() || HasFatalFailure()) {
+            return;
+        }
+        // Every size both unsigned and signed, some of them in subdirectories.
+        for (int signedFile = 0; signedFile < 2; ++signedFile) {
+            for (auto size : kSizes) {
+                const auto i = int(files_.size());
+                auto path = (i % 3 ? "dir/" : "") + ("file_" + std::to_string(i));
+                contents_.push_back(makeData(size, i));
+                files_.push_back({
+                        .path = std::move(path),
+                        .id = fileId(i + 1),
+                        .size = size,
+                        .metadata = {'m', char('0' + i)},
+                        .signature = signedFile ? makeSignature(contents_.back()) : RawMetadata{},
+                });
+            }
+        }
+    }
+
+    void checkFiles() {
+        for (size_t i = 0; i < files_.size(); ++i) {
+            std::string data;
+            ASSERT_TRUE(android::base::ReadFileToString(mountPath(files_[i].path), &data))
+                    << files_[i].path;
+            EXPECT_EQ(contents_[i], data) << files_[i].path;
+            EXPECT_EQ(files_[i].metadata,
+                      android::incfs::getMetadata(control_, files_[i].id));
+        }
+    }
+
+    // Checks the per-stage counters and reports the throughput of each stage.
+    void checkStats(const InstallPipeline& pipeline) {
+        uint64_t total = 0, verified = 0;
+        for (auto&& file : files_) {
+            total += file.size;
+            verified += file.signature.empty() ? 0 : file.size;
+        }
+        const auto& stats = pipeline.stats();
+        ASSERT_EQ(5u, stats.size());
+        EXPECT_STREQ("makeFile", stats[0].name);
+        EXPECT_EQ(files_.size(), stats[0].items);
+        EXPECT_EQ(total, stats[1].bytes);    // fetch
+        EXPECT_EQ(verified, stats[2].bytes); // hash
+        EXPECT_EQ(total, stats[3].bytes);    // compress
+        EXPECT_GT(stats[4].bytes, 0u);       // write: compressed data and hash blocks
+
+        for (auto&& stage : stats) {
+            const auto seconds = std::chrono::duration<double>(stage.busy).count();
+            const auto mbps = seconds > 0 ? stage.bytes / seconds / (1024 * 1024) : 0;
+            RecordProperty(std::string(stage.name) + "_MBps", std::to_string(mbps));
+            RecordProperty(std::string(stage.name) + "_waiting_ms",
+                           std::to_string(stage.waiting.count() / 1000000));
+        }
+        const auto seconds = std::chrono::duration<double>(pipeline.elapsed()).count();
+        RecordProperty("total_MBps", std::to_string(total / seconds / (1024 * 1024)));
+    }
+
+    InstallManifest files_;
+    std::vector<std::string> contents_;
+};
+
+TEST_F(InstallPipelineTest, LocalFileSource) {
+    TemporaryDir source_dir;
+    ASSERT_EQ(0, ::mkdir((source_dir.path + "/dir"s).c_str(), 0777));
+    for (size_t i = 0; i < files_.size(); ++i) {
+        ASSERT_TRUE(android::base::WriteStringToFile(contents_[i],
+                                                     source_dir.path + "/"s + files_[i].path));
+    }
+    LocalFileSource source(source_dir.path);
+    InstallPipeline pipeline(control_, source, {.chunkSize = 256 * 1024});
+    ASSERT_EQ(0, pipeline.run(files_));
+    checkFiles();
+    checkStats(pipeline);
+}
+
+TEST_F(InstallPipelineTest, PipeSource) {
+    int fds[2];
+    ASSERT_EQ(0, ::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds));
+    android::incfs::UniqueFd readEnd(fds[0]);
+    std::thread writer([&, writeEnd = android::incfs::UniqueFd(fds[1])] {
+        for (auto&& data : contents_) {
+            for (size_t done = 0; done < data.size();) {
+                const auto res = TEMP_FAILURE_RETRY(::send(writeEnd.get(), data.data() + done,
+                                                           data.size() - done, MSG_NOSIGNAL));
+                if (res <= 0) {
+                    return;
+                }
+                done += res;
+            }
+        }
+    });
+    {
+        PipeSource source(std::move(readEnd));
+        InstallPipeline pipeline(control_, source, {.chunkSize = 256 * 1024});
+        EXPECT_EQ(0, pipeline.run(files_));
+        checkStats(pipeline);
+    }
+    // The source has closed its end, so the writer can't get stuck.
+    writer.join();
+    checkFiles();
+}
+
+TEST_F(InstallPipelineTest, BadSignatureRemovesFile) {
+    // A single verified file that doesn't match its signature.
+    const auto size = kSizes[std::size(kSizes) - 1];
+    contents_ = {makeData(size, 0)};
+    files_ = {{
+            .path = "bad",
+            .id = fileId(100),
+            .size = size,
+            .signature = makeSignature(contents_[0], nullptr, true),
+    }};
+    TemporaryDir source_dir;
+    ASSERT_TRUE(android::base::WriteStringToFile(contents_[0], source_dir.path + "/bad"s));
+    LocalFileSource source(source_dir.path);
+    InstallPipeline pipeline(control_, source, {.chunkSize = 256 * 1024});
+    EXPECT_EQ(-EBADMSG, pipeline.run(files_));
+
+    // Its data may have been written already, so the whole file is gone instead.
+    EXPECT_FALSE(android::incfs::openForSpecialOps(control_, fileId(100)).ok());
+    EXPECT_NE(0, ::access(mountPath("bad").c_str(), F_OK));
+}
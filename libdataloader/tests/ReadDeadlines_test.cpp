@@ -0,0 +1,194 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ReadDeadlines.h"
+
+#include <gtest/gtest.h>
+#include <string.h>
+#include <time.h>
+
+#include <thread>
+
+using namespace android::dataloader;
+using namespace std::literals;
+
+namespace {
+
+constexpr uint64_t kTimeoutUs = 10'000'000;
+
+uint64_t nowUs() {
+    timespec ts;
+    ::clock_gettime(CLOCK_BOOTTIME, &ts);
+    return uint64_t(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+FileId fileId(uint64_t i) {
+    FileId id = {};
+    memcpy(id.data, &i, sizeof(i));
+    return id;
+}
+
+} // namespace
+
+class ReadDeadlineTrackerTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        tracker_.setParams({.readTimeoutMs = kTimeoutUs / 1000,
+                            .hedgePercent = 50,
+                            .nearMissPercent = 20});
+    }
+
+    // A read of |block| of file 1 that started |agoUs| back.
+    ReadInfo read(IncFsBlockIndex block, uint64_t agoUs) {
+        return {.id = fileId(1), .bootClockTsUs = nowUs() - agoUs, .block = block,
+                .serialNo = serial_++};
+    }
+
+    void written(std::vector<IncFsBlockIndex> indices, FileId id = fileId(1)) {
+        std::vector<DataBlock> blocks;
+        for (auto index : indices) {
+            blocks.push_back({.pageIndex = index, .kind = INCFS_BLOCK_KIND_DATA});
+        }
+        const std::vector<FdFile> files(blocks.size(), FdFile{.id = id});
+        tracker_.onBlocksWritten({blocks.data(), blocks.size()}, {files.data(), files.size()});
+    }
+
+    ReadDeadlineTracker tracker_;
+    uint32_t serial_ = 1;
+};
+
+TEST_F(ReadDeadlineTrackerTest, Disabled) {
+    tracker_.setParams({});
+    EXPECT_FALSE(tracker_.enabled());
+    std::vector reads = {read(0, 0)};
+    tracker_.onPendingReads(reads);
+    EXPECT_FALSE(tracker_.tracking());
+    EXPECT_FALSE(tracker_.nextDeadline());
+    EXPECT_EQ(0u, tracker_.stats().reads);
+}
+
+TEST_F(ReadDeadlineTrackerTest, SortsByDeadline) {
+    std::vector reads = {read(1, 1'000'000), read(2, 3'000'000), read(3, 2'000'000)};
+    tracker_.onPendingReads(reads);
+    ASSERT_EQ(3u, reads.size());
+    EXPECT_EQ(2, reads[0].block);
+    EXPECT_EQ(3, reads[1].block);
+    EXPECT_EQ(1, reads[2].block);
+    EXPECT_EQ(3u, tracker_.stats().reads);
+
+    // The earliest one crosses the hedge threshold in 2s.
+    const auto next = tracker_.nextDeadline();
+    ASSERT_TRUE(next);
+    EXPECT_LE(*next, 2s);
+    EXPECT_GT(*next, 1s);
+}
+
+TEST_F(ReadDeadlineTrackerTest, HedgesOnce) {
+    std::vector reads = {read(1, 1'000'000), read(2, 6'000'000), read(3, 7'000'000)};
+    tracker_.onPendingReads(reads);
+    EXPECT_EQ(0s, *tracker_.nextDeadline());
+
+    std::vector<ReadInfo> hedged;
+    EXPECT_EQ(0, tracker_.onDeadlines(hedged));
+    ASSERT_EQ(2u, hedged.size());
+    EXPECT_EQ(3, hedged[0].block);
+    EXPECT_EQ(2, hedged[1].block);
+    EXPECT_EQ(2u, tracker_.stats().hedged);
+
+    // Not again, but they're still tracked.
+    hedged.clear();
+    EXPECT_EQ(0, tracker_.onDeadlines(hedged));
+    EXPECT_TRUE(hedged.empty());
+    EXPECT_TRUE(tracker_.tracking());
+    EXPECT_GT(*tracker_.nextDeadline(), 1s);
+}
+
+TEST_F(ReadDeadlineTrackerTest, SatisfiedAndNearMisses) {
+    std::vector reads = {read(1, 0), read(2, 9'000'000), read(3, 0)};
+    tracker_.onPendingReads(reads);
+
+    // Wrong file, wrong block, and a hash block: nothing.
+    written({1, 2}, fileId(2));
+    written({4});
+    DataBlock hash = {.pageIndex = 1, .kind = INCFS_BLOCK_KIND_HASH};
+    const FdFile file = {.id = fileId(1)};
+    tracker_.onBlocksWritten({&hash, 1}, {&file, 1});
+    EXPECT_EQ(0u, tracker_.stats().satisfied);
+
+    written({1, 2});
+    auto stats = tracker_.stats();
+    EXPECT_EQ(2u, stats.satisfied);
+    EXPECT_EQ(1u, stats.nearMisses);
+    EXPECT_EQ(0u, stats.timeouts);
+    EXPECT_TRUE(tracker_.tracking());
+
+    written({3});
+    EXPECT_EQ(3u, tracker_.stats().satisfied);
+    EXPECT_FALSE(tracker_.tracking());
+}
+
+TEST_F(ReadDeadlineTrackerTest, Timeouts) {
+    std::vector reads = {read(1, kTimeoutUs + 1'000'000), read(2, kTimeoutUs - 20'000),
+                         read(3, 0)};
+    tracker_.onPendingReads(reads);
+
+    std::vector<ReadInfo> hedged;
+    EXPECT_EQ(1, tracker_.onDeadlines(hedged));
+    EXPECT_EQ(1u, tracker_.stats().timeouts);
+    // The one that's about to expire got hedged.
+    ASSERT_EQ(1u, hedged.size());
+    EXPECT_EQ(2, hedged[0].block);
+
+    // Its data comes too late.
+    std::this_thread::sleep_for(50ms);
+    written({2});
+    auto stats = tracker_.stats();
+    EXPECT_EQ(2u, stats.timeouts);
+    EXPECT_EQ(0u, stats.satisfied);
+    EXPECT_TRUE(tracker_.tracking());
+}
+
+TEST_F(ReadDeadlineTrackerTest, DuplicatesAndCap) {
+    std::vector reads = {read(1, 0), read(1, 0)};
+    tracker_.onPendingReads(reads);
+    EXPECT_EQ(1u, tracker_.stats().reads);
+
+    reads.clear();
+    for (size_t i = 0; i < ReadDeadlineTracker::kMaxTrackedReads + 10; ++i) {
+        reads.push_back(read(i + 2, 0));
+    }
+    tracker_.onPendingReads(reads);
+    EXPECT_EQ(ReadDeadlineTracker::kMaxTrackedReads, tracker_.stats().reads);
+
+    // Satisfying some makes room for more.
+    written({1, 2});
+    reads = {read(100'000, 0)};
+    tracker_.onPendingReads(reads);
+    EXPECT_EQ(ReadDeadlineTracker::kMaxTrackedReads + 1, tracker_.stats().reads);
+}
+
+TEST_F(ReadDeadlineTrackerTest, Clear) {
+    std::vector reads = {read(1, 6'000'000)};
+    tracker_.onPendingReads(reads);
+    tracker_.clear();
+    EXPECT_FALSE(tracker_.tracking());
+    EXPECT_FALSE(tracker_.nextDeadline());
+    std::vector<ReadInfo> hedged;
+    EXPECT_EQ(0, tracker_.onDeadlines(hedged));
+    EXPECT_TRUE(hedged.empty());
+    // The stats survive.
+    EXPECT_EQ(1u, tracker_.stats().reads);
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ReadLogBatching.h"
+
+#include <gtest/gtest.h>
+
+using namespace android::dataloader;
+using namespace std::literals;
+
+TEST(ReadLogBatchingTest, GrowsForSmallBatches) {
+    ReadLogBatching batching;
+    EXPECT_EQ(1ms, batching.onWakeup(1));
+    EXPECT_EQ(2ms, batching.onWakeup(1));
+    EXPECT_EQ(4ms, batching.onWakeup(1));
+    for (int i = 0; i < 10; ++i) {
+        batching.onWakeup(1);
+    }
+    EXPECT_EQ(ReadLogBatching::kMaxDelay, batching.onWakeup(1));
+}
+
+TEST(ReadLogBatchingTest, ShrinksForLargeBatches) {
+    ReadLogBatching batching;
+    for (int i = 0; i < 3; ++i) {
+        batching.onWakeup(1);
+    }
+    EXPECT_EQ(2ms, batching.onWakeup(ReadLogBatching::kTargetBatch));
+    EXPECT_EQ(1ms, batching.onWakeup(ReadLogBatching::kTargetBatch));
+    EXPECT_EQ(0ms, batching.onWakeup(ReadLogBatching::kTargetBatch));
+    EXPECT_EQ(0ms, batching.onWakeup(ReadLogBatching::kTargetBatch));
+}
+
+TEST(ReadLogBatchingTest, DroppedRecordsCapTheDelay) {
+    ReadLogBatching batching;
+    for (int i = 0; i < 10; ++i) {
+        batching.onWakeup(1);
+    }
+    ASSERT_EQ(ReadLogBatching::kMaxDelay, batching.onWakeup(1));
+
+    // Every overflow halves the cap, and the current delay follows right away.
+    batching.onDroppedRecords();
+    EXPECT_EQ(ReadLogBatching::kMaxDelay / 2, batching.onWakeup(1));
+    batching.onDroppedRecords();
+    EXPECT_EQ(ReadLogBatching::kMaxDelay / 4, batching.onWakeup(1));
+    for (int i = 0; i < 10; ++i) {
+        batching.onDroppedRecords();
+    }
+    EXPECT_EQ(0ms, batching.onWakeup(1));
+
+    // Until the next start.
+    batching.reset();
+    for (int i = 0; i < 10; ++i) {
+        batching.onWakeup(1);
+    }
+    EXPECT_EQ(ReadLogBatching::kMaxDelay, batching.onWakeup(1));
+}
@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "WriteCoalescer.h"
+
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <thread>
+
+#include "FileIds.h"
+#include "IncFsTestMount.h"
+
+using namespace android::dataloader;
+using namespace android::dataloader::test;
+using namespace std::literals;
+
+class WriteCoalescerTest : public IncFsTestMount {
+protected:
+    static constexpr IncFsSize kFileBlocks = 16;
+
+    void SetUp() override {
+        IncFsTestMount::SetUp();
+        if (IsSkipped() || HasFatalFailure()) {
+            return;
+        }
+        fd_ = makeFile("file", fileId(1));
+        ASSERT_TRUE(fd_.ok());
+    }
+
+    android::incfs::UniqueFd makeFile(std::string_view name, FileId id) {
+        EXPECT_EQ(0,
+                  android::incfs::makeFile(control_, mountPath(name), 0555, id,
+                                           {.size = kFileBlocks * kBlockSize}));
+        return android::incfs::openForSpecialOps(control_, id);
+    }
+
+    int write(IncFsBlockIndex first, IncFsBlockIndex count) {
+        std::vector<DataBlock> blocks;
+        for (auto i = first; i < first + count; ++i) {
+            blocks.push_back({
+                    .fileFd = fd_.get(),
+                    .pageIndex = i,
+                    .compression = INCFS_COMPRESSION_KIND_NONE,
+                    .kind = INCFS_BLOCK_KIND_DATA,
+                    .dataSize = kBlockSize,
+                    .data = data_.data(),
+            });
+        }
+        std::vector<FdFile> files;
+        ids_.resolve({blocks.data(), blocks.size()}, &files);
+        return coalescer_.write({blocks.data(), blocks.size()}, {files.data(), files.size()});
+    }
+
+    IncFsBlockIndex filledBlocks() {
+        auto [res, ranges] = android::incfs::getFilledRanges(fd_.get());
+        EXPECT_EQ(0, res);
+        IncFsBlockIndex filled = 0;
+        for (auto&& range : ranges.dataRanges()) {
+            filled += range.size();
+        }
+        return filled;
+    }
+
+    void pendingRead(IncFsBlockIndex block) {
+        const ReadInfo read = {.id = fileId(1), .block = block};
+        coalescer_.onPendingReads({&read, 1});
+    }
+
+    const std::vector<char> data_ = std::vector<char>(kBlockSize, 'x');
+    android::incfs::UniqueFd fd_;
+    FileIdCache ids_;
+    WriteCoalescer coalescer_;
+};
+
+TEST_F(WriteCoalescerTest, FileIdCache) {
+    EXPECT_EQ(fileId(1), ids_.get(fd_.get()).id);
+    EXPECT_EQ(fileId(1), ids_.get(fd_.get()).id);
+
+    // Same fd number, different file.
+    const auto other = makeFile("other", fileId(2));
+    ASSERT_TRUE(other.ok());
+    ASSERT_EQ(fd_.get(), ::dup2(other.get(), fd_.get()));
+    EXPECT_EQ(fileId(2), ids_.get(fd_.get()).id);
+
+    EXPECT_FALSE(android::incfs::isValidFileId(ids_.get(-1).id));
+}
+
+TEST_F(WriteCoalescerTest, Disabled) {
+    EXPECT_FALSE(coalescer_.enabled());
+    EXPECT_EQ(2, write(0, 2));
+    EXPECT_EQ(2, filledBlocks());
+}
+
+TEST_F(WriteCoalescerTest, FlushesOnSize) {
+    coalescer_.setParams({.maxBufferedBytes = 4 * kBlockSize, .maxDelayMs = 60000});
+    ASSERT_TRUE(coalescer_.enabled());
+    EXPECT_EQ(1, write(0, 1));
+    EXPECT_EQ(2, write(1, 2));
+    EXPECT_EQ(0, filledBlocks());
+    EXPECT_EQ(1, write(3, 1));
+    EXPECT_EQ(4, filledBlocks());
+    EXPECT_FALSE(coalescer_.nextDeadline());
+
+    // A write that's big enough on its own goes out right away.
+    EXPECT_EQ(4, write(4, 4));
+    EXPECT_EQ(8, filledBlocks());
+}
+
+TEST_F(WriteCoalescerTest, FlushesOnDeadline) {
+    coalescer_.setParams({.maxBufferedBytes = 1024 * 1024, .maxDelayMs = 50});
+    EXPECT_EQ(1, write(0, 1));
+    ASSERT_TRUE(coalescer_.nextDeadline());
+    coalescer_.flushExpired();
+    EXPECT_EQ(0, filledBlocks());
+
+    std::this_thread::sleep_until(*coalescer_.nextDeadline());
+    coalescer_.flushExpired();
+    EXPECT_EQ(1, filledBlocks());
+    EXPECT_FALSE(coalescer_.nextDeadline());
+}
+
+TEST_F(WriteCoalescerTest, FlushesForPendingReads) {
+    coalescer_.setParams({.maxBufferedBytes = 1024 * 1024, .maxDelayMs = 60000});
+
+    // A pending read for a block that comes later: the block skips the buffer, and takes the
+    // buffered ones of the same file with it.
+    EXPECT_EQ(1, write(0, 1));
+    pendingRead(5);
+    EXPECT_EQ(0, filledBlocks());
+    EXPECT_EQ(1, write(5, 1));
+    EXPECT_EQ(2, filledBlocks());
+
+    // A pending read for an already buffered block flushes it.
+    EXPECT_EQ(1, write(7, 1));
+    EXPECT_EQ(2, filledBlocks());
+    pendingRead(7);
+    EXPECT_EQ(3, filledBlocks());
+
+    // Unrelated reads don't.
+    EXPECT_EQ(1, write(9, 1));
+    pendingRead(10);
+    EXPECT_EQ(3, filledBlocks());
+    EXPECT_EQ(0, coalescer_.flush());
+    EXPECT_EQ(4, filledBlocks());
+}